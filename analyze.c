@@ -0,0 +1,230 @@
+// Prints what cfg.h finds in each ROM without running it: how much of it is
+// code, its subroutines and who calls them, indirect jumps, writes that may
+// modify code, and a map of the ROM, 64 bytes to a line:
+//
+//     c  code      s  sprite      d  data      .  nothing reaches it
+//
+// -l adds every basic block with its instructions, -q prints one line per
+// ROM and nothing else.
+//
+// Usage: ./chip8_analyze [-q | -l] <rom>...
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "chip8.h"
+#include "cfg.h"
+#include "disasm.h"
+
+#include <unistd.h>
+
+#define MAP_LINE 64
+
+static const char map_chars[CFG_KINDS] = { '.', 'c', 's', 'd' };
+
+static const char* const exit_names[CFG_EXITS] = {
+    "falls into", "jumps to", "calls", "returns", "skips to", "jumps indirect",
+    "faults", "runs off the ROM"
+};
+
+static void usage(){
+    fprintf(stderr,
+        "Usage: ./chip8_analyze [-q | -l] <rom>...\n"
+        "  -q             one line per ROM\n"
+        "  -l             list every block\n");
+    exit(2);
+}
+
+static double now_seconds(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_routines(const Chip8Cfg* cfg){
+    printf("routines:\n");
+    for (unsigned r = 0; r < cfg->num_routines; r++)
+    {
+        unsigned entry = cfg->routines[r];
+        unsigned callers = 0;
+
+        for (unsigned i = 0; i < cfg->num_calls; i++)
+        {
+            callers += cfg->calls[i].addr == entry;
+        }
+        printf("  0x%03x  %-8s %u caller%s%s", entry, entry == CFG_ENTRY ? "main" : "sub",
+               callers, callers == 1 ? "" : "s", entry == CFG_ENTRY || cfg->returns[r] ? "" : ", never returns");
+
+        // Callees, once each, from the blocks this routine owns
+        printf(", calls");
+        unsigned printed = 0;
+        for (unsigned i = 0; i < cfg->num_calls; i++)
+        {
+            const Chip8CfgBlock* b = Chip8CfgBlockOf(cfg, cfg->calls[i].pc);
+            bool dup = false;
+
+            if (b == NULL || b->routine != entry)
+            {
+                continue;
+            }
+            for (unsigned j = 0; j < i && !dup; j++)
+            {
+                const Chip8CfgBlock* o = Chip8CfgBlockOf(cfg, cfg->calls[j].pc);
+                dup = o != NULL && o->routine == entry && cfg->calls[j].addr == cfg->calls[i].addr;
+            }
+            if (!dup)
+            {
+                printf(" 0x%03x", cfg->calls[i].addr);
+                printed++;
+            }
+        }
+        printf("%s\n", printed ? "" : " nothing");
+    }
+}
+
+static void print_sites(const char* title, const Chip8CfgSite* sites, unsigned num){
+    if (num == 0)
+    {
+        return;
+    }
+    printf("%s:\n", title);
+    for (unsigned i = 0; i < num; i++)
+    {
+        char text[DISASM_MAX];
+
+        Chip8Disassemble(sites[i].opcode, text);
+        printf("  0x%03x  %-17s", sites[i].pc, text);
+        if (sites[i].addr == CFG_NONE)
+        {
+            printf(" unknown\n");
+        }
+        else
+        {
+            printf(" 0x%03x%s\n", sites[i].addr, sites[i].hits_code ? ", over code" : "");
+        }
+    }
+}
+
+static void print_blocks(const Chip8Cfg* cfg, const uint8_t* rom){
+    printf("blocks:\n");
+    for (unsigned i = 0; i < cfg->num_blocks; i++)
+    {
+        const Chip8CfgBlock* b = &cfg->blocks[i];
+
+        printf("  0x%03x-0x%03x in 0x%03x, %s", b->start, b->end - 1, b->routine, exit_names[b->exit]);
+        for (int j = 0; j < 2; j++)
+        {
+            if (b->next[j] != CFG_NONE)
+            {
+                printf(" 0x%03x", b->next[j]);
+            }
+        }
+        printf("\n");
+        for (unsigned pc = b->start; pc < b->end; pc += 2)
+        {
+            uint16_t op = rom[pc - CFG_ENTRY] << 8 | rom[pc + 1 - CFG_ENTRY];
+            char text[DISASM_MAX];
+
+            Chip8Disassemble(op, text);
+            printf("      0x%03x  %04x  %s\n", pc, op, text);
+        }
+    }
+}
+
+static void print_map(const Chip8Cfg* cfg){
+    char line[MAP_LINE + 1];
+
+    printf("map:\n");
+    for (unsigned a = CFG_ENTRY; a < CFG_ENTRY + cfg->rom_size; a += MAP_LINE)
+    {
+        unsigned n = 0;
+
+        for (; n < MAP_LINE && a + n < CFG_ENTRY + cfg->rom_size; n++)
+        {
+            line[n] = map_chars[cfg->kind[a + n]];
+        }
+        line[n] = '\0';
+        printf("  0x%03x  %s\n", a, line);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    bool quiet = false, list = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "ql")) != -1)
+    {
+        switch (opt)
+        {
+            case 'q': quiet = true; break;
+            case 'l': list = true; break;
+            default: usage();
+        }
+    }
+    if (optind >= argc || (quiet && list))
+    {
+        usage();
+    }
+
+    for (int i = optind; i < argc; i++)
+    {
+        uint8_t rom[MAX_GAME_SIZE];
+        unsigned size, counts[CFG_KINDS];
+        Chip8Cfg* cfg;
+        double start;
+        FILE* fptr = fopen(argv[i], "rb");
+
+        if (fptr == NULL)
+        {
+            fprintf(stderr, "Unable to open game: %s\n", argv[i]);
+            exit(2);
+        }
+        size = (unsigned) fread(rom, 1, MAX_GAME_SIZE, fptr);
+        fclose(fptr);
+
+        start = now_seconds();
+        cfg = Chip8CfgBuild(rom, size);
+        if (cfg == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        double took = now_seconds() - start;
+        Chip8CfgCount(cfg, counts);
+
+        if (quiet)
+        {
+            printf("%s: %u bytes, %u code, %u sprite, %u data, %u unknown, %u blocks, %u routines, "
+                   "%u indirect, %u writes, %.3f ms\n", argv[i], size, counts[CFG_CODE],
+                   counts[CFG_SPRITE], counts[CFG_DATA], counts[CFG_UNKNOWN], cfg->num_blocks,
+                   cfg->num_routines, cfg->num_indirect, cfg->num_writes, took * 1e3);
+            Chip8CfgFree(cfg);
+            continue;
+        }
+
+        printf("%s: %u bytes in %.3f ms\n", argv[i], size, took * 1e3);
+        printf("  %u code, %u sprite, %u data, %u unknown\n", counts[CFG_CODE], counts[CFG_SPRITE],
+               counts[CFG_DATA], counts[CFG_UNKNOWN]);
+        printf("  %u blocks, %u routines, %u calls", cfg->num_blocks, cfg->num_routines, cfg->num_calls);
+        if (cfg->overlaps > 0)
+        {
+            printf(", %u instructions overlapping others", cfg->overlaps);
+        }
+        printf("\n");
+        print_routines(cfg);
+        print_sites("indirect jumps", cfg->indirect, cfg->num_indirect);
+        print_sites("writes that may modify code", cfg->writes, cfg->num_writes);
+        if (list)
+        {
+            print_blocks(cfg, rom);
+        }
+        print_map(cfg);
+        if (i + 1 < argc)
+        {
+            printf("\n");
+        }
+        Chip8CfgFree(cfg);
+    }
+    return 0;
+}
@@ -0,0 +1,763 @@
+#include "chip8.h"
+#include "chip8_ops.h"
+#include "batch.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define BATCH_AVX2
+#endif
+
+#define LANE_BIT(lane) (1u << (lane))
+
+Chip8Batch* Chip8BatchCreate(void){
+    return calloc(1, sizeof(Chip8Batch));
+}
+
+void Chip8BatchFree(Chip8Batch* batch){
+    free(batch);
+}
+
+void Chip8BatchSetLane(Chip8Batch* batch, unsigned lane, const CHIP8* chip8){
+    uint8_t memory[MEM_SIZE];
+
+    Chip8ReadMemory(chip8, 0, memory, MEM_SIZE);
+    for (int i = 0; i < MEM_SIZE; i++)
+    {
+        batch->memory[i][lane] = memory[i];
+    }
+    for (int row = 0; row < GFX_ROWS; row++)
+    {
+        batch->fb[row][lane] = chip8->fb[row];
+    }
+    for (int r = 0; r < 16; r++)
+    {
+        batch->V[r][lane] = chip8->registers[r];
+    }
+    for (int k = 0; k < KEYPAD_SIZE; k++)
+    {
+        batch->key[k][lane] = chip8->key[k];
+    }
+    for (int s = 0; s < STACK_SIZE; s++)
+    {
+        batch->stack[s][lane] = chip8->stack[s];
+    }
+    batch->DelayTimer[lane]    = chip8->DelayTimer;
+    batch->SoundTimer[lane]    = chip8->SoundTimer;
+    batch->draw_flag[lane]     = chip8->draw_flag;
+    batch->opcode[lane]        = chip8->opcode;
+    batch->PC[lane]            = chip8->PC;
+    batch->IndexRegister[lane] = chip8->IndexRegister;
+    batch->stkptr[lane]        = chip8->stkptr;
+    batch->dirty_rows[lane]    = chip8->dirty_rows;
+    batch->rng[lane]           = chip8->rng;
+    batch->ticks[lane]         = chip8->ticks;
+    batch->cycles[lane]        = chip8->cycles;
+    batch->fault[lane]         = chip8->fault;
+    batch->live |= LANE_BIT(lane);
+    if (chip8->waiting)
+    {
+        batch->waiting |= LANE_BIT(lane);
+    }
+    else
+    {
+        batch->waiting &= ~LANE_BIT(lane);
+    }
+}
+
+void Chip8BatchGetLane(const Chip8Batch* batch, unsigned lane, CHIP8* chip8){
+    uint8_t memory[MEM_SIZE];
+
+    for (int i = 0; i < MEM_SIZE; i++)
+    {
+        memory[i] = batch->memory[i][lane];
+    }
+    for (int row = 0; row < GFX_ROWS; row++)
+    {
+        chip8->fb[row] = batch->fb[row][lane];
+    }
+    for (int r = 0; r < 16; r++)
+    {
+        chip8->registers[r] = batch->V[r][lane];
+    }
+    for (int k = 0; k < KEYPAD_SIZE; k++)
+    {
+        chip8->key[k] = batch->key[k][lane];
+    }
+    for (int s = 0; s < STACK_SIZE; s++)
+    {
+        chip8->stack[s] = batch->stack[s][lane];
+    }
+    chip8->DelayTimer    = batch->DelayTimer[lane];
+    chip8->SoundTimer    = batch->SoundTimer[lane];
+    chip8->draw_flag     = batch->draw_flag[lane];
+    chip8->opcode        = batch->opcode[lane];
+    chip8->PC            = batch->PC[lane];
+    chip8->IndexRegister = batch->IndexRegister[lane];
+    chip8->stkptr        = batch->stkptr[lane];
+    chip8->dirty_rows    = batch->dirty_rows[lane];
+    chip8->rng           = batch->rng[lane];
+    chip8->ticks         = batch->ticks[lane];
+    chip8->cycles        = batch->cycles[lane];
+    chip8->waiting       = (batch->waiting & LANE_BIT(lane)) != 0;
+    chip8->fault         = batch->fault[lane];
+
+    // Only the pages the lane wrote get copied, and only they are dropped
+    // from whatever the machine had cached
+    Chip8WriteMemory(chip8, 0, memory, MEM_SIZE);
+}
+
+void Chip8BatchSetKey(Chip8Batch* batch, unsigned lane, uint8_t key, uint8_t down){
+    batch->key[key][lane] = down;
+}
+
+void Chip8BatchTick(Chip8Batch* batch){
+    for (int lane = 0; lane < CHIP8_LANES; lane++)
+    {
+        batch->ticks[lane]++;
+        if (batch->DelayTimer[lane] > 0)
+        {
+            batch->DelayTimer[lane]--;
+        }
+        if (batch->SoundTimer[lane] > 0)
+        {
+            batch->SoundTimer[lane]--;
+        }
+    }
+}
+
+static inline uint16_t fetch(const Chip8Batch* b, unsigned lane){
+    uint16_t PC = b->PC[lane];
+    return b->memory[PC & MEM_MASK][lane] << 8 | b->memory[(PC + 1) & MEM_MASK][lane];
+}
+
+// Halts the lane on the instruction it is at, as EmulateCycle faults a
+// machine. wake_lanes leaves it alone.
+static void fault_lane(Chip8Batch* b, unsigned l, Chip8Fault kind){
+    b->fault[l] = kind;
+    b->waiting |= LANE_BIT(l);
+}
+
+// One instruction on one lane, exactly like the EmulateCycle case. The
+// vector path hands anything irregular (stack, memory, sprites, keys, random
+// numbers) to this one lane at a time.
+static void step_lane(Chip8Batch* b, unsigned l, uint16_t opcode){
+    uint8_t  x   = (opcode >> 8) & 0x000F;
+    uint8_t  y   = (opcode >> 4) & 0x000F;
+    uint8_t  n   = opcode & 0x000F;
+    uint8_t  kk  = opcode & 0x00FF;
+    uint16_t nnn = opcode & 0x0FFF;
+    uint8_t  pressed;
+    int i;
+
+#define V(r) (b->V[r][l])
+#define PC   (b->PC[l])
+#define I    (b->IndexRegister[l])
+#define FAULT(kind) do { fault_lane(b, l, kind); return; } while (0)
+
+    b->opcode[l] = opcode;
+    switch (opcode & 0xF000)
+    {
+        case 0x0000:
+            if (kk == 0xE0)
+            {
+                for (i = 0; i < GFX_ROWS; i++)
+                {
+                    b->fb[i][l] = 0;
+                }
+                b->draw_flag[l] = 1;
+                b->dirty_rows[l] = ~0u;
+                PC += 2;
+            }
+            else if (kk == 0xEE)
+            {
+                if (b->stkptr[l] == 0)
+                {
+                    FAULT(CHIP8_FAULT_STACK_UNDERFLOW);
+                }
+                PC = b->stack[--b->stkptr[l]][l];
+            }
+            else
+            {
+                FAULT(CHIP8_FAULT_OPCODE);
+            }
+            break;
+
+        case 0x1000: PC = nnn; break;
+        case 0x2000:
+            if (b->stkptr[l] >= STACK_SIZE)
+            {
+                FAULT(CHIP8_FAULT_STACK_OVERFLOW);
+            }
+            b->stack[b->stkptr[l]++][l] = (PC + 2) & MEM_MASK;
+            PC = nnn;
+            break;
+        case 0x3000: PC += (V(x) == kk) ? 4 : 2; break;
+        case 0x4000: PC += (V(x) != kk) ? 4 : 2; break;
+        case 0x5000: PC += (V(x) == V(y)) ? 4 : 2; break;
+        case 0x6000: V(x) = kk; PC += 2; break;
+        case 0x7000: V(x) += kk; PC += 2; break;
+
+        case 0x8000:
+            // VF is written first, like EmulateCycle, which matters when x is F
+            switch (n)
+            {
+                case 0x0: V(x) = V(y); break;
+                case 0x1: V(x) |= V(y); break;
+                case 0x2: V(x) &= V(y); break;
+                case 0x3: V(x) ^= V(y); break;
+                case 0x4: V(0xF) = ((int) V(x) + (int) V(y)) > 255; V(x) += V(y); break;
+                case 0x5: V(0xF) = V(x) > V(y); V(x) -= V(y); break;
+                case 0x6: V(0xF) = V(x) & 0x1; V(x) >>= 1; break;
+                case 0x7: V(0xF) = V(y) > V(x); V(x) = V(y) - V(x); break;
+                case 0xE: V(0xF) = (V(x) >> 7) & 0x1; V(x) <<= 1; break;
+                default:  FAULT(CHIP8_FAULT_OPCODE);
+            }
+            PC += 2;
+            break;
+
+        case 0x9000:
+            if (n != 0)
+            {
+                FAULT(CHIP8_FAULT_OPCODE);
+            }
+            PC += (V(x) != V(y)) ? 4 : 2;
+            break;
+
+        case 0xA000: I = nnn; PC += 2; break;
+        case 0xB000: PC = nnn + V(0); break;
+        case 0xC000: V(x) = randbyte(&b->rng[l]) & kk; PC += 2; break;
+
+        case 0xD000:
+        {
+            uint8_t collision = 0;
+
+            for (i = 0; i < n; i++)
+            {
+                uint64_t bits = sprite_row(b->memory[(I + i) & MEM_MASK][l], V(x));
+                uint64_t* rowp = &b->fb[(V(y) + i) % GFX_ROWS][l];
+
+                collision |= (*rowp & bits) != 0;
+                *rowp ^= bits;
+            }
+            V(0xF) = collision;
+            b->draw_flag[l] = 1;
+            b->dirty_rows[l] |= sprite_rows(V(y), n);
+            PC += 2;
+            break;
+        }
+
+        case 0xE000:
+            if (kk != 0x9E && kk != 0xA1)
+            {
+                FAULT(CHIP8_FAULT_OPCODE);
+            }
+            if (V(x) >= KEYPAD_SIZE)
+            {
+                FAULT(CHIP8_FAULT_KEY);
+            }
+            pressed = b->key[V(x)][l];
+            if (kk == 0x9E)
+            {
+                PC += pressed ? 4 : 2;
+            }
+            else
+            {
+                PC += !pressed ? 4 : 2;
+            }
+            break;
+
+        default:
+            switch (kk)
+            {
+                case 0x07: V(x) = b->DelayTimer[l]; PC += 2; break;
+                case 0x0A:
+                    // No key yet: halt the lane on this instruction. It sits
+                    // out of every Chip8BatchRun until one of its keys is down.
+                    for (i = 0; i < KEYPAD_SIZE; i++)
+                    {
+                        if (b->key[i][l])
+                        {
+                            V(x) = i;
+                            PC += 2;
+                            break;
+                        }
+                    }
+                    if (i == KEYPAD_SIZE)
+                    {
+                        b->waiting |= LANE_BIT(l);
+                    }
+                    break;
+                case 0x15: b->DelayTimer[l] = V(x); PC += 2; break;
+                case 0x18: b->SoundTimer[l] = V(x); PC += 2; break;
+                case 0x1E:
+                    V(0xF) = (I + V(x) > 0xFFF) ? 1 : 0;
+                    I += V(x);
+                    PC += 2;
+                    break;
+                case 0x29: I = FONTSET_BYTES_PER_CHAR * V(x); PC += 2; break;
+                case 0x33:
+                    b->memory[I & MEM_MASK][l]       = (V(x) % 1000) / 100;
+                    b->memory[(I + 1) & MEM_MASK][l] = (V(x) % 100) / 10;
+                    b->memory[(I + 2) & MEM_MASK][l] = V(x) % 10;
+                    PC += 2;
+                    break;
+                case 0x55:
+                    for (i = 0; i <= x; i++)
+                    {
+                        b->memory[(I + i) & MEM_MASK][l] = V(i);
+                    }
+                    I += x + 1;
+                    PC += 2;
+                    break;
+                case 0x65:
+                    for (i = 0; i <= x; i++)
+                    {
+                        V(i) = b->memory[(I + i) & MEM_MASK][l];
+                    }
+                    I += x + 1;
+                    PC += 2;
+                    break;
+                default:
+                    FAULT(CHIP8_FAULT_OPCODE);
+            }
+            break;
+    }
+    PC &= MEM_MASK;
+
+#undef V
+#undef PC
+#undef I
+#undef FAULT
+}
+
+static void run_lanes(Chip8Batch* b, uint32_t cycles){
+    for (unsigned lane = 0; lane < CHIP8_LANES; lane++)
+    {
+        if (b->live & LANE_BIT(lane))
+        {
+            for (uint32_t c = 0; c < cycles && !(b->waiting & LANE_BIT(lane)); c++)
+            {
+                step_lane(b, lane, fetch(b, lane));
+            }
+        }
+    }
+}
+
+#ifdef BATCH_AVX2
+
+#define AVX2 __attribute__((target("avx2")))
+
+#define LOAD(p)     _mm256_loadu_si256((const __m256i*) (p))
+#define STORE(p, v) _mm256_storeu_si256((__m256i*) (p), (v))
+
+// 16-bit lane arrays (PC, I, opcode) take two vectors: lanes 0..15 and 16..31.
+// Byte masks get sign extended to match.
+#define MASK_LO(m)  _mm256_cvtepi8_epi16(_mm256_castsi256_si128(m))
+#define MASK_HI(m)  _mm256_cvtepi8_epi16(_mm256_extracti128_si256((m), 1))
+#define ZEXT_LO(v)  _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v))
+#define ZEXT_HI(v)  _mm256_cvtepu8_epi16(_mm256_extracti128_si256((v), 1))
+
+// 32 lane bits to 32 bytes of 0x00 / 0xFF
+AVX2 static inline __m256i expand_mask(uint32_t bits){
+    const __m256i pick = _mm256_setr_epi64x(0x0000000000000000LL, 0x0101010101010101LL,
+                                            0x0202020202020202LL, 0x0303030303030303LL);
+    const __m256i bit  = _mm256_set1_epi64x((long long) 0x8040201008040201ULL);
+    __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32((int) bits), pick);
+
+    return _mm256_cmpeq_epi8(_mm256_and_si256(v, bit), bit);
+}
+
+// Lanes 8k..8k+7 of `bits` as 32-bit 0 / -1, for the uint32_t lane arrays
+AVX2 static inline __m256i mask32(uint32_t bits, int k){
+    __m256i sel = _mm256_slli_epi32(_mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128), 8 * k);
+    return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int) bits), sel), sel);
+}
+
+// Two vectors of 16-bit 0 / -1 (or 0 / 1) down to 32 bytes, in lane order
+AVX2 static inline __m256i pack16(__m256i lo, __m256i hi){
+    return _mm256_permute4x64_epi64(_mm256_packs_epi16(lo, hi), 0xD8);
+}
+
+AVX2 static inline void blend16(uint16_t* a, __m256i lo, __m256i hi, __m256i m){
+    STORE(a,      _mm256_blendv_epi8(LOAD(a),      lo, MASK_LO(m)));
+    STORE(a + 16, _mm256_blendv_epi8(LOAD(a + 16), hi, MASK_HI(m)));
+}
+
+AVX2 static inline void blend8(uint8_t* a, __m256i v, __m256i m){
+    STORE(a, _mm256_blendv_epi8(LOAD(a), v, m));
+}
+
+// PC += inc, where inc is one byte per lane and already 0 outside the group
+AVX2 static inline void advance(Chip8Batch* b, __m256i inc){
+    STORE(b->PC,      _mm256_add_epi16(LOAD(b->PC),      ZEXT_LO(inc)));
+    STORE(b->PC + 16, _mm256_add_epi16(LOAD(b->PC + 16), ZEXT_HI(inc)));
+}
+
+AVX2 static inline void next(Chip8Batch* b, __m256i m){
+    advance(b, _mm256_and_si256(m, _mm256_set1_epi8(2)));
+}
+
+AVX2 static inline void skip_if(Chip8Batch* b, __m256i cond, __m256i m){
+    __m256i two = _mm256_set1_epi8(2);
+    advance(b, _mm256_and_si256(m, _mm256_add_epi8(two, _mm256_and_si256(cond, two))));
+}
+
+// Unsigned a > b, as 0x00 / 0xFF
+AVX2 static inline __m256i gt_u8(__m256i a, __m256i b){
+    return _mm256_xor_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(a, b), a), _mm256_set1_epi8(-1));
+}
+
+// Lanes at `PC` whose next two bytes match the lead lane's, so they are about
+// to run the same opcode
+AVX2 static inline uint32_t lanes_at(const Chip8Batch* b, uint16_t PC, unsigned lead){
+    const uint8_t* hi = b->memory[PC & MEM_MASK];
+    const uint8_t* lo = b->memory[(PC + 1) & MEM_MASK];
+    __m256i want = _mm256_set1_epi16((short) PC);
+    __m256i at   = pack16(_mm256_cmpeq_epi16(LOAD(b->PC), want),
+                          _mm256_cmpeq_epi16(LOAD(b->PC + 16), want));
+
+    at = _mm256_and_si256(at, _mm256_cmpeq_epi8(LOAD(hi), _mm256_set1_epi8((char) hi[lead])));
+    at = _mm256_and_si256(at, _mm256_cmpeq_epi8(LOAD(lo), _mm256_set1_epi8((char) lo[lead])));
+    return (uint32_t) _mm256_movemask_epi8(at);
+}
+
+// Takes one instruction off every lane in `group`. Returns the lanes that
+// still have some left.
+AVX2 static inline uint32_t consume(Chip8Batch* b, uint32_t group){
+    uint32_t active = 0;
+
+    for (int k = 0; k < CHIP8_LANES / 8; k++)
+    {
+        __m256i left = _mm256_add_epi32(LOAD(b->left + 8 * k), mask32(group, k));   // -1 in the group
+
+        STORE(b->left + 8 * k, left);
+        active |= (uint32_t) (~_mm256_movemask_ps(_mm256_castsi256_ps(
+                      _mm256_cmpeq_epi32(left, _mm256_setzero_si256()))) & 0xFF) << (8 * k);
+    }
+    return active;
+}
+
+// True when every lane in the group has the same value in this byte register
+AVX2 static inline bool uniform8(const uint8_t* a, uint8_t value, uint32_t group){
+    uint32_t same = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(LOAD(a), _mm256_set1_epi8((char) value)));
+    return (same & group) == group;
+}
+
+// Dxyn for a group that agrees on Vx, Vy and I, which is the usual case for
+// lanes running in step. The sprite bytes and display rows then sit at the
+// same index for every lane, so each row is 8 vectors of 4 lanes. Returns
+// false when the lanes disagree and have to draw one at a time.
+AVX2 static bool draw_group(Chip8Batch* b, uint8_t x, uint8_t y, uint8_t n,
+                            uint32_t group, unsigned lead, __m256i m){
+    uint8_t  vx = b->V[x][lead];
+    uint8_t  vy = b->V[y][lead];
+    uint16_t I  = b->IndexRegister[lead];
+    __m256i  want = _mm256_set1_epi16((short) I);
+    __m128i  shr  = _mm_cvtsi32_si128(vx % GFX_COLS);
+    __m128i  shl  = _mm_cvtsi32_si128(GFX_COLS - vx % GFX_COLS);   // 64 shifts to 0
+    __m256i  sel[CHIP8_LANES / 4], hit[CHIP8_LANES / 4];
+    uint32_t same, collision = 0;
+    int j, k;
+
+    same = (uint32_t) _mm256_movemask_epi8(pack16(_mm256_cmpeq_epi16(LOAD(b->IndexRegister), want),
+                                                  _mm256_cmpeq_epi16(LOAD(b->IndexRegister + 16), want)));
+    if ((same & group) != group || !uniform8(b->V[x], vx, group) || !uniform8(b->V[y], vy, group))
+    {
+        return false;
+    }
+
+    for (k = 0; k < CHIP8_LANES / 4; k++)
+    {
+        __m256i bit = _mm256_setr_epi64x(1LL << (4 * k), 2LL << (4 * k), 4LL << (4 * k), 8LL << (4 * k));
+        sel[k] = _mm256_cmpeq_epi64(_mm256_and_si256(_mm256_set1_epi64x(group), bit), bit);
+        hit[k] = _mm256_setzero_si256();
+    }
+
+    for (j = 0; j < n; j++)
+    {
+        const uint8_t* bytes = b->memory[(I + j) & MEM_MASK];
+        uint64_t* row = b->fb[(vy + j) % GFX_ROWS];
+
+        for (k = 0; k < CHIP8_LANES / 4; k++)
+        {
+            int32_t four;
+            __m256i bits, pixels;
+
+            // Same as sprite_row, four lanes at a time
+            memcpy(&four, bytes + 4 * k, sizeof(four));
+            bits = _mm256_slli_epi64(_mm256_cvtepu8_epi64(_mm_cvtsi32_si128(four)), GFX_COLS - 8);
+            bits = _mm256_or_si256(_mm256_srl_epi64(bits, shr), _mm256_sll_epi64(bits, shl));
+            bits = _mm256_and_si256(bits, sel[k]);
+
+            pixels = LOAD(row + 4 * k);
+            hit[k] = _mm256_or_si256(hit[k], _mm256_and_si256(pixels, bits));
+            STORE(row + 4 * k, _mm256_xor_si256(pixels, bits));
+        }
+    }
+
+    for (k = 0; k < CHIP8_LANES / 4; k++)
+    {
+        int clear = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(hit[k], _mm256_setzero_si256())));
+        collision |= (uint32_t) (~clear & 0xF) << (4 * k);
+    }
+    blend8(b->V[0xF], _mm256_and_si256(expand_mask(collision), _mm256_set1_epi8(1)), m);
+    blend8(b->draw_flag, _mm256_set1_epi8(1), m);
+
+    for (k = 0; k < CHIP8_LANES / 8; k++)
+    {
+        __m256i rows = _mm256_and_si256(mask32(group, k), _mm256_set1_epi32((int) sprite_rows(vy, n)));
+        STORE(b->dirty_rows + 8 * k, _mm256_or_si256(LOAD(b->dirty_rows + 8 * k), rows));
+    }
+    return true;
+}
+
+// One instruction on every lane in `group`. Register, timer, I, key and
+// control flow opcodes, and sprites the lanes agree on, run as vector ops
+// across the group; the rest go lane by lane.
+AVX2 static void exec_group(Chip8Batch* b, uint16_t opcode, uint32_t group, unsigned lead){
+    uint8_t  x   = (opcode >> 8) & 0x000F;
+    uint8_t  y   = (opcode >> 4) & 0x000F;
+    uint8_t  n   = opcode & 0x000F;
+    uint8_t  kk  = opcode & 0x00FF;
+    uint16_t nnn = opcode & 0x0FFF;
+    __m256i  m   = expand_mask(group);
+    __m256i  vx, v;
+
+#define VX  LOAD(b->V[x])
+#define VY  LOAD(b->V[y])
+#define VF  b->V[0xF]
+
+    // In the guard slots PC can wrap, which step_lane takes care of
+    if (b->PC[lead] >= MEM_PC_GUARD)
+    {
+        goto lanes;
+    }
+
+    switch (opcode & 0xF000)
+    {
+        case 0x1000:
+            v = _mm256_set1_epi16((short) nnn);
+            blend16(b->PC, v, v, m);
+            break;
+        case 0x3000: skip_if(b, _mm256_cmpeq_epi8(VX, _mm256_set1_epi8((char) kk)), m); break;
+        case 0x4000: skip_if(b, _mm256_andnot_si256(_mm256_cmpeq_epi8(VX, _mm256_set1_epi8((char) kk)), m), m); break;
+        case 0x5000: skip_if(b, _mm256_cmpeq_epi8(VX, VY), m); break;
+        case 0x6000: blend8(b->V[x], _mm256_set1_epi8((char) kk), m); next(b, m); break;
+        case 0x7000: blend8(b->V[x], _mm256_add_epi8(VX, _mm256_set1_epi8((char) kk)), m); next(b, m); break;
+
+        case 0x8000:
+            // Same order as EmulateCycle: VF first, then Vx from the
+            // registers as they are after that
+            switch (n)
+            {
+                case 0x0: blend8(b->V[x], VY, m); break;
+                case 0x1: blend8(b->V[x], _mm256_or_si256(VX, VY), m); break;
+                case 0x2: blend8(b->V[x], _mm256_and_si256(VX, VY), m); break;
+                case 0x3: blend8(b->V[x], _mm256_xor_si256(VX, VY), m); break;
+                case 0x4:
+                    vx = VX;
+                    v  = _mm256_add_epi8(vx, VY);
+                    blend8(VF, _mm256_and_si256(gt_u8(vx, v), _mm256_set1_epi8(1)), m);
+                    blend8(b->V[x], _mm256_add_epi8(VX, VY), m);
+                    break;
+                case 0x5:
+                    blend8(VF, _mm256_and_si256(gt_u8(VX, VY), _mm256_set1_epi8(1)), m);
+                    blend8(b->V[x], _mm256_sub_epi8(VX, VY), m);
+                    break;
+                case 0x6:
+                    blend8(VF, _mm256_and_si256(VX, _mm256_set1_epi8(1)), m);
+                    blend8(b->V[x], _mm256_and_si256(_mm256_srli_epi16(VX, 1), _mm256_set1_epi8(0x7F)), m);
+                    break;
+                case 0x7:
+                    blend8(VF, _mm256_and_si256(gt_u8(VY, VX), _mm256_set1_epi8(1)), m);
+                    blend8(b->V[x], _mm256_sub_epi8(VY, VX), m);
+                    break;
+                case 0xE:
+                    blend8(VF, _mm256_and_si256(_mm256_srli_epi16(VX, 7), _mm256_set1_epi8(1)), m);
+                    vx = VX;
+                    blend8(b->V[x], _mm256_add_epi8(vx, vx), m);
+                    break;
+                default:
+                    goto lanes;
+            }
+            next(b, m);
+            break;
+
+        case 0x9000:
+            if (n != 0)
+            {
+                goto lanes;
+            }
+            skip_if(b, _mm256_andnot_si256(_mm256_cmpeq_epi8(VX, VY), m), m);
+            break;
+
+        case 0xA000:
+            v = _mm256_set1_epi16((short) nnn);
+            blend16(b->IndexRegister, v, v, m);
+            next(b, m);
+            break;
+
+        case 0xB000:
+        {
+            __m256i wrap = _mm256_set1_epi16(MEM_MASK);
+
+            v  = _mm256_set1_epi16((short) nnn);
+            vx = LOAD(b->V[0]);
+            blend16(b->PC, _mm256_and_si256(_mm256_add_epi16(v, ZEXT_LO(vx)), wrap),
+                    _mm256_and_si256(_mm256_add_epi16(v, ZEXT_HI(vx)), wrap), m);
+            break;
+        }
+
+        case 0xD000:
+            if (!draw_group(b, x, y, n, group, lead, m))
+            {
+                goto lanes;
+            }
+            next(b, m);
+            break;
+
+        case 0xE000:
+        {
+            uint8_t k = b->V[x][lead];
+            __m256i up;
+
+            // Lanes with Vx past key F fault, one at a time
+            if ((kk != 0x9E && kk != 0xA1) || k >= KEYPAD_SIZE || !uniform8(b->V[x], k, group))
+            {
+                goto lanes;
+            }
+            up = _mm256_cmpeq_epi8(LOAD(b->key[k]), _mm256_setzero_si256());
+            skip_if(b, kk == 0x9E ? _mm256_andnot_si256(up, m) : up, m);
+            break;
+        }
+
+        case 0xF000:
+            switch (kk)
+            {
+                case 0x07: blend8(b->V[x], LOAD(b->DelayTimer), m); break;
+                case 0x15: blend8(b->DelayTimer, VX, m); break;
+                case 0x18: blend8(b->SoundTimer, VX, m); break;
+                case 0x1E:
+                {
+                    // VF = I + Vx > 0xFFF. I can already be past 0xFFF, and
+                    // if it isn't the 16-bit sum can't wrap.
+                    __m256i top = _mm256_set1_epi16((short) 0xF000);
+                    __m256i one = _mm256_set1_epi16(1);
+                    __m256i i0  = LOAD(b->IndexRegister), i1 = LOAD(b->IndexRegister + 16);
+                    __m256i s0, s1;
+
+                    vx = VX;
+                    s0 = _mm256_or_si256(i0, _mm256_add_epi16(i0, ZEXT_LO(vx)));
+                    s1 = _mm256_or_si256(i1, _mm256_add_epi16(i1, ZEXT_HI(vx)));
+                    s0 = _mm256_andnot_si256(_mm256_cmpeq_epi16(_mm256_and_si256(s0, top), _mm256_setzero_si256()), one);
+                    s1 = _mm256_andnot_si256(_mm256_cmpeq_epi16(_mm256_and_si256(s1, top), _mm256_setzero_si256()), one);
+                    blend8(VF, pack16(s0, s1), m);
+
+                    vx = VX;
+                    blend16(b->IndexRegister, _mm256_add_epi16(i0, ZEXT_LO(vx)), _mm256_add_epi16(i1, ZEXT_HI(vx)), m);
+                    break;
+                }
+                case 0x29:
+                    vx = VX;
+                    v  = _mm256_set1_epi16(FONTSET_BYTES_PER_CHAR);
+                    blend16(b->IndexRegister, _mm256_mullo_epi16(ZEXT_LO(vx), v),
+                            _mm256_mullo_epi16(ZEXT_HI(vx), v), m);
+                    break;
+                default:
+                    goto lanes;
+            }
+            next(b, m);
+            break;
+
+        default:
+            goto lanes;
+    }
+
+    v = _mm256_set1_epi16((short) opcode);
+    blend16(b->opcode, v, v, m);
+    return;
+
+lanes:
+    for (uint32_t bits = group; bits != 0; bits &= bits - 1)
+    {
+        step_lane(b, __builtin_ctz(bits), opcode);
+    }
+
+#undef VX
+#undef VY
+#undef VF
+}
+
+AVX2 static void run_vector(Chip8Batch* b, uint32_t cycles){
+    uint32_t active = b->live & ~b->waiting;
+
+    for (unsigned lane = 0; lane < CHIP8_LANES; lane++)
+    {
+        b->left[lane] = (active & LANE_BIT(lane)) ? cycles : 0;
+    }
+    if (cycles == 0)
+    {
+        return;
+    }
+
+    while (active != 0)
+    {
+        unsigned lead = __builtin_ctz(active);
+        uint32_t group = active & lanes_at(b, b->PC[lead], lead);
+
+        if (group != active)
+        {
+            // Split up. Let the lane furthest behind go, the others wait at
+            // their PCs and join it when it gets there.
+            for (uint32_t bits = active; bits != 0; bits &= bits - 1)
+            {
+                unsigned lane = __builtin_ctz(bits);
+                if (b->left[lane] > b->left[lead])
+                {
+                    lead = lane;
+                }
+            }
+            group = active & lanes_at(b, b->PC[lead], lead);
+        }
+
+        exec_group(b, fetch(b, lead), group, lead);
+        active = consume(b, group) & ~b->waiting;
+    }
+}
+
+#endif
+
+// Lanes halted in Fx0A that have a key down now go again and take it
+static void wake_lanes(Chip8Batch* b){
+    for (unsigned lane = 0; lane < CHIP8_LANES; lane++)
+    {
+        if (!(b->waiting & LANE_BIT(lane)) || b->fault[lane] != CHIP8_OK)
+        {
+            continue;
+        }
+        for (int k = 0; k < KEYPAD_SIZE; k++)
+        {
+            if (b->key[k][lane])
+            {
+                b->waiting &= ~LANE_BIT(lane);
+                break;
+            }
+        }
+    }
+}
+
+void Chip8BatchRun(Chip8Batch* batch, uint32_t cycles){
+    for (int lane = 0; lane < CHIP8_LANES; lane++)
+    {
+        batch->cycles[lane] += cycles;
+    }
+    wake_lanes(batch);
+#ifdef BATCH_AVX2
+    if (__builtin_cpu_supports("avx2"))
+    {
+        run_vector(batch, cycles);
+        return;
+    }
+#endif
+    run_lanes(batch, cycles);
+}
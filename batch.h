@@ -0,0 +1,62 @@
+// Lockstep engine for running many copies of one ROM side by side, e.g. the
+// same game under different inputs. State is kept struct-of-arrays: every
+// register is CHIP8_LANES bytes wide, one byte per machine, so on an AVX2
+// host one vector instruction does a register op for all 32 machines.
+//
+// Each step of Chip8BatchRun picks a PC and runs the instruction there on
+// every lane sitting at that PC. Lanes that went somewhere else wait. The
+// lane furthest behind always goes first, so lanes that split on a skip
+// or a loop fall back into step on their own.
+
+#ifndef CHIP_8_BATCH
+#define CHIP_8_BATCH
+
+#include "chip8.h"
+
+#define CHIP8_LANES 32
+
+typedef struct
+{
+    uint8_t     memory[MEM_SIZE][CHIP8_LANES];  // interleaved, memory[addr] is one vector
+    uint64_t    fb[GFX_ROWS][CHIP8_LANES];
+    uint8_t     V[16][CHIP8_LANES];
+    uint8_t     DelayTimer[CHIP8_LANES];
+    uint8_t     SoundTimer[CHIP8_LANES];
+    uint8_t     key[KEYPAD_SIZE][CHIP8_LANES];
+    uint8_t     draw_flag[CHIP8_LANES];
+    uint16_t    opcode[CHIP8_LANES];
+    uint16_t    PC[CHIP8_LANES];
+    uint16_t    IndexRegister[CHIP8_LANES];
+    uint16_t    stack[STACK_SIZE][CHIP8_LANES];
+    uint16_t    stkptr[CHIP8_LANES];
+    uint32_t    dirty_rows[CHIP8_LANES];
+    uint32_t    rng[CHIP8_LANES];               // every lane has its own random numbers
+    uint32_t    ticks[CHIP8_LANES];
+    uint64_t    cycles[CHIP8_LANES];
+    uint8_t     fault[CHIP8_LANES];             // Chip8Fault of each lane
+    uint32_t    left[CHIP8_LANES];              // instructions left in this Chip8BatchRun
+    uint32_t    live;                           // one bit per lane in use
+    uint32_t    waiting;                        // one bit per lane halted in Fx0A or by a fault
+} Chip8Batch;
+
+// All lanes start out unused. Returns NULL when out of memory.
+Chip8Batch* Chip8BatchCreate(void);
+void Chip8BatchFree(Chip8Batch* batch);
+
+// Copies a machine into a lane and marks it in use, or copies a lane back
+// out into a machine. Set up the machine with InitializeChip8 and LoadGame.
+void Chip8BatchSetLane(Chip8Batch* batch, unsigned lane, const CHIP8* chip8);
+void Chip8BatchGetLane(const Chip8Batch* batch, unsigned lane, CHIP8* chip8);
+
+void Chip8BatchSetKey(Chip8Batch* batch, unsigned lane, uint8_t key, uint8_t down);
+
+// Runs `cycles` instructions on every lane in use. Each lane ends up where
+// Chip8Run would have put it. A lane that halts in Fx0A drops out of the run
+// and costs nothing until a Chip8BatchRun finds one of its keys down. A
+// lane that faults halts the same way for good, with fault[lane] set.
+void Chip8BatchRun(Chip8Batch* batch, uint32_t cycles);
+
+// Tick for every lane
+void Chip8BatchTick(Chip8Batch* batch);
+
+#endif
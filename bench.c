@@ -0,0 +1,544 @@
+// Benchmarks: nanoseconds per instruction for each opcode family, and end to
+// end MIPS on whole ROMs. No GL needed.
+//
+// Usage: ./chip8_bench [options] [rom...]
+//
+// The opcode suite runs small synthetic programs: one family's instructions
+// repeated through a loop body, then a jump back. With the switch engine they
+// go through EmulateCycle one call at a time, so that is what gets measured;
+// the other engines go through Chip8Run. The ROM suite runs each ROM (the
+// bundled IBMLogo, Tetris and SpaceInvaders by default) with no input, in
+// frames of -i instructions and one Tick, through Chip8Run. Its instruction
+// count leaves out the cycles idle skipping fast-forwarded, so the time is
+// per instruction that actually ran.
+//
+// The clone suite branches each ROM, 60 frames in, into copies (clone.h).
+// It times Chip8Clone, and the reset of a warm pool whose children each ran
+// a frame of their own. There the instruction count is the number of clones
+// or resets and the time is per clone or reset.
+//
+// Every case runs -k times on a fresh machine and the fastest run counts.
+// Results go out as CSV, one line per case and engine:
+//     suite,name,engine,instructions,ns_per_instr,mips
+// Feed an earlier run back in with -b and the new numbers are compared
+// against it case by case. Anything slower by more than -T percent is
+// reported as a regression and the exit status is 1.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "chip8.h"
+#include "clone.h"
+
+#include <unistd.h>
+
+#define DEFAULT_OP_CYCLES 5000000
+#define DEFAULT_FRAMES 6000
+#define DEFAULT_CYCLES_PER_FRAME 1000
+#define DEFAULT_REPEAT 3
+#define DEFAULT_THRESHOLD 5.0
+#define MAX_ENGINES 3
+#define MAX_LINE 1024
+#define CLONES 200000                           // per clone case
+#define POOL_CHILDREN 64
+#define POOL_ROUNDS 200
+#define BRANCH_FRAME 60                         // where the clone suite branches
+
+#define BODY_START  0x200
+#define BODY_LEN    32                          // instructions in a loop body
+#define LONG_LEN    48                          // more than fits a JIT block or an idle probe
+#define SUB_ADDR    0x280                       // where the 2nnn family's 00EE lives
+#define DATA_ADDR   0x300                       // what I points at, off the code's page
+
+#ifdef CHIP8_THREADED
+#define PREDECODE_NAME "threaded"
+#else
+#define PREDECODE_NAME "predecode"
+#endif
+
+// One opcode family. The body cycles through ops until it is len
+// instructions long. A 0x1000 entry stands for a jump to the next instruction.
+typedef struct
+{
+    const char* name;
+    int         len;
+    uint16_t    ops[8];                         // 0 ends the list early
+} Family;
+
+static const Family families[] =
+{
+    { "00E0 clear",         BODY_LEN, { 0x00E0 } },
+    { "1nnn jump",          BODY_LEN, { 0x1000 } },
+    { "2nnn+00EE call",     BODY_LEN, { 0x2000 | SUB_ADDR } },
+    { "3xkk..9xy0 skip",    BODY_LEN, { 0x3012, 0x4034, 0x5010, 0x9120 } },
+    { "6xkk load",          BODY_LEN, { 0x6012, 0x6134, 0x6256, 0x6378 } },
+    { "7xkk add",           BODY_LEN, { 0x7001, 0x7102, 0x7203, 0x7304 } },
+    { "7xkk long loop",     LONG_LEN, { 0x7001, 0x7102, 0x7203, 0x7304 } },
+    { "8xyN alu",           BODY_LEN, { 0x8010, 0x8121, 0x8232, 0x8343, 0x8454, 0x8565, 0x8676, 0x878E } },
+    { "Annn+Fx1E index",    BODY_LEN, { 0xA000 | DATA_ADDR, 0xF01E, 0xF11E } },
+    { "Cxkk random",        BODY_LEN, { 0xC0FF, 0xC17F } },
+    { "Dxyn draw",          BODY_LEN, { 0xD015, 0xD125 } },
+    { "Ex9E/ExA1 keys",     BODY_LEN, { 0xE09E, 0xE1A1 } },
+    { "Fx07/15/18 timers",  BODY_LEN, { 0xF007, 0xF115, 0xF218 } },
+    { "Fx29 font",          BODY_LEN, { 0xF029, 0xF129 } },
+    { "Fx33 bcd",           BODY_LEN, { 0xF033 } },
+    { "Fx55 store",         BODY_LEN, { 0xA000 | DATA_ADDR, 0xFF55 } },
+    { "Fx65 load",          BODY_LEN, { 0xA000 | DATA_ADDR, 0xFF65 } },
+};
+
+#define NUM_FAMILIES (sizeof(families) / sizeof(families[0]))
+
+static const char* default_roms[] = { "IBMLogo.ch8", "Tetris.ch8", "SpaceInvaders.ch8" };
+
+typedef struct
+{
+    const char* suite;
+    const char* name;
+    const char* engine;
+    uint64_t    instructions;
+    double      ns_per_instr;
+} Result;
+
+static const char* engines[MAX_ENGINES];
+static int      num_engines;
+static uint32_t op_cycles           = DEFAULT_OP_CYCLES;
+static uint64_t frames              = DEFAULT_FRAMES;
+static uint32_t cycles_per_frame    = DEFAULT_CYCLES_PER_FRAME;
+static int      repeat              = DEFAULT_REPEAT;
+
+static Result*  results;
+static size_t   num_results;
+static size_t   results_capacity;
+
+static double now_seconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static CHIP8* new_machine(){
+    CHIP8* chip8 = malloc(sizeof(CHIP8));
+
+    if (chip8 == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    InitializeChip8(chip8);
+    Chip8Seed(chip8, 1);
+    return chip8;
+}
+
+static void enable_engine(CHIP8* chip8, const char* engine){
+    if (strcmp(engine, "predecode") == 0)
+    {
+        Chip8EnablePredecode(chip8);
+    }
+    else if (strcmp(engine, "jit") == 0)
+    {
+        Chip8EnableJit(chip8);
+    }
+}
+
+static void free_machine(CHIP8* chip8){
+    Chip8DisablePredecode(chip8);
+    Chip8DisableJit(chip8);
+    Chip8ReleaseMemory(chip8);
+    free(chip8);
+}
+
+static const char* engine_name(const char* engine){
+    return strcmp(engine, "predecode") == 0 ? PREDECODE_NAME : engine;
+}
+
+static void add_result(const char* suite, const char* name, const char* engine,
+                       uint64_t instructions, double seconds){
+    if (num_results == results_capacity)
+    {
+        results_capacity = results_capacity ? 2 * results_capacity : 64;
+        results = realloc(results, results_capacity * sizeof(Result));
+        if (results == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    results[num_results].suite        = suite;
+    results[num_results].name         = name;
+    results[num_results].engine       = engine_name(engine);
+    results[num_results].instructions = instructions;
+    results[num_results].ns_per_instr = seconds * 1e9 / instructions;
+    num_results++;
+}
+
+static void put_op(CHIP8* chip8, uint16_t addr, uint16_t op){
+    uint8_t bytes[2] = { op >> 8, op & 0xFF };
+
+    Chip8WriteMemory(chip8, addr, bytes, 2);
+}
+
+// Lays out a family's loop body with two jumps back after it, in case the
+// last instruction is a skip that gets taken
+static void load_family(CHIP8* chip8, const Family* family){
+    size_t num_ops = 0;
+    uint16_t addr = BODY_START;
+
+    while (num_ops < 8 && family->ops[num_ops] != 0)
+    {
+        num_ops++;
+    }
+    for (int i = 0; i < family->len; i++, addr += 2)
+    {
+        uint16_t op = family->ops[i % num_ops];
+        put_op(chip8, addr, op == 0x1000 ? 0x1000 | (addr + 2) : op);
+    }
+    put_op(chip8, addr, 0x1000 | BODY_START);
+    put_op(chip8, addr + 2, 0x1000 | BODY_START);
+    put_op(chip8, SUB_ADDR, 0x00EE);
+
+    // Something for the draws and skips to work with
+    chip8->registers[0] = 8;
+    chip8->registers[1] = 3;
+    chip8->registers[2] = 20;
+    chip8->key[3] = 1;
+}
+
+static void bench_family(const Family* family, const char* engine){
+    double best = 0;
+
+    for (int r = 0; r < repeat; r++)
+    {
+        CHIP8* chip8 = new_machine();
+        double start;
+
+        load_family(chip8, family);
+        enable_engine(chip8, engine);
+
+        start = now_seconds();
+        if (strcmp(engine, "switch") == 0)
+        {
+            for (uint32_t c = 0; c < op_cycles; c++)
+            {
+                EmulateCycle(chip8);
+            }
+        }
+        else
+        {
+            Chip8Run(chip8, op_cycles);
+        }
+        double elapsed = now_seconds() - start;
+
+        if (r == 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+        free_machine(chip8);
+    }
+    add_result("op", family->name, engine, op_cycles, best);
+}
+
+// Counts only the instructions that ran: what idle skipping fast-forwarded
+// is free, and would make a ROM look faster the longer it idles. A ROM that
+// halts in Fx0A ends its case with the frame it halted in.
+static void bench_rom(const char* rom, const char* engine){
+    uint64_t ran = 0;
+    double best = 0;
+
+    for (int r = 0; r < repeat; r++)
+    {
+        CHIP8* chip8 = new_machine();
+        double start;
+
+        LoadGame(chip8, (char*) rom);
+        enable_engine(chip8, engine);
+
+        start = now_seconds();
+        for (uint64_t f = 0; f < frames && !chip8->waiting; f++)
+        {
+            Chip8Run(chip8, cycles_per_frame);
+            Tick(chip8);
+        }
+        double elapsed = now_seconds() - start;
+
+        if (r == 0 || elapsed < best)
+        {
+            best = elapsed;
+            ran  = chip8->cycles - chip8->idle_skipped;
+        }
+        free_machine(chip8);
+    }
+    add_result("rom", rom, engine, ran > 0 ? ran : 1, best);
+}
+
+// The parent the clone suite branches from
+static CHIP8* branch_point(const char* rom){
+    CHIP8* chip8 = new_machine();
+
+    LoadGame(chip8, (char*) rom);
+    for (int f = 0; f < BRANCH_FRAME; f++)
+    {
+        Chip8Run(chip8, cycles_per_frame);
+        Tick(chip8);
+    }
+    return chip8;
+}
+
+static void bench_clone(const char* rom){
+    CHIP8* parent = branch_point(rom);
+    double best = 0;
+
+    for (int r = 0; r < repeat; r++)
+    {
+        CHIP8 child;
+        double start = now_seconds();
+
+        for (int i = 0; i < CLONES; i++)
+        {
+            Chip8Clone(parent, &child);
+            Chip8ReleaseMemory(&child);
+        }
+        double elapsed = now_seconds() - start;
+
+        if (r == 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    free_machine(parent);
+    add_result("clone", rom, "-", CLONES, best);
+}
+
+static void bench_pool(const char* rom, const char* engine){
+    CHIP8* parent = branch_point(rom);
+    double best = 0;
+
+    for (int r = 0; r < repeat; r++)
+    {
+        Chip8Pool pool;
+        double elapsed = 0;
+
+        if (!Chip8PoolInit(&pool, parent, POOL_CHILDREN))
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        for (unsigned i = 0; i < pool.count; i++)
+        {
+            enable_engine(&pool.children[i], engine);
+        }
+
+        // Each child takes its own branch, then they all go back
+        for (int round = 0; round < POOL_ROUNDS; round++)
+        {
+            double start;
+
+            for (unsigned i = 0; i < pool.count; i++)
+            {
+                pool.children[i].key[(round + i) % KEYPAD_SIZE] = 1;
+                Chip8Run(&pool.children[i], cycles_per_frame);
+                Tick(&pool.children[i]);
+            }
+            start = now_seconds();
+            Chip8PoolReset(&pool);
+            elapsed += now_seconds() - start;
+        }
+        Chip8PoolFree(&pool);
+
+        if (r == 0 || elapsed < best)
+        {
+            best = elapsed;
+        }
+    }
+    free_machine(parent);
+    add_result("reset", rom, engine, (uint64_t) POOL_CHILDREN * POOL_ROUNDS, best);
+}
+
+// Reads the CSV of an earlier run and compares every case found in both.
+// Returns the number of regressions.
+static int compare(const char* path, double threshold){
+    FILE* fptr = fopen(path, "r");
+    char line[MAX_LINE];
+    int regressions = 0;
+
+    if (fptr == NULL)
+    {
+        fprintf(stderr, "Unable to open baseline: %s\n", path);
+        exit(2);
+    }
+
+    while (fgets(line, sizeof(line), fptr) != NULL)
+    {
+        char suite[MAX_LINE], name[MAX_LINE], engine[MAX_LINE];
+        double old_ns;
+
+        if (sscanf(line, "%1023[^,],%1023[^,],%1023[^,],%*[^,],%lf", suite, name, engine, &old_ns) != 4)
+        {
+            continue;                           // header, or not ours
+        }
+        for (size_t i = 0; i < num_results; i++)
+        {
+            const Result* res = &results[i];
+            double change;
+
+            if (strcmp(res->suite, suite) != 0 || strcmp(res->name, name) != 0 ||
+                strcmp(res->engine, engine) != 0)
+            {
+                continue;
+            }
+            change = 100.0 * (res->ns_per_instr - old_ns) / old_ns;
+            fprintf(stderr, "%-4s %-20s %-10s %9.2f -> %9.2f ns  %+6.1f%%%s\n",
+                    suite, name, engine, old_ns, res->ns_per_instr, change,
+                    change > threshold ? "  REGRESSION" : "");
+            if (change > threshold)
+            {
+                regressions++;
+            }
+        }
+    }
+
+    fclose(fptr);
+    return regressions;
+}
+
+static void usage(){
+    fprintf(stderr,
+        "Usage: ./chip8_bench [options] [rom...]\n"
+        "  -e <engine>    switch, predecode or jit, repeat for more (default all)\n"
+        "  -n <cycles>    instructions per opcode case (default %d)\n"
+        "  -f <frames>    frames per ROM case (default %d)\n"
+        "  -i <cycles>    instructions per 60 Hz frame (default %d)\n"
+        "  -k <runs>      runs per case, the fastest counts (default %d)\n"
+        "  -s <suite>     only run op, rom or clone\n"
+        "  -o <file>      write results here instead of stdout\n"
+        "  -b <file>      compare against the results of an earlier run\n"
+        "  -T <percent>   slowdown -b reports as a regression (default %.0f)\n",
+        DEFAULT_OP_CYCLES, DEFAULT_FRAMES, DEFAULT_CYCLES_PER_FRAME, DEFAULT_REPEAT,
+        DEFAULT_THRESHOLD);
+    exit(2);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* out_path = NULL;
+    const char* baseline = NULL;
+    const char* suite = NULL;
+    double threshold = DEFAULT_THRESHOLD;
+    const char** roms = default_roms;
+    int num_roms = sizeof(default_roms) / sizeof(default_roms[0]);
+    FILE* out = stdout;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "e:n:f:i:k:s:o:b:T:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'e':
+                if (num_engines == MAX_ENGINES ||
+                    (strcmp(optarg, "switch") != 0 && strcmp(optarg, "predecode") != 0 &&
+                     strcmp(optarg, "jit") != 0))
+                {
+                    usage();
+                }
+                engines[num_engines++] = optarg;
+                break;
+            case 'n': op_cycles = strtoul(optarg, NULL, 10); break;
+            case 'f': frames = strtoull(optarg, NULL, 10); break;
+            case 'i': cycles_per_frame = strtoul(optarg, NULL, 10); break;
+            case 'k': repeat = atoi(optarg); break;
+            case 's':
+                suite = optarg;
+                if (strcmp(suite, "op") != 0 && strcmp(suite, "rom") != 0 &&
+                    strcmp(suite, "clone") != 0)
+                {
+                    usage();
+                }
+                break;
+            case 'o': out_path = optarg; break;
+            case 'b': baseline = optarg; break;
+            case 'T': threshold = atof(optarg); break;
+            default: usage();
+        }
+    }
+    if (op_cycles < 1 || frames < 1 || cycles_per_frame < 1 || repeat < 1)
+    {
+        usage();
+    }
+    if (num_engines == 0)
+    {
+        engines[num_engines++] = "switch";
+        engines[num_engines++] = "predecode";
+        engines[num_engines++] = "jit";
+    }
+    if (optind < argc)
+    {
+        roms = (const char**) &argv[optind];
+        num_roms = argc - optind;
+    }
+
+    // Find a missing ROM before any suite has run, not halfway through
+    for (int i = 0; i < num_roms && (suite == NULL || strcmp(suite, "op") != 0); i++)
+    {
+        FILE* test = fopen(roms[i], "rb");
+        if (test == NULL)
+        {
+            fprintf(stderr, "Unable to open game: %s\n", roms[i]);
+            exit(2);
+        }
+        fclose(test);
+    }
+
+    for (int e = 0; e < num_engines; e++)
+    {
+        if (suite == NULL || strcmp(suite, "op") == 0)
+        {
+            for (size_t i = 0; i < NUM_FAMILIES; i++)
+            {
+                bench_family(&families[i], engines[e]);
+            }
+        }
+        if (suite == NULL || strcmp(suite, "rom") == 0)
+        {
+            for (int i = 0; i < num_roms; i++)
+            {
+                bench_rom(roms[i], engines[e]);
+            }
+        }
+        if (suite == NULL || strcmp(suite, "clone") == 0)
+        {
+            for (int i = 0; i < num_roms; i++)
+            {
+                bench_pool(roms[i], engines[e]);
+            }
+        }
+    }
+    for (int i = 0; i < num_roms && (suite == NULL || strcmp(suite, "clone") == 0); i++)
+    {
+        bench_clone(roms[i]);
+    }
+
+    if (out_path != NULL)
+    {
+        out = fopen(out_path, "w");
+        if (out == NULL)
+        {
+            fprintf(stderr, "Unable to open output: %s\n", out_path);
+            exit(2);
+        }
+    }
+    fprintf(out, "suite,name,engine,instructions,ns_per_instr,mips\n");
+    for (size_t i = 0; i < num_results; i++)
+    {
+        fprintf(out, "%s,%s,%s,%llu,%.3f,%.2f\n", results[i].suite, results[i].name,
+                results[i].engine, (unsigned long long) results[i].instructions,
+                results[i].ns_per_instr, 1e3 / results[i].ns_per_instr);
+    }
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+
+    if (baseline != NULL && compare(baseline, threshold) > 0)
+    {
+        return 1;
+    }
+    return 0;
+}
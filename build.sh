@@ -1,24 +1,97 @@
 #!/bin/bash
 
-# Set the output binary name
+# Set the output binary names
 OUTPUT="chip8_emulator"
+RUNNER="chip8_runner"
+BENCH="chip8_bench"
+TRACEDUMP="chip8_tracedump"
+FUZZ="chip8_fuzz"
+ANALYZE="chip8_analyze"
 
 # Source files
-SRC_FILES="chip8.c main.c"
+CORE_FILES="chip8.c memory.c predecode.c jit.c savestate.c clone.c stats.c trace.c"
+
+# CORE=threaded ./build.sh swaps the predecoded handler loop for the
+# labels-as-values core in threaded.c. Results are bit-identical either way.
+CORE_CFLAGS=""
+if [ "$CORE" = "threaded" ]; then
+    CORE_FILES="$CORE_FILES threaded.c"
+    CORE_CFLAGS="-DCHIP8_THREADED"
+fi
+SRC_FILES="$CORE_FILES scaler.c rewind.c inputlog.c main.c"
+RUNNER_FILES="$CORE_FILES rom.c batch.c runner.c"
+BENCH_FILES="$CORE_FILES bench.c"
+TRACEDUMP_FILES="disasm.c trace.c tracedump.c"
+FUZZ_FILES="$CORE_FILES disasm.c fuzz.c"
+ANALYZE_FILES="disasm.c cfg.c analyze.c"
 
 # Compiler and flags
 CC=gcc
-CFLAGS="-Wall -Wextra -pedantic -std=c99"
+CFLAGS="-Wall -Wextra -pedantic -std=c99 $CORE_CFLAGS"
 LDFLAGS="-lGL -lGLU -lglut -lm"
+RUNNER_CFLAGS="-O2 -pthread"
+RUNNER_LDFLAGS="-pthread"
 
 # Compile the program
 echo "Compiling CHIP-8 Emulator..."
 $CC $CFLAGS $SRC_FILES -o $OUTPUT $LDFLAGS
 
 # Check if compilation was successful
+if [ $? -ne 0 ]; then
+    echo "Compilation failed. Check errors above."
+    exit 1
+fi
+
+# The headless runner has no GL dependency, so it builds on any box
+echo "Compiling headless runner..."
+$CC $CFLAGS $RUNNER_CFLAGS $RUNNER_FILES -o $RUNNER $RUNNER_LDFLAGS
+
+if [ $? -ne 0 ]; then
+    echo "Compilation failed. Check errors above."
+    exit 1
+fi
+
+# Same optimization as the runner, so its numbers are the ones that matter
+echo "Compiling benchmarks..."
+$CC $CFLAGS -O2 $BENCH_FILES -o $BENCH
+
+if [ $? -ne 0 ]; then
+    echo "Compilation failed. Check errors above."
+    exit 1
+fi
+
+echo "Compiling trace decoder..."
+$CC $CFLAGS $TRACEDUMP_FILES -o $TRACEDUMP
+
+if [ $? -ne 0 ]; then
+    echo "Compilation failed. Check errors above."
+    exit 1
+fi
+
+echo "Compiling fuzzer..."
+$CC $CFLAGS $RUNNER_CFLAGS $FUZZ_FILES -o $FUZZ $RUNNER_LDFLAGS
+
+if [ $? -ne 0 ]; then
+    echo "Compilation failed. Check errors above."
+    exit 1
+fi
+
+echo "Compiling ROM analyzer..."
+$CC $CFLAGS -O2 $ANALYZE_FILES -o $ANALYZE
+
 if [ $? -eq 0 ]; then
     echo "Compilation successful! Run the emulator with:"
     echo "./$OUTPUT <path_to_rom>"
+    echo "or run a batch of jobs headless with:"
+    echo "./$RUNNER <jobfile>"
+    echo "or measure the cores with:"
+    echo "./$BENCH > results.csv"
+    echo "and read a trace with:"
+    echo "./$TRACEDUMP <game>.trace"
+    echo "and look for ROMs and inputs that break it with:"
+    echo "./$FUZZ"
+    echo "and see what a ROM holds without running it with:"
+    echo "./$ANALYZE <path_to_rom>"
 else
     echo "Compilation failed. Check errors above."
     exit 1
@@ -0,0 +1,782 @@
+#include "cfg.h"
+#include "chip8_ops.h"
+
+// Per address, while exploring
+#define F_INSN      0x01                        // an instruction that can run starts here
+#define F_QUEUED    0x02                        // on the worklist, or explored
+#define F_LEADER    0x04                        // a block starts here
+#define F_SUB       0x08                        // a subroutine starts here
+#define F_RETURNS   0x10                        // ... and it can reach a 00EE
+#define F_REACHES   0x20                        // a 00EE can be reached from here
+
+// Constant tracking. A register holds its value, or one of these.
+#define UNSEEN      -1                          // nothing has reached it yet
+#define VARIES      -2                          // not the same on every path
+
+// Rounds of following newly resolved Bnnn targets, each one a full pass.
+// Real ROMs settle in two.
+#define MAX_ROUNDS  8
+
+typedef struct
+{
+    int32_t     v[16];
+    int32_t     I;
+} Consts;
+
+// What an instruction does to the PC
+typedef enum
+{
+    FLOW_NEXT,
+    FLOW_JUMP,
+    FLOW_CALL,
+    FLOW_RET,
+    FLOW_SKIP,
+    FLOW_INDIRECT,
+    FLOW_BAD
+} Flow;
+
+typedef struct
+{
+    Chip8Cfg*       cfg;
+    const uint8_t*  rom;
+    unsigned        size;
+    uint8_t         flags[MEM_SIZE];
+    uint16_t        target[MEM_SIZE];           // Bnnn at this address goes here, CFG_NONE if V0 varies
+    uint16_t        work[MEM_SIZE];             // worklist, each address goes on it once per walk
+    unsigned        top;
+    uint16_t        pred_at[MEM_SIZE + 1];      // preds[pred_at[a]] up to pred_at[a + 1] lead to a
+    uint16_t        preds[2 * MEM_SIZE];
+    uint16_t        caller_at[MEM_SIZE + 1];    // the same for the calls to a
+    uint16_t        callers[MEM_SIZE];
+    Consts          in[MAX_GAME_SIZE];          // per block, on the way in
+    uint16_t        order[MAX_GAME_SIZE];       // block worklist for the constants
+    bool            pending[MAX_GAME_SIZE];     // ... and which blocks are on it
+} Scan;
+
+static bool in_rom(const Scan* s, unsigned pc){
+    return pc >= CFG_ENTRY && pc + 1 < CFG_ENTRY + s->size;
+}
+
+static uint16_t fetch(const Scan* s, unsigned pc){
+    return s->rom[pc - CFG_ENTRY] << 8 | s->rom[pc + 1 - CFG_ENTRY];
+}
+
+// Same decode as EmulateCycle: anything it faults on is FLOW_BAD
+static Flow flow(uint16_t op){
+    unsigned kk = op & 0xFF, n = op & 0xF;
+
+    switch (op & 0xF000)
+    {
+        case 0x0000: return kk == 0xE0 ? FLOW_NEXT : kk == 0xEE ? FLOW_RET : FLOW_BAD;
+        case 0x1000: return FLOW_JUMP;
+        case 0x2000: return FLOW_CALL;
+        case 0x3000: case 0x4000: case 0x5000: return FLOW_SKIP;
+        case 0x8000: return (n <= 0x7 || n == 0xE) ? FLOW_NEXT : FLOW_BAD;
+        case 0x9000: return n == 0 ? FLOW_SKIP : FLOW_BAD;
+        case 0xB000: return FLOW_INDIRECT;
+        case 0xE000: return (kk == 0x9E || kk == 0xA1) ? FLOW_SKIP : FLOW_BAD;
+        case 0xF000:
+            switch (kk)
+            {
+                case 0x07: case 0x0A: case 0x15: case 0x18: case 0x1E:
+                case 0x29: case 0x33: case 0x55: case 0x65:
+                    return FLOW_NEXT;
+                default:
+                    return FLOW_BAD;
+            }
+        default: return FLOW_NEXT;
+    }
+}
+
+static void queue(Scan* s, unsigned pc, uint8_t flags){
+    pc &= MEM_MASK;
+    s->flags[pc] |= flags;
+    if (!(s->flags[pc] & F_QUEUED))
+    {
+        s->flags[pc] |= F_QUEUED;
+        s->work[s->top++] = pc;
+    }
+}
+
+// Finds every instruction that can run, starting over from 0x200. With
+// `all_calls` every call is taken to return; otherwise only calls to
+// subroutines already found to return go on past the call.
+static void explore(Scan* s, bool all_calls){
+    for (unsigned a = 0; a < MEM_SIZE; a++)
+    {
+        s->flags[a] &= F_RETURNS;
+    }
+    queue(s, CFG_ENTRY, F_LEADER);
+    while (s->top > 0)
+    {
+        unsigned pc = s->work[--s->top];
+        uint16_t op;
+
+        if (!in_rom(s, pc))
+        {
+            continue;
+        }
+        s->flags[pc] |= F_INSN;
+        op = fetch(s, pc);
+        switch (flow(op))
+        {
+            case FLOW_NEXT: queue(s, pc + 2, 0); break;
+            case FLOW_JUMP: queue(s, op & 0xFFF, F_LEADER); break;
+            case FLOW_CALL:
+                queue(s, op & 0xFFF, F_LEADER | F_SUB);
+                if (all_calls || (s->flags[op & 0xFFF] & F_RETURNS))
+                {
+                    queue(s, pc + 2, F_LEADER);
+                }
+                break;
+            case FLOW_SKIP:
+                queue(s, pc + 2, F_LEADER);
+                queue(s, pc + 4, F_LEADER);
+                break;
+            case FLOW_INDIRECT:
+                if (s->target[pc] != CFG_NONE)
+                {
+                    queue(s, s->target[pc], F_LEADER);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// Where an instruction can go without leaving its routine. A call goes on to
+// pc + 2, which only counts once the callee is known to return.
+static unsigned successors(const Scan* s, unsigned pc, unsigned next[2]){
+    uint16_t op = fetch(s, pc);
+
+    switch (flow(op))
+    {
+        case FLOW_NEXT: case FLOW_CALL:
+            next[0] = pc + 2;
+            return 1;
+        case FLOW_JUMP:
+            next[0] = op & 0xFFF;
+            return 1;
+        case FLOW_SKIP:
+            next[0] = pc + 2;
+            next[1] = pc + 4;
+            return 2;
+        case FLOW_INDIRECT:
+            next[0] = s->target[pc];
+            return s->target[pc] != CFG_NONE;
+        default:
+            return 0;
+    }
+}
+
+static void reaches(Scan* s, unsigned pc){
+    if (!(s->flags[pc] & F_REACHES))
+    {
+        s->flags[pc] |= F_REACHES;
+        s->work[s->top++] = pc;
+        if (s->flags[pc] & F_SUB)
+        {
+            s->flags[pc] |= F_RETURNS;
+        }
+    }
+}
+
+// Packs the edges into lists by address: list[at[a]] up to list[at[a + 1]]
+// are the ones for a. Call with at[] counted per address.
+static void pack(uint16_t at[MEM_SIZE + 1]){
+    for (unsigned a = 1; a <= MEM_SIZE; a++)
+    {
+        at[a] += at[a - 1];
+    }
+}
+
+// Finds the subroutines that can reach a 00EE, walking back from every 00EE
+// to the instructions that lead to it. Once a subroutine is found to return,
+// its call sites carry on back from the instruction after them. An indirect
+// jump that isn't resolved is taken to return, so the code after its call
+// still gets looked at.
+//
+// Run over the code explore(s, true) finds, which holds everything a
+// subroutine could reach. Each edge is walked once.
+static void find_returns(Scan* s){
+    memset(s->pred_at, 0, sizeof(s->pred_at));
+    memset(s->caller_at, 0, sizeof(s->caller_at));
+    for (unsigned pc = CFG_ENTRY; pc < MEM_SIZE; pc++)
+    {
+        unsigned next[2], num_next = (s->flags[pc] & F_INSN) ? successors(s, pc, next) : 0;
+
+        // From scratch, a Bnnn resolved since the last time may take one away
+        s->flags[pc] &= ~F_RETURNS;
+        for (unsigned i = 0; i < num_next; i++)
+        {
+            s->pred_at[next[i] & MEM_MASK]++;
+        }
+        if (num_next > 0 && flow(fetch(s, pc)) == FLOW_CALL)
+        {
+            s->caller_at[fetch(s, pc) & 0xFFF]++;
+        }
+    }
+    pack(s->pred_at);
+    pack(s->caller_at);
+    for (unsigned pc = MEM_SIZE; pc-- > CFG_ENTRY;)
+    {
+        unsigned next[2], num_next = (s->flags[pc] & F_INSN) ? successors(s, pc, next) : 0;
+
+        for (unsigned i = 0; i < num_next; i++)
+        {
+            s->preds[--s->pred_at[next[i] & MEM_MASK]] = pc;
+        }
+        if (num_next > 0 && flow(fetch(s, pc)) == FLOW_CALL)
+        {
+            s->callers[--s->caller_at[fetch(s, pc) & 0xFFF]] = pc;
+        }
+    }
+
+    for (unsigned pc = CFG_ENTRY; pc < MEM_SIZE; pc++)
+    {
+        uint16_t op = (s->flags[pc] & F_INSN) ? fetch(s, pc) : 0;
+
+        if (flow(op) == FLOW_RET || (flow(op) == FLOW_INDIRECT && s->target[pc] == CFG_NONE))
+        {
+            reaches(s, pc);
+        }
+    }
+    while (s->top > 0)
+    {
+        unsigned to = s->work[--s->top];
+
+        for (unsigned i = s->pred_at[to]; i < s->pred_at[to + 1]; i++)
+        {
+            uint16_t op = fetch(s, s->preds[i]);
+
+            if (flow(op) != FLOW_CALL || (s->flags[op & 0xFFF] & F_RETURNS))
+            {
+                reaches(s, s->preds[i]);
+            }
+        }
+        // It returns now, and so do the calls to it that had only it in the way
+        for (unsigned i = s->caller_at[to]; i < s->caller_at[to + 1]; i++)
+        {
+            unsigned pc = s->callers[i];
+
+            if (s->flags[(pc + 2) & MEM_MASK] & F_REACHES)
+            {
+                reaches(s, pc);
+            }
+        }
+    }
+}
+
+// Cuts the instructions into blocks, in address order
+static void find_blocks(Scan* s){
+    Chip8Cfg* cfg = s->cfg;
+
+    cfg->num_blocks = 0;
+    memset(cfg->block_at, 0, sizeof(cfg->block_at));
+    for (unsigned a = CFG_ENTRY; a < MEM_SIZE; a++)
+    {
+        Chip8CfgBlock* b;
+        unsigned pc = a;
+
+        if ((s->flags[a] & (F_INSN | F_LEADER)) != (F_INSN | F_LEADER))
+        {
+            continue;
+        }
+        b = &cfg->blocks[cfg->num_blocks++];
+        b->start   = a;
+        b->next[0] = b->next[1] = CFG_NONE;
+        b->routine = CFG_NONE;
+        cfg->block_at[a] = cfg->num_blocks;
+        for (;;)
+        {
+            uint16_t op = fetch(s, pc);
+            unsigned after = (pc + 2) & MEM_MASK;
+
+            b->end = pc + 2;
+            switch (flow(op))
+            {
+                case FLOW_NEXT:
+                    if (!(s->flags[after] & F_INSN))
+                    {
+                        b->exit = CFG_EXIT_OUTSIDE;
+                    }
+                    else if (s->flags[after] & F_LEADER)
+                    {
+                        b->exit    = CFG_EXIT_FALL;
+                        b->next[0] = after;
+                    }
+                    else
+                    {
+                        pc = after;
+                        continue;
+                    }
+                    break;
+                case FLOW_JUMP:
+                    b->exit    = CFG_EXIT_JUMP;
+                    b->next[0] = op & 0xFFF;
+                    break;
+                case FLOW_CALL:
+                    b->exit    = CFG_EXIT_CALL;
+                    b->next[0] = op & 0xFFF;
+                    if (s->flags[op & 0xFFF] & F_RETURNS)
+                    {
+                        b->next[1] = after;
+                    }
+                    break;
+                case FLOW_RET:
+                    b->exit = CFG_EXIT_RET;
+                    break;
+                case FLOW_SKIP:
+                    b->exit    = CFG_EXIT_SKIP;
+                    b->next[0] = after;
+                    b->next[1] = (pc + 4) & MEM_MASK;
+                    break;
+                case FLOW_INDIRECT:
+                    b->exit    = s->target[pc] != CFG_NONE ? CFG_EXIT_JUMP : CFG_EXIT_INDIRECT;
+                    b->next[0] = s->target[pc];
+                    break;
+                default:
+                    b->exit = CFG_EXIT_BAD;
+                    break;
+            }
+            break;
+        }
+    }
+}
+
+static const Chip8CfgBlock* block_at(const Chip8Cfg* cfg, unsigned addr){
+    unsigned index = addr < MEM_SIZE ? cfg->block_at[addr] : 0;
+
+    return index ? &cfg->blocks[index - 1] : NULL;
+}
+
+// ---- constants ----
+
+static int32_t meet(int32_t a, int32_t b){
+    if (a == UNSEEN)
+    {
+        return b;
+    }
+    return (b == UNSEEN || a == b) ? a : VARIES;
+}
+
+static bool known(int32_t v){
+    return v >= 0;
+}
+
+// 8xy4..8xyE: VF first, then Vx from the registers as they are after that,
+// as in EmulateCycle
+static void alu_flag(Consts* c, unsigned x, unsigned y, unsigned n){
+    int32_t vx = c->v[x], vy = c->v[y];
+
+    if (!known(vx) || !known(vy))
+    {
+        c->v[0xF] = VARIES;
+        c->v[x]   = VARIES;
+        return;
+    }
+    switch (n)
+    {
+        case 0x4: c->v[0xF] = vx + vy > 255;      break;
+        case 0x5: c->v[0xF] = vx > vy;            break;
+        case 0x6: c->v[0xF] = vx & 1;             break;
+        case 0x7: c->v[0xF] = vy > vx;            break;
+        default:  c->v[0xF] = (vx >> 7) & 1;      break;
+    }
+    vx = c->v[x];
+    vy = c->v[y];
+    switch (n)
+    {
+        case 0x4: c->v[x] = (vx + vy) & 0xFF;     break;
+        case 0x5: c->v[x] = (vx - vy) & 0xFF;     break;
+        case 0x6: c->v[x] = vx >> 1;              break;
+        case 0x7: c->v[x] = (vy - vx) & 0xFF;     break;
+        default:  c->v[x] = (vx << 1) & 0xFF;     break;
+    }
+}
+
+// What one instruction leaves in the registers
+static void step(Consts* c, uint16_t op){
+    unsigned x = (op >> 8) & 0xF, y = (op >> 4) & 0xF, kk = op & 0xFF, n = op & 0xF;
+
+    switch (op & 0xF000)
+    {
+        case 0x6000: c->v[x] = kk; break;
+        case 0x7000: c->v[x] = known(c->v[x]) ? (c->v[x] + (int32_t) kk) & 0xFF : VARIES; break;
+        case 0x8000:
+            switch (n)
+            {
+                case 0x0: c->v[x] = c->v[y]; break;
+                case 0x1: c->v[x] = known(c->v[x]) && known(c->v[y]) ? c->v[x] | c->v[y] : VARIES; break;
+                case 0x2: c->v[x] = known(c->v[x]) && known(c->v[y]) ? c->v[x] & c->v[y] : VARIES; break;
+                case 0x3: c->v[x] = known(c->v[x]) && known(c->v[y]) ? c->v[x] ^ c->v[y] : VARIES; break;
+                default:  alu_flag(c, x, y, n); break;
+            }
+            break;
+        case 0xA000: c->I = op & 0xFFF; break;
+        case 0xC000: c->v[x] = VARIES; break;
+        case 0xD000: c->v[0xF] = VARIES; break;
+        case 0xF000:
+            switch (kk)
+            {
+                case 0x07: case 0x0A: c->v[x] = VARIES; break;
+                case 0x1E:
+                    if (known(c->I) && known(c->v[x]))
+                    {
+                        c->v[0xF] = c->I + c->v[x] > 0xFFF;
+                        c->I = (c->I + c->v[x]) & 0xFFFF;
+                    }
+                    else
+                    {
+                        c->v[0xF] = VARIES;
+                        c->I = VARIES;
+                    }
+                    break;
+                case 0x29: c->I = known(c->v[x]) ? FONTSET_BYTES_PER_CHAR * c->v[x] : VARIES; break;
+                case 0x55: c->I = known(c->I) ? (c->I + (int32_t) x + 1) & 0xFFFF : VARIES; break;
+                case 0x65:
+                    for (unsigned r = 0; r <= x; r++)
+                    {
+                        c->v[r] = VARIES;
+                    }
+                    c->I = known(c->I) ? (c->I + (int32_t) x + 1) & 0xFFFF : VARIES;
+                    break;
+            }
+            break;
+    }
+}
+
+static void merge(Scan* s, unsigned addr, const Consts* c, unsigned* top){
+    const Chip8CfgBlock* b = block_at(s->cfg, addr);
+    Consts* in;
+    bool changed = false;
+
+    if (b == NULL)
+    {
+        return;
+    }
+    in = &s->in[b - s->cfg->blocks];
+    for (int r = 0; r < 16; r++)
+    {
+        int32_t v = meet(in->v[r], c->v[r]);
+        changed |= v != in->v[r];
+        in->v[r] = v;
+    }
+    int32_t I = meet(in->I, c->I);
+    changed |= I != in->I;
+    in->I = I;
+    if (changed && !s->pending[b - s->cfg->blocks])
+    {
+        s->pending[b - s->cfg->blocks] = true;
+        s->order[(*top)++] = b - s->cfg->blocks;
+    }
+}
+
+// Runs the constants to a fixed point, block by block. A machine starts with
+// everything 0, and nothing is known after a call returns.
+static void propagate(Scan* s){
+    Chip8Cfg* cfg = s->cfg;
+    Consts start, unknown;
+    unsigned top = 0;
+
+    for (unsigned i = 0; i < cfg->num_blocks; i++)
+    {
+        s->pending[i] = false;
+        s->in[i].I = UNSEEN;
+        for (int r = 0; r < 16; r++)
+        {
+            s->in[i].v[r] = UNSEEN;
+        }
+    }
+    memset(&start, 0, sizeof(start));
+    unknown.I = VARIES;
+    for (int r = 0; r < 16; r++)
+    {
+        unknown.v[r] = VARIES;
+    }
+
+    merge(s, CFG_ENTRY, &start, &top);
+    while (top > 0)
+    {
+        const Chip8CfgBlock* b = &cfg->blocks[s->order[--top]];
+        Consts c = s->in[b - cfg->blocks];
+
+        s->pending[b - cfg->blocks] = false;
+        for (unsigned pc = b->start; pc < b->end; pc += 2)
+        {
+            step(&c, fetch(s, pc));
+        }
+        switch (b->exit)
+        {
+            case CFG_EXIT_CALL:
+                merge(s, b->next[0], &c, &top);
+                if (b->next[1] != CFG_NONE)
+                {
+                    merge(s, b->next[1], &unknown, &top);
+                }
+                break;
+            default:
+                for (int i = 0; i < 2; i++)
+                {
+                    if (b->next[i] != CFG_NONE)
+                    {
+                        merge(s, b->next[i], &c, &top);
+                    }
+                }
+                break;
+        }
+    }
+}
+
+// Bnnn sites whose V0 is known now. Returns true if it found any.
+static bool resolve(Scan* s){
+    Chip8Cfg* cfg = s->cfg;
+    bool found = false;
+
+    for (unsigned i = 0; i < cfg->num_blocks; i++)
+    {
+        const Chip8CfgBlock* b = &cfg->blocks[i];
+        unsigned last = b->end - 2;
+        uint16_t op = fetch(s, last);
+        Consts c = s->in[i];
+
+        if (flow(op) != FLOW_INDIRECT || s->target[last] != CFG_NONE)
+        {
+            continue;
+        }
+        for (unsigned pc = b->start; pc < last; pc += 2)
+        {
+            step(&c, fetch(s, pc));
+        }
+        if (known(c.v[0]))
+        {
+            s->target[last] = ((op & 0xFFF) + c.v[0]) & MEM_MASK;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// ---- the result ----
+
+static void mark(Scan* s, int32_t addr, unsigned len, Chip8CfgKind kind){
+    for (unsigned i = 0; i < len; i++)
+    {
+        unsigned a = (addr + i) & MEM_MASK;
+        if (a >= CFG_ENTRY && a < CFG_ENTRY + s->size && s->cfg->kind[a] == CFG_UNKNOWN)
+        {
+            s->cfg->kind[a] = kind;
+        }
+    }
+}
+
+static bool covers_code(const Scan* s, int32_t addr, unsigned len){
+    for (unsigned i = 0; i < len; i++)
+    {
+        if (s->cfg->kind[(addr + i) & MEM_MASK] == CFG_CODE)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void add_site(Chip8CfgSite* sites, unsigned* num, unsigned pc, uint16_t op, int32_t addr, bool hits_code){
+    Chip8CfgSite* site = &sites[(*num)++];
+
+    site->pc        = pc;
+    site->opcode    = op;
+    site->addr      = known(addr) ? (uint16_t) addr : CFG_NONE;
+    site->hits_code = hits_code;
+}
+
+// Fills in the byte map and the lists of sites from the final constants
+static void collect(Scan* s){
+    Chip8Cfg* cfg = s->cfg;
+
+    for (unsigned a = CFG_ENTRY; a < MEM_SIZE; a++)
+    {
+        if (s->flags[a] & F_INSN)
+        {
+            if (cfg->kind[a] == CFG_CODE)
+            {
+                cfg->overlaps++;
+            }
+            cfg->kind[a] = CFG_CODE;
+            cfg->kind[(a + 1) & MEM_MASK] = CFG_CODE;
+        }
+    }
+
+    for (unsigned i = 0; i < cfg->num_blocks; i++)
+    {
+        const Chip8CfgBlock* b = &cfg->blocks[i];
+        Consts c = s->in[i];
+
+        for (unsigned pc = b->start; pc < b->end; pc += 2)
+        {
+            uint16_t op = fetch(s, pc);
+            unsigned x = (op >> 8) & 0xF;
+
+            switch (op & 0xF0FF)
+            {
+                case 0xF033:
+                case 0xF055:
+                {
+                    unsigned len = (op & 0xFF) == 0x33 ? 3 : x + 1;
+                    bool hits = known(c.I) && covers_code(s, c.I, len);
+
+                    if (!known(c.I) || hits)
+                    {
+                        add_site(cfg->writes, &cfg->num_writes, pc, op, c.I, hits);
+                    }
+                    else
+                    {
+                        mark(s, c.I, len, CFG_DATA);
+                    }
+                    break;
+                }
+                case 0xF065:
+                    if (known(c.I))
+                    {
+                        mark(s, c.I, x + 1, CFG_DATA);
+                    }
+                    break;
+                default:
+                    if ((op & 0xF000) == 0xD000 && known(c.I))
+                    {
+                        mark(s, c.I, op & 0xF, CFG_SPRITE);
+                    }
+                    else if ((op & 0xF000) == 0x2000)
+                    {
+                        add_site(cfg->calls, &cfg->num_calls, pc, op, op & 0xFFF, false);
+                    }
+                    else if ((op & 0xF000) == 0xB000)
+                    {
+                        add_site(cfg->indirect, &cfg->num_indirect, pc, op,
+                                 known(c.v[0]) ? ((op & 0xFFF) + c.v[0]) & MEM_MASK : VARIES, false);
+                    }
+                    break;
+            }
+            step(&c, op);
+        }
+    }
+}
+
+// Gives each block to the first routine that reaches it without a call:
+// the program from 0x200, then the subroutines by address
+static void find_routines(Scan* s){
+    Chip8Cfg* cfg = s->cfg;
+
+    cfg->num_routines = 0;
+    for (unsigned a = CFG_ENTRY; a < MEM_SIZE; a++)
+    {
+        unsigned top = 0;
+        uint16_t* stack = s->order;
+        const Chip8CfgBlock* first = block_at(cfg, a);
+
+        if (first == NULL || (a != CFG_ENTRY && !(s->flags[a] & F_SUB)))
+        {
+            continue;
+        }
+        cfg->returns[cfg->num_routines]    = (s->flags[a] & F_RETURNS) != 0;
+        cfg->routines[cfg->num_routines++] = a;
+        if (first->routine != CFG_NONE)
+        {
+            continue;
+        }
+        cfg->blocks[first - cfg->blocks].routine = a;
+        stack[top++] = first - cfg->blocks;
+        while (top > 0)
+        {
+            Chip8CfgBlock* b = &cfg->blocks[stack[--top]];
+
+            for (int i = b->exit == CFG_EXIT_CALL ? 1 : 0; i < 2; i++)
+            {
+                const Chip8CfgBlock* to = b->next[i] != CFG_NONE ? block_at(cfg, b->next[i]) : NULL;
+                if (to != NULL && to->routine == CFG_NONE)
+                {
+                    cfg->blocks[to - cfg->blocks].routine = a;
+                    stack[top++] = to - cfg->blocks;
+                }
+            }
+        }
+    }
+}
+
+Chip8Cfg* Chip8CfgBuild(const uint8_t* rom, unsigned size){
+    Chip8Cfg* cfg = calloc(1, sizeof(Chip8Cfg));
+    Scan* s = malloc(sizeof(Scan));
+    int round = 0;
+
+    if (cfg == NULL || s == NULL)
+    {
+        free(cfg);
+        free(s);
+        return NULL;
+    }
+    if (size > MAX_GAME_SIZE)
+    {
+        size = MAX_GAME_SIZE;
+    }
+    cfg->rom_size = size;
+    s->cfg   = cfg;
+    s->rom   = rom;
+    s->size  = size;
+    s->top   = 0;
+    memset(s->flags, 0, sizeof(s->flags));
+    memset(s->target, 0xFF, sizeof(s->target));
+
+    for (;;)
+    {
+        explore(s, true);
+        find_returns(s);
+        explore(s, false);
+        find_blocks(s);
+        propagate(s);
+        // Past the last round, any Bnnn left stays indirect
+        if (round++ == MAX_ROUNDS || !resolve(s))
+        {
+            break;
+        }
+    }
+    collect(s);
+    find_routines(s);
+    free(s);
+    return cfg;
+}
+
+void Chip8CfgFree(Chip8Cfg* cfg){
+    free(cfg);
+}
+
+void Chip8CfgCount(const Chip8Cfg* cfg, unsigned counts[CFG_KINDS]){
+    memset(counts, 0, CFG_KINDS * sizeof(unsigned));
+    for (unsigned a = CFG_ENTRY; a < CFG_ENTRY + cfg->rom_size; a++)
+    {
+        counts[cfg->kind[a]]++;
+    }
+}
+
+const Chip8CfgBlock* Chip8CfgBlockOf(const Chip8Cfg* cfg, unsigned addr){
+    unsigned lo = 0, hi = cfg->num_blocks;
+
+    // Last block starting at or before addr
+    while (lo < hi)
+    {
+        unsigned mid = (lo + hi) / 2;
+        if (cfg->blocks[mid].start <= addr)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    if (lo == 0 || addr >= cfg->blocks[lo - 1].end)
+    {
+        return NULL;
+    }
+    return &cfg->blocks[lo - 1];
+}
@@ -0,0 +1,101 @@
+// Static control flow analysis of a ROM, without running it. Starts at 0x200
+// and follows jumps, calls, returns and skips to find every instruction that
+// can run. The result is split into basic blocks with their successors, a
+// call graph, and a map of which ROM bytes are code, sprites or other data.
+//
+// Inside the code it tracks constant values of V0 to VF and I from block to
+// block. With I known, a DRW marks its sprite bytes and Fx65 its data. A
+// Bnnn whose V0 is known is followed like a jump, and the rest are reported
+// as indirect. Fx33 and Fx55 writes into code, or with I unknown, are
+// reported as possible self-modification.
+//
+// Calls are assumed to come back only if the subroutine can reach a 00EE.
+// Code reached only through an unresolved Bnnn stays unknown.
+//
+// Nothing here touches a machine; chip8_analyze (analyze.c) prints the
+// result. A whole ROM takes well under a millisecond.
+
+#ifndef CHIP_8_CFG
+#define CHIP_8_CFG
+
+#include "chip8.h"
+
+#define CFG_ENTRY   0x200
+#define CFG_NONE    0xFFFF                      // no address
+
+// What a byte of the ROM was found to be
+typedef enum
+{
+    CFG_UNKNOWN = 0,                            // nothing known reaches it
+    CFG_CODE,                                   // part of an instruction that can run
+    CFG_SPRITE,                                 // drawn by a DRW with I known
+    CFG_DATA,                                   // read by Fx65 or written by Fx33/Fx55 with I known
+    CFG_KINDS
+} Chip8CfgKind;
+
+// How a block ends
+typedef enum
+{
+    CFG_EXIT_FALL = 0,                          // runs into the next block, next[0]
+    CFG_EXIT_JUMP,                              // 1nnn, or Bnnn with V0 known: next[0]
+    CFG_EXIT_CALL,                              // 2nnn: next[0] callee, next[1] return, NONE if it never does
+    CFG_EXIT_RET,                               // 00EE
+    CFG_EXIT_SKIP,                              // next[0] not taken, next[1] taken
+    CFG_EXIT_INDIRECT,                          // Bnnn with V0 unknown
+    CFG_EXIT_BAD,                               // unknown opcode, the machine faults
+    CFG_EXIT_OUTSIDE,                           // next instruction isn't in the ROM
+    CFG_EXITS
+} Chip8CfgExit;
+
+typedef struct
+{
+    uint16_t    start;
+    uint16_t    end;                            // address after the last instruction
+    uint16_t    next[2];                        // successors, CFG_NONE if not used
+    uint16_t    routine;                        // CFG_ENTRY or the subroutine it was found in first
+    uint8_t     exit;                           // Chip8CfgExit
+} Chip8CfgBlock;
+
+// A 2nnn, Bnnn, Fx33 or Fx55 worth listing, and what I or V0 was
+typedef struct
+{
+    uint16_t    pc;
+    uint16_t    opcode;
+    uint16_t    addr;                           // call target, jump target or I, CFG_NONE if not known
+    bool        hits_code;                      // a write whose known range covers code
+} Chip8CfgSite;
+
+typedef struct
+{
+    unsigned        rom_size;
+    uint8_t         kind[MEM_SIZE];             // Chip8CfgKind per byte, 0x200 up
+    unsigned        overlaps;                   // instructions that share bytes with another one
+    uint16_t        block_at[MEM_SIZE];         // index + 1 of the block starting there, 0 = none
+
+    Chip8CfgBlock   blocks[MAX_GAME_SIZE];      // by start address
+    unsigned        num_blocks;
+
+    uint16_t        routines[MAX_GAME_SIZE];    // CFG_ENTRY, then subroutine entries by address
+    bool            returns[MAX_GAME_SIZE];     // same order: the routine can reach a 00EE
+    unsigned        num_routines;
+
+    Chip8CfgSite    calls[MAX_GAME_SIZE];       // by site
+    unsigned        num_calls;
+    Chip8CfgSite    indirect[MAX_GAME_SIZE];    // Bnnn sites; addr is the target when V0 is known
+    unsigned        num_indirect;
+    Chip8CfgSite    writes[MAX_GAME_SIZE];      // Fx33 and Fx55 that could write code
+    unsigned        num_writes;
+} Chip8Cfg;
+
+// Analyzes a ROM image as it would be loaded at 0x200. Returns NULL when out
+// of memory.
+Chip8Cfg* Chip8CfgBuild(const uint8_t* rom, unsigned size);
+void Chip8CfgFree(Chip8Cfg* cfg);
+
+// Bytes of the ROM of each Chip8CfgKind
+void Chip8CfgCount(const Chip8Cfg* cfg, unsigned counts[CFG_KINDS]);
+
+// The block holding addr, or NULL if it isn't code
+const Chip8CfgBlock* Chip8CfgBlockOf(const Chip8Cfg* cfg, unsigned addr);
+
+#endif
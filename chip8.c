@@ -1,108 +1,30 @@
 #include "chip8.h"
-
-#define unknown_opcode(op) \
+#include "chip8_ops.h"
+#include "predecode.h"
+#include "jit.h"
+#include "stats.h"
+#include "trace.h"
+
+// Stops this machine on the instruction it is at and leaves EmulateCycle
+#define fault(kind) \
     do \
     { \
-        fprintf(stderr, "Unknown opcode: 0x%x\n", op); \
-        fprintf(stderr, "kk: 0x%02x\n", kk); \
-        exit(42); \
+        raise_fault(chip8, kind); \
+        return chip8->fault; \
     } while (0)
-    
-#ifdef DEBUG
-#define p(...) printf(__VA_ARGS__);
-#else
-#define p(...)
-#endif
-
-#define IS_BIT_SET(byte, bit) (((0x80 >> (bit)) & (byte)) != 0x0)
-
-#define FONTSET_ADDRESS 0x00
-#define FONTSET_BYTES_PER_CHAR 5
-unsigned char fontset[80] =
-{
-	0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-	0x20, 0x60, 0x20, 0x20, 0x70, // 1
-	0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-	0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-	0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-	0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-	0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-	0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-	0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-	0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-	0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-	0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-	0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-	0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-	0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
-};
-
-uint16_t    opcode;
-uint8_t     memory[MEM_SIZE];
-uint8_t     registers[16];
-uint16_t    IndexRegister;
-uint16_t    PC;
-uint8_t     gfx[GFX_ROWS][GFX_COLS];
-uint8_t     DelayTimer;
-uint8_t     SoundTimer;
-uint16_t    stack[STACK_SIZE];
-uint16_t    stkptr;
-uint8_t     key[KEYPAD_SIZE];
-bool        chip8_draw_flag;
-
-static inline uint8_t randbyte(){
-    return (rand() % 256);
-}
-
-/*
-inline:
-A hint to the compiler to replace the function call with the actual code of the function at compile time.
-Reduces the overhead of a function call but may increase binary size if the function is used in many places.
-*/
-
-// This is basically Dxyn instruction
-
-void draw_sprite(uint8_t x, uint8_t y, uint8_t n){
-    unsigned row = y, col = x;
-    unsigned byte_index;
-    unsigned bit_index;
 
-    // In C (and C++), when you use the unsigned keyword without explicitly specifying the type, it is implicitly treated as unsigned int
+#define IDLE_MAX_LOOP   16                      // longest loop Chip8SkipIdle looks at
+#define IDLE_BACKOFF    64                      // jumps back to a busy loop before looking again
 
-    // setting collision flag to 0
-    registers[0xF] = 0;
-
-    for (byte_index = 0; byte_index < n; byte_index++)
-    {
-        uint8_t byte = memory[IndexRegister + byte_index];
-
-        for (bit_index = 0; bit_index < 8; bit_index++)
-        {
-            uint8_t bit = (byte >> bit_index) & 0x1; // bit value in sprite
-            uint8_t *pixelp = &gfx[(row + byte_index) % GFX_ROWS][(col + (7 - bit_index)) % GFX_COLS];
-
-            // Collision
-            if (bit == 1 && *pixelp == 1)
-            {
-                registers[0xF] = 1;
-            }
-
-            // Draw pixel
-            *pixelp = *pixelp ^ bit;
-            
-        }
-        
-    }
-}
-
-static void debug_draw(){
+// Only for -DDEBUG builds, so the others don't warn about them
+#ifdef DEBUG
+static void debug_draw(CHIP8* chip8){
     int x,y;
     for (y = 0; y < GFX_ROWS; y++)
     {
         for (x = 0; x < GFX_COLS; x++)
         {
-            if (gfx[y][x] == 0)
+            if (GFX_PIXEL(chip8, y, x) == 0)
             {
                 printf("0");
             }else{
@@ -115,52 +37,69 @@ static void debug_draw(){
     printf("\n");
 }
 
-static void print_state(){
+static void print_state(CHIP8* chip8){
     printf("------------------------------------------\n");
     printf("\n");
 
     printf("V0: 0x%02x  V4: 0x%02x  V8: 0x%02x  VC: 0x%02x\n",
-            registers[0], registers[4], registers[8], registers[12]);
+            chip8->registers[0], chip8->registers[4], chip8->registers[8], chip8->registers[12]);
 
     printf("V1: 0x%02x  V5: 0x%02x  V9: 0x%02x  VD: 0x%02x\n",
-            registers[1], registers[5], registers[9], registers[13]);
+            chip8->registers[1], chip8->registers[5], chip8->registers[9], chip8->registers[13]);
 
     printf("V2: 0x%02x  V6: 0x%02x  VA: 0x%02x  VE: 0x%02x\n",
-            registers[2], registers[6], registers[10], registers[14]);
+            chip8->registers[2], chip8->registers[6], chip8->registers[10], chip8->registers[14]);
 
     printf("V3: 0x%02x  V7: 0x%02x  VB: 0x%02x  VF: 0x%02x\n",
-            registers[3], registers[7], registers[11], registers[15]);
+            chip8->registers[3], chip8->registers[7], chip8->registers[11], chip8->registers[15]);
 
     printf("\n");
-    printf("PC: 0x%04x\n", PC);
+    printf("PC: 0x%04x\n", chip8->PC);
     printf("\n");
     printf("\n");
 }
+#endif
 
-void InitializeChip8(){
-    PC              = 0x200;
-    opcode          = 0;
-    IndexRegister   = 0;
-    stkptr          = 0;
-
-    memset(memory, 0, sizeof(uint8_t)*MEM_SIZE);
-    memset(registers, 0, sizeof(uint8_t)*16);
-    memset(gfx,    0, sizeof(uint8_t)  * GFX_SIZE);
-    memset(stack,  0, sizeof(uint16_t) * STACK_SIZE);
-    memset(key,    0, sizeof(uint8_t)  * KEYPAD_SIZE);
-
-    for (int i = 0; i < 80; i++)
-    {
-        memory[FONTSET_ADDRESS + i] = fontset[i];
-    }
+void InitializeChip8(CHIP8* chip8){
+    chip8->PC              = 0x200;
+    chip8->opcode          = 0;
+    chip8->IndexRegister   = 0;
+    chip8->stkptr          = 0;
+
+    memset(chip8->registers, 0, sizeof(uint8_t)*16);
+    memset(chip8->fb,     0, sizeof(uint64_t) * GFX_ROWS);
+    memset(chip8->stack,  0, sizeof(uint16_t) * STACK_SIZE);
+    memset(chip8->key,    0, sizeof(uint8_t)  * KEYPAD_SIZE);
+
+    // Nothing to release yet, this only sets up the font and the zeros
+    memset(chip8->page_ref, 0, sizeof(chip8->page_ref));
+    Chip8ReleaseMemory(chip8);
+
+    chip8->draw_flag = true;
+    chip8->dirty_rows = ~0u;
+    chip8->waiting = false;
+    chip8->fault = CHIP8_OK;
+    chip8->ticks = 0;
+    chip8->cycles = 0;
+    chip8->DelayTimer = 0;
+    chip8->SoundTimer = 0;
+    chip8->predecode = NULL;
+    chip8->jit = NULL;
+    chip8->stats = NULL;
+    chip8->trace = NULL;
+    chip8->idle_skipped = 0;
+    memset(chip8->idle_pc, 0, sizeof(chip8->idle_pc));
+    memset(chip8->idle_backoff, 0, sizeof(chip8->idle_backoff));
+    Chip8Seed(chip8, (uint32_t) time(NULL));
+}
 
-    chip8_draw_flag = true;
-    DelayTimer = 0;
-    SoundTimer = 0;
-    srand(time(NULL));
+void Chip8Seed(CHIP8* chip8, uint32_t seed){
+    chip8->rng = rng_from_seed(seed);
 }
 
-void LoadGame(char* game){
+bool LoadGame(CHIP8* chip8, char* game){
+    uint8_t rom[MAX_GAME_SIZE];
+    size_t size;
     FILE* fptr;
 
     fptr = fopen(game, "rb");
@@ -168,304 +107,586 @@ void LoadGame(char* game){
     if (fptr == NULL)
     {
         fprintf(stderr, "Unable to open game: %s\n", game);
-        exit(42);
+        return false;
     }
 
-    fread(&memory[0x200], 1, MAX_GAME_SIZE, fptr);
+    size = fread(rom, 1, MAX_GAME_SIZE, fptr);
+    Chip8WriteMemory(chip8, 0x200, rom, (unsigned) size);
 
-    fclose(fptr);    
+    fclose(fptr);
+    return true;
 }
 
 // The detailed explanations of each opcode functionalities are there in old file
-void EmulateCycle(){
+// Lowest key that is down, or -1
+static int pressed_key(const CHIP8* chip8){
+    for (int i = 0; i < KEYPAD_SIZE; i++)
+    {
+        if (chip8->key[i])
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char* Chip8FaultName(Chip8Fault fault){
+    static const char* names[CHIP8_FAULT_COUNT] =
+    {
+        "no fault", "unknown opcode", "stack overflow", "stack underflow", "key out of range"
+    };
+
+    return (unsigned) fault < CHIP8_FAULT_COUNT ? names[fault] : "unknown fault";
+}
+
+static void raise_fault(CHIP8* chip8, Chip8Fault kind){
+    // Halted like Fx0A, except that no key gets it going again. The trace
+    // gets written out first, with the bad instruction on the end.
+    chip8->fault = kind;
+    chip8->waiting = true;
+    Chip8TraceFault(chip8);
+}
+
+Chip8Fault EmulateCycle(CHIP8* chip8){
     int i;
     uint8_t x, y, n;
     uint8_t kk;
     uint16_t nnn;
+    uint8_t bcd[3];
+
+    // Halted in Fx0A: nothing to do until a key is down, then run the Fx0A
+    // again to take it. A faulted machine stays put.
+    if (chip8->waiting)
+    {
+        if (chip8->fault != CHIP8_OK || pressed_key(chip8) < 0)
+        {
+            return chip8->fault;
+        }
+        chip8->waiting = false;
+    }
 
     // Instruction fetch
-    opcode = memory[PC] << 8 | memory[PC + 1];
-    x   = (opcode >> 8) & 0x000F;
-    y   = (opcode >> 4) & 0x000F;
-    n   = opcode & 0x000F;
-    kk  = opcode & 0x00FF;
-    nnn = opcode & 0x0FFF;
+    chip8->opcode = fetch_opcode(chip8, chip8->PC);
+    x   = (chip8->opcode >> 8) & 0x000F;
+    y   = (chip8->opcode >> 4) & 0x000F;
+    n   = chip8->opcode & 0x000F;
+    kk  = chip8->opcode & 0x00FF;
+    nnn = chip8->opcode & 0x0FFF;
 
     #ifdef DEBUG 
-    printf("PC: 0x%04x Op: 0x%04x\n", PC, opcode);
+    printf("PC: 0x%04x Op: 0x%04x\n", chip8->PC, chip8->opcode);
     #endif
 
     // Instruction decode and execute
-    switch (opcode & 0xF000)
+    switch (chip8->opcode & 0xF000)
     {
         case 0x0000:
             switch(kk){
                 case 0x00E0:
                     p("Clear Screen\n");
-                    memset(gfx, 0, sizeof(uint8_t)*GFX_SIZE);
-                    chip8_draw_flag = true;
-                    PC = PC + 2;
+                    memset(chip8->fb, 0, sizeof(uint64_t)*GFX_ROWS);
+                    chip8->dirty_rows = ~0u;
+                    chip8->draw_flag = true;
+                    chip8->PC = chip8->PC + 2;
                     break;
                 case 0x00EE:
                     p("Return from subroutine\n");
-                    PC = stack[--stkptr];
+                    if (chip8->stkptr == 0)
+                    {
+                        fault(CHIP8_FAULT_STACK_UNDERFLOW);
+                    }
+                    chip8->PC = chip8->stack[--chip8->stkptr];
                     break;
                 default:
-                    unknown_opcode(opcode);
+                    fault(CHIP8_FAULT_OPCODE);
             }
         break;
 
         case 0x1000:
             p("Jump to address 0x%x\n", nnn);
-            PC = nnn;
+            chip8->PC = nnn;
             break;
         
         case 0x2000:
             p("Call subroutine at 0x%04X\n", nnn);
-            stack[stkptr++] = PC + 2;
-            PC = nnn;
+            if (chip8->stkptr >= STACK_SIZE)
+            {
+                fault(CHIP8_FAULT_STACK_OVERFLOW);
+            }
+            chip8->stack[chip8->stkptr++] = (chip8->PC + 2) & MEM_MASK;
+            chip8->PC = nnn;
             break;
         
         case 0x3000:
-            p("Skip next instruction if 0x%x == 0x%x\n", registers[x], kk);
-            PC += (registers[x] == kk) ? 4 : 2;
+            p("Skip next instruction if 0x%x == 0x%x\n", chip8->registers[x], kk);
+            chip8->PC += (chip8->registers[x] == kk) ? 4 : 2;
             break;
         
         case 0x4000:
-            p("Skip next instruction if 0x%x != 0x%x\n", registers[x], kk);
-            PC += (registers[x] != kk) ? 4 : 2;
+            p("Skip next instruction if 0x%x != 0x%x\n", chip8->registers[x], kk);
+            chip8->PC += (chip8->registers[x] != kk) ? 4 : 2;
             break;
 
         case 0x5000:
-            p("Skip next instruction if 0x%x == 0x%x\n", registers[x], registers[y]);
-            PC += (registers[x] == registers[y]) ? 4 : 2;
+            p("Skip next instruction if 0x%x == 0x%x\n", chip8->registers[x], chip8->registers[y]);
+            chip8->PC += (chip8->registers[x] == chip8->registers[y]) ? 4 : 2;
             break;
 
         case 0x6000:
             p("Set V[0x%x] to 0x%x\n", x, kk);
-            registers[x] = kk;
-            PC += 2;
+            chip8->registers[x] = kk;
+            chip8->PC += 2;
             break;
 
         case 0x7000:
             p("Set V[0x%d] to V[0x%d] + 0x%x\n", x, x, kk);
-            registers[x] += kk;
-            PC += 2;
+            chip8->registers[x] += kk;
+            chip8->PC += 2;
             break;
 
         case 0x8000:
             switch(n){
                 case 0x0:
-                    p("V[0x%x] = V[0x%x] = 0x%x\n", x, y, registers[y]);
-                    registers[x] = registers[y];
+                    p("V[0x%x] = V[0x%x] = 0x%x\n", x, y, chip8->registers[y]);
+                    chip8->registers[x] = chip8->registers[y];
                     break;
                 
                 case 0x1:
-                    p("V[0x%x] |= V[0x%x] = 0x%x\n", x, y, registers[y]);
-                    registers[x] = registers[x] | registers[y];
+                    p("V[0x%x] |= V[0x%x] = 0x%x\n", x, y, chip8->registers[y]);
+                    chip8->registers[x] = chip8->registers[x] | chip8->registers[y];
                     break;
 
                 case 0x2:
-                    p("V[0x%x] &= V[0x%x] = 0x%x\n", x, y, registers[y]);
-                    registers[x] = registers[x] & registers[y];
+                    p("V[0x%x] &= V[0x%x] = 0x%x\n", x, y, chip8->registers[y]);
+                    chip8->registers[x] = chip8->registers[x] & chip8->registers[y];
                     break;
 
                 case 0x3:
-                    p("V[0x%x] ^= V[0x%x] = 0x%x\n", x, y, registers[y]);
-                    registers[x] = registers[x] ^ registers[y];
+                    p("V[0x%x] ^= V[0x%x] = 0x%x\n", x, y, chip8->registers[y]);
+                    chip8->registers[x] = chip8->registers[x] ^ chip8->registers[y];
                     break;
 
                 case 0x4:
-                    p("Add V[%d] (0x%02X) + V[%d] (0x%02X)", x, registers[x], y, registers[y]);
-                    registers[0xF] = ((int) registers[x] + (int) registers[y]) > 255 ? 1 : 0;
-                    registers[x] = registers[x] + registers[y];
+                    p("Add V[%d] (0x%02X) + V[%d] (0x%02X)", x, chip8->registers[x], y, chip8->registers[y]);
+                    chip8->registers[0xF] = ((int) chip8->registers[x] + (int) chip8->registers[y]) > 255 ? 1 : 0;
+                    chip8->registers[x] = chip8->registers[x] + chip8->registers[y];
                     break;
 
                 case 0x5:
-                    p("Subtract V[%d] (0x%02X) - V[%d] (0x%02X)", x, registers[x], y, registers[y]);
-                    registers[0xF] = (registers[x] > registers[y]) ? 1 : 0;
-                    registers[x] = registers[x] - registers[y];
+                    p("Subtract V[%d] (0x%02X) - V[%d] (0x%02X)", x, chip8->registers[x], y, chip8->registers[y]);
+                    chip8->registers[0xF] = (chip8->registers[x] > chip8->registers[y]) ? 1 : 0;
+                    chip8->registers[x] = chip8->registers[x] - chip8->registers[y];
                     break;
 
                 case 0x6:
-                    p("V[0x%x] = V[0x%x] >> 1 = 0x%x >> 1\n", x, x, registers[x]);
-                    registers[0xF] = registers[x] & 0x1;
-                    registers[x] = (registers[x] >> 1);
+                    p("V[0x%x] = V[0x%x] >> 1 = 0x%x >> 1\n", x, x, chip8->registers[x]);
+                    chip8->registers[0xF] = chip8->registers[x] & 0x1;
+                    chip8->registers[x] = (chip8->registers[x] >> 1);
                     break;
 
                 case 0x7:
-                    p("Subtract V[%d] (0x%02X) - V[%d] (0x%02X)\n", y, registers[y], x, registers[x]);
-                    registers[0xF] = (registers[y] > registers[x]) ? 1 : 0;
-                    registers[x] = registers[y] - registers[x];
+                    p("Subtract V[%d] (0x%02X) - V[%d] (0x%02X)\n", y, chip8->registers[y], x, chip8->registers[x]);
+                    chip8->registers[0xF] = (chip8->registers[y] > chip8->registers[x]) ? 1 : 0;
+                    chip8->registers[x] = chip8->registers[y] - chip8->registers[x];
                     break;
                 
                 case 0xE:
-                    p("V[0x%x] = V[0x%x] << 1 = 0x%x << 1\n", x, x, registers[x]);
-                    registers[0xF] = (registers[x] >> 7) & 0x1;
-                    registers[x] = (registers[x] << 1);
+                    p("V[0x%x] = V[0x%x] << 1 = 0x%x << 1\n", x, x, chip8->registers[x]);
+                    chip8->registers[0xF] = (chip8->registers[x] >> 7) & 0x1;
+                    chip8->registers[x] = (chip8->registers[x] << 1);
                     break;
 
                 default:
-                    unknown_opcode(opcode);
+                    fault(CHIP8_FAULT_OPCODE);
             }
-            PC += 2;
+            chip8->PC += 2;
             break;
         
         case 0x9000:
             switch(n){
                 case 0x0:
-                    p("Skip next instruction if 0x%x != 0x%x\n", registers[x], registers[y]);
-                    PC += (registers[x] != registers[y]) ? 4 : 2;
+                    p("Skip next instruction if 0x%x != 0x%x\n", chip8->registers[x], chip8->registers[y]);
+                    chip8->PC += (chip8->registers[x] != chip8->registers[y]) ? 4 : 2;
                     break;
                 default:
-                    unknown_opcode(opcode); 
+                    fault(CHIP8_FAULT_OPCODE);
             }
             break;
 
         case 0xA000:
             p("Set I to 0x%x\n", nnn);
-            IndexRegister = nnn;
-            PC += 2;
+            chip8->IndexRegister = nnn;
+            chip8->PC += 2;
             break;
         
         case 0xB000:
-            p("Jump to 0x%x + V[0] (0x%x)\n", nnn, registers[0]);
-            PC = nnn + registers[0];
+            p("Jump to 0x%x + V[0] (0x%x)\n", nnn, chip8->registers[0]);
+            chip8->PC = nnn + chip8->registers[0];
             break;
 
         case 0xC000:
             p("V[0x%x] = random byte\n", x);
-            registers[x] = randbyte() & kk;
-            PC += 2;
+            chip8->registers[x] = randbyte(&chip8->rng) & kk;
+            chip8->PC += 2;
             break;
 
         case 0xD000:
             p("Draw sprite at (V[0x%x], V[0x%x]) = (0x%x, 0x%x) of height %d", 
-               x, y, registers[x], registers[y], n);
-            draw_sprite(registers[x], registers[y], n);
-            PC += 2;
-            chip8_draw_flag = true;
+               x, y, chip8->registers[x], chip8->registers[y], n);
+            draw_sprite(chip8, chip8->registers[x], chip8->registers[y], n);
+            chip8->PC += 2;
+            chip8->draw_flag = true;
+            #ifdef DEBUG
+                debug_draw(chip8);
+            #endif
             break;
 
         case 0xE000:
             switch(kk){
                 case 0x9E:
                     p("Skip next instruction if key[%d] is pressed\n", x);
-                    PC += (key[registers[x]]) ? 4 : 2;
+                    if (chip8->registers[x] >= KEYPAD_SIZE)
+                    {
+                        fault(CHIP8_FAULT_KEY);
+                    }
+                    chip8->PC += (chip8->key[chip8->registers[x]]) ? 4 : 2;
                     break;
 
                 case 0xA1:
                     p("Skip next instruction if key[%d] is NOT pressed\n", x);
-                    PC += (!key[registers[x]]) ? 4 : 2;
+                    if (chip8->registers[x] >= KEYPAD_SIZE)
+                    {
+                        fault(CHIP8_FAULT_KEY);
+                    }
+                    chip8->PC += (!chip8->key[chip8->registers[x]]) ? 4 : 2;
                     break;
 
                 default:
-                    unknown_opcode(opcode);
+                    fault(CHIP8_FAULT_OPCODE);
             }
             break;
         
         case 0xF000:
             switch(kk){
                 case 0x07:
-                    p("V[0x%x] = delay timer = %d\n", x, DelayTimer);
-                    registers[x] = DelayTimer;
-                    PC += 2;
+                    p("V[0x%x] = delay timer = %d\n", x, chip8->DelayTimer);
+                    chip8->registers[x] = chip8->DelayTimer;
+                    chip8->PC += 2;
                     break;
                 
                 case 0x0A:
-                    i = 0;
                     p("Wait for key instruction\n");
-                    while (true)
+                    i = pressed_key(chip8);
+                    if (i < 0)
                     {
-                        for (i = 0; i < KEYPAD_SIZE; i++)
-                        {
-                            if(key[i]){
-                                registers[x] = i;
-                                goto got_key_press;
-                            }
-                        }
-                    }
-                    got_key_press:
-                        PC += 2;
+                        // Halt here with the PC on this instruction. Chip8Run
+                        // comes back to the caller, which can park the machine
+                        // until a key goes down.
+                        chip8->waiting = true;
                         break;
+                    }
+                    chip8->registers[x] = i;
+                    chip8->PC += 2;
+                    break;
                 
                 case 0x15:
-                    p("delay timer = V[0x%x] = %d\n", x, registers[x]);
-                    DelayTimer = registers[x];
-                    PC += 2;
+                    p("delay timer = V[0x%x] = %d\n", x, chip8->registers[x]);
+                    chip8->DelayTimer = chip8->registers[x];
+                    chip8->PC += 2;
                     break;
 
                 case 0x18:
-                    p("sound timer = V[0x%x] = %d\n", x, registers[x]);
-                    SoundTimer = registers[x];
-                    PC += 2;
+                    p("sound timer = V[0x%x] = %d\n", x, chip8->registers[x]);
+                    chip8->SoundTimer = chip8->registers[x];
+                    chip8->PC += 2;
                     break;
 
                 case 0x1E:
-                    p("I = I + V[0x%x] = 0x%x + 0x%x\n", x, IndexRegister, registers[x]);
-                    registers[0xF] = (IndexRegister + registers[x] > 0xFFF) ? 1 : 0;
-                    IndexRegister = IndexRegister + registers[x];
-                    PC += 2;
+                    p("I = I + V[0x%x] = 0x%x + 0x%x\n", x, chip8->IndexRegister, chip8->registers[x]);
+                    chip8->registers[0xF] = (chip8->IndexRegister + chip8->registers[x] > 0xFFF) ? 1 : 0;
+                    chip8->IndexRegister = chip8->IndexRegister + chip8->registers[x];
+                    chip8->PC += 2;
                     break;
 
                 case 0x29:
-                    p("I = location of font for character V[0x%x] = 0x%x\n", x, registers[x]);
-                    IndexRegister = FONTSET_BYTES_PER_CHAR * registers[x];
-                    PC += 2;
+                    p("I = location of font for character V[0x%x] = 0x%x\n", x, chip8->registers[x]);
+                    chip8->IndexRegister = FONTSET_BYTES_PER_CHAR * chip8->registers[x];
+                    chip8->PC += 2;
                     break;
 
                 case 0x33:
-                    p("Store BCD for %d starting at address 0x%x\n", registers[x], IndexRegister);
-                    memory[IndexRegister]   = (registers[x] % 1000) / 100; // hundred's digit
-                    memory[IndexRegister+1] = (registers[x] % 100) / 10;   // ten's digit
-                    memory[IndexRegister+2] = (registers[x] % 10);         // one's digit
-                    PC += 2;
+                    p("Store BCD for %d starting at address 0x%x\n", chip8->registers[x], chip8->IndexRegister);
+                    bcd[0] = (chip8->registers[x] % 1000) / 100;    // hundred's digit
+                    bcd[1] = (chip8->registers[x] % 100) / 10;      // ten's digit
+                    bcd[2] = (chip8->registers[x] % 10);            // one's digit
+                    mem_store(chip8, chip8->IndexRegister, bcd, 3);
+                    Chip8InvalidateCode(chip8, chip8->IndexRegister, 3);
+                    chip8->PC += 2;
                     break;
 
                 case 0x55:
-                    p("Copy sprite from registers 0 to 0x%x into memory at address 0x%x\n", x, IndexRegister);
-                    for (i = 0; i <= x; i++) { 
-                        memory[IndexRegister + i] = registers[i]; 
-                    }
-                    IndexRegister += x + 1;
-                    PC += 2;
+                    p("Copy sprite from registers 0 to 0x%x into memory at address 0x%x\n", x, chip8->IndexRegister);
+                    mem_store(chip8, chip8->IndexRegister, chip8->registers, x + 1);
+                    Chip8InvalidateCode(chip8, chip8->IndexRegister, x + 1);
+                    chip8->IndexRegister += x + 1;
+                    chip8->PC += 2;
                     break;
 
                 case 0x65:
-                    p("Copy sprite from memory at address 0x%x into registers 0 to 0x%x\n", x, IndexRegister);
-                    for (i = 0; i <= x; i++) { 
-                        registers[i] = memory[IndexRegister + i]; 
-                    }
-                    IndexRegister += x + 1;
-                    PC += 2;
+                    p("Copy sprite from memory at address 0x%x into registers 0 to 0x%x\n", x, chip8->IndexRegister);
+                    mem_load(chip8, chip8->IndexRegister, chip8->registers, x + 1);
+                    chip8->IndexRegister += x + 1;
+                    chip8->PC += 2;
                     break;
 
                 default:
-                    unknown_opcode(opcode);
+                    fault(CHIP8_FAULT_OPCODE);
             }
             break;
         
         default:
-            unknown_opcode(opcode);
+            fault(CHIP8_FAULT_OPCODE);
     }
 
+    chip8->PC &= MEM_MASK;
+
     #ifdef DEBUG
-        print_state()
+        print_state(chip8);
     #endif
+    return CHIP8_OK;
 }
 
-void Tick(){
-    if (DelayTimer > 0)
+void Tick(CHIP8* chip8){
+    chip8->ticks++;
+    if (chip8->DelayTimer > 0)
     {
-        DelayTimer--;
+        chip8->DelayTimer--;
     }
-    if (SoundTimer > 0)
+    if (chip8->SoundTimer > 0)
     {
-        SoundTimer--;
-        if (SoundTimer == 0)
+        chip8->SoundTimer--;
+        if (chip8->SoundTimer == 0)
         {
             p("BEEP!\n");
         }
     }
 }
 
+void Chip8GetGfx(const CHIP8* chip8, uint8_t gfx[GFX_ROWS][GFX_COLS]){
+    for (int row = 0; row < GFX_ROWS; row++)
+    {
+        for (int col = 0; col < GFX_COLS; col++)
+        {
+            gfx[row][col] = GFX_PIXEL(chip8, row, col);
+        }
+    }
+}
+
+void Chip8InvalidateCode(CHIP8* chip8, unsigned addr, unsigned len){
+    // Writes wrap at the top of memory, so split one that went round
+    addr &= MEM_SIZE - 1;
+    if (addr + len > MEM_SIZE)
+    {
+        Chip8InvalidateCode(chip8, 0, addr + len - MEM_SIZE);
+        len = MEM_SIZE - addr;
+    }
+    if (chip8->predecode != NULL)
+    {
+        Chip8PredecodeInvalidate(chip8, addr, len);
+    }
+    if (chip8->jit != NULL)
+    {
+        Chip8JitInvalidate(chip8, addr, len);
+    }
+}
+
+// Chip8Run with counters or a trace on. One EmulateCycle at a time and no
+// idle skipping, so every instruction is seen. An Fx0A is only seen once it
+// gets its key.
+static void run_instrumented(CHIP8* chip8, uint32_t cycles){
+    struct Chip8Trace* trace = chip8->trace;
+    uint8_t before[16];
+
+    while (cycles)
+    {
+        uint16_t pc = chip8->PC;
+
+        if (trace != NULL)
+        {
+            trace->cycle = chip8->cycles - cycles;
+            memcpy(before, chip8->registers, sizeof(before));
+        }
+        EmulateCycle(chip8);
+        cycles--;
+        if (chip8->waiting)
+        {
+            return;
+        }
+
+        if (chip8->stats != NULL)
+        {
+            Chip8Count(chip8, pc);
+        }
+        if (trace != NULL)
+        {
+            Chip8TraceStep(chip8, pc, before);
+        }
+    }
+}
+
+Chip8Fault Chip8Run(CHIP8* chip8, uint32_t cycles){
+    chip8->cycles += cycles;
+    if (chip8->stats != NULL || chip8->trace != NULL)
+    {
+        run_instrumented(chip8, cycles);
+        return chip8->fault;
+    }
+    if (chip8->waiting)
+    {
+        // One cycle to check the keys, and the rest are idle if still halted
+        if (cycles == 0)
+        {
+            return chip8->fault;
+        }
+        EmulateCycle(chip8);
+        cycles--;
+        if (chip8->waiting)
+        {
+            return chip8->fault;
+        }
+    }
+    if (chip8->jit != NULL)
+    {
+        Chip8RunJit(chip8, cycles);
+        return chip8->fault;
+    }
+    if (chip8->predecode != NULL)
+    {
+#ifdef CHIP8_THREADED
+        Chip8RunThreaded(chip8, cycles);
+#else
+        Chip8RunPredecoded(chip8, cycles);
+#endif
+        return chip8->fault;
+    }
+
+    while (cycles && !chip8->waiting)
+    {
+        uint16_t pc = chip8->PC;
+
+        EmulateCycle(chip8);
+        cycles--;
+        if ((chip8->opcode & 0xF000) == 0x1000 && chip8->PC <= pc)
+        {
+            cycles -= Chip8SkipIdle(chip8, cycles);
+        }
+    }
+    return chip8->fault;
+}
+
+// Opcodes an idle loop may be made of: they only touch V, I, the timers and
+// the PC, and do the same thing every time for the same V, I, timers and keys
+static bool idle_op(uint16_t opcode){
+    uint8_t kk = opcode & 0xFF;
+
+    switch (opcode & 0xF000)
+    {
+        case 0x1000: case 0x3000: case 0x4000: case 0x6000:
+        case 0x7000: case 0xA000: case 0xB000:
+            return true;
+        case 0x5000: case 0x9000:
+            return (opcode & 0xF) == 0;
+        case 0x8000:
+            return (opcode & 0xF) <= 7 || (opcode & 0xF) == 0xE;
+        case 0xE000:
+            return kk == 0x9E || kk == 0xA1;
+        case 0xF000:
+            return kk == 0x07 || kk == 0x15 || kk == 0x18 || kk == 0x1E || kk == 0x29;
+        default:
+            return false;
+    }
+}
+
+uint32_t Chip8SkipIdle(CHIP8* chip8, uint32_t cycles){
+    uint16_t start = chip8->PC;
+    uint8_t registers[16];
+    uint16_t I = chip8->IndexRegister;
+    uint8_t DelayTimer = chip8->DelayTimer, SoundTimer = chip8->SoundTimer;
+    unsigned slot = (start >> 1) & (IDLE_SLOTS - 1);
+    uint32_t ran = 0, trip_start = 0;
+
+    // A busy loop stays busy for a while, don't pay for the probe every trip
+    if (start == chip8->idle_pc[slot] && chip8->idle_backoff[slot] > 0)
+    {
+        chip8->idle_backoff[slot]--;
+        return 0;
+    }
+
+    // Go round for real with EmulateCycle. None of these opcodes write
+    // memory, so no cache needs telling.
+    memcpy(registers, chip8->registers, sizeof(registers));
+    while (ran < cycles && ran < IDLE_MAX_LOOP && chip8->PC < MEM_SIZE - 1)
+    {
+        if (!idle_op(fetch_opcode(chip8, chip8->PC)))
+        {
+            break;
+        }
+        EmulateCycle(chip8);
+        ran++;
+
+        // Ex9E and ExA1 fault on a Vx past key F, and a faulted machine
+        // standing still is no idle loop
+        if (chip8->fault != CHIP8_OK)
+        {
+            return ran;
+        }
+        if (chip8->PC == start)
+        {
+            uint32_t trip = ran - trip_start;
+
+            if (memcmp(registers, chip8->registers, sizeof(registers)) == 0 &&
+                I == chip8->IndexRegister && DelayTimer == chip8->DelayTimer &&
+                SoundTimer == chip8->SoundTimer)
+            {
+                // Every further trip ends right back here with the same
+                // state, opcode included. Skip the trips that fit.
+                uint32_t skip = (cycles - ran) / trip * trip;
+
+                chip8->idle_skipped += skip;
+                return ran + skip;
+            }
+
+            // A trip can change state once and then settle, like reading a
+            // timer that just ticked into a register. Go round again and
+            // compare with where this trip left off.
+            memcpy(registers, chip8->registers, sizeof(registers));
+            I          = chip8->IndexRegister;
+            DelayTimer = chip8->DelayTimer;
+            SoundTimer = chip8->SoundTimer;
+            trip_start = ran;
+        }
+    }
+
+    if (ran == cycles)
+    {
+        return ran;                             // out of budget, no verdict yet
+    }
+    chip8->idle_pc[slot] = start;
+    chip8->idle_backoff[slot] = IDLE_BACKOFF;
+    return ran;
+}
+
+uint32_t Chip8IdleBackoff(const CHIP8* chip8, uint16_t pc){
+    unsigned slot = (pc >> 1) & (IDLE_SLOTS - 1);
+
+    return chip8->idle_pc[slot] == pc ? chip8->idle_backoff[slot] : 0;
+}
+
+void Chip8IdleLetBy(CHIP8* chip8, uint16_t pc, uint32_t jumps){
+    unsigned slot = (pc >> 1) & (IDLE_SLOTS - 1);
+
+    if (chip8->idle_pc[slot] == pc)
+    {
+        chip8->idle_backoff[slot] -= jumps < chip8->idle_backoff[slot] ? jumps : chip8->idle_backoff[slot];
+    }
+}
@@ -17,11 +17,141 @@
 
 #define GFX_INDEX(row, col) ((row)*GFX_COLS + (col))
 
+// One uint64_t per display row, column 0 in the top bit
+#define GFX_PIXEL(chip8, row, col) (((chip8)->fb[row] >> (GFX_COLS - 1 - (col))) & 1)
+
 #define MAX_GAME_SIZE (0x1000 - 0x200)
 
-void InitializeChip8();
-void LoadGame(char* game);
-void EmulateCycle();
-void Tick();
+// Guest addresses are 12 bits: I plus an offset, PC and stack entries all
+// wrap at 4 KB, by masking rather than checking
+#define MEM_MASK (MEM_SIZE - 1)
+
+// The last two instruction slots, the only ones where PC + 2 or PC + 4 can
+// wrap. The fast cores leave them to EmulateCycle, which masks PC after
+// every instruction, so their own PC updates never need to.
+#define MEM_PC_GUARD (MEM_SIZE - 4)
+
+// Busy loops Chip8SkipIdle remembers at once, one per slot by address, so
+// nested or neighbouring loops don't keep resetting each other's backoff
+#define IDLE_SLOTS 8
+
+// Guest memory is paged so machines can share what they don't write
+#define MEM_PAGE_SIZE 256
+#define MEM_PAGES (MEM_SIZE / MEM_PAGE_SIZE)
+
+// Why a machine stopped. The instruction that did it is left in opcode, with
+// PC on it, and waiting is set, so every core halts there until a state is
+// restored or the machine is initialized again.
+// Memory addresses wrap at 4 KB, so there is no bad memory access to catch.
+typedef enum
+{
+    CHIP8_OK = 0,
+    CHIP8_FAULT_OPCODE,                         // not an instruction
+    CHIP8_FAULT_STACK_OVERFLOW,                 // 2nnn with all 16 levels in use
+    CHIP8_FAULT_STACK_UNDERFLOW,                // 00EE with nothing to return to
+    CHIP8_FAULT_KEY,                            // Ex9E or ExA1 with Vx past key F
+    CHIP8_FAULT_COUNT
+} Chip8Fault;
+
+struct Chip8Page;
+struct Chip8Predecode;
+struct Chip8Jit;
+struct Chip8Stats;
+struct Chip8Trace;
+
+// Everything one machine needs lives in here, so a process can host as many
+// machines as it likes. Nothing in chip8.c keeps state outside of this struct.
+typedef struct
+{
+    uint16_t    opcode;                         // opcode being executed
+    uint8_t     registers[16];                  // V0 to VF
+    uint16_t    IndexRegister;                  // I
+    uint16_t    PC;                             // program counter
+    uint64_t    fb[GFX_ROWS];                   // 64x32 display, one bit per pixel
+    uint8_t     DelayTimer;                     // 60 Hz delay timer
+    uint8_t     SoundTimer;                     // 60 Hz sound timer
+    uint16_t    stack[STACK_SIZE];              // 16 level stack
+    uint16_t    stkptr;                         // stack pointer
+    uint8_t     key[KEYPAD_SIZE];               // 16 keys, 1 = pressed
+    bool        draw_flag;                      // set when fb changed
+    uint32_t    dirty_rows;                     // bit per fb row drawn to, the frontend clears it
+    bool        waiting;                        // halted in Fx0A until a key is down, or by a fault
+    uint8_t     fault;                          // Chip8Fault, CHIP8_OK unless the machine faulted
+    uint32_t    rng;                            // xorshift32 state for Cxkk, never 0
+    uint32_t    ticks;                          // Tick calls so far
+    uint64_t    cycles;                         // instructions asked of Chip8Run so far
+
+    // 4kB RAM as 16 pages. A page the machine hasn't written is shared: the
+    // font, zeros, a ROM image, or a page a snapshot also holds.
+    // The first write to one gets the machine its own copy (chip8_ops.h).
+    uint8_t*               mem[MEM_PAGES];      // each page's 256 bytes
+    struct Chip8Page*      page_ref[MEM_PAGES]; // refcounted page behind mem, NULL = never freed
+
+    struct Chip8Predecode* predecode;           // decoded instruction cache, NULL = off
+    struct Chip8Jit*       jit;                 // x86-64 block translator, NULL = off
+    struct Chip8Stats*     stats;               // execution counters, NULL = off (stats.h)
+    struct Chip8Trace*     trace;               // execution trace ring, NULL = off (trace.h)
+
+    uint64_t    idle_skipped;                   // cycles Chip8Run fast-forwarded in idle loops
+    uint16_t    idle_pc[IDLE_SLOTS];            // loops last probed and found busy, by address
+    uint16_t    idle_backoff[IDLE_SLOTS];       // jumps back to idle_pc to let by before probing again
+} CHIP8;
+
+// Seeds the machine's random numbers from the clock. Call Chip8Seed after
+// it for a run that can be repeated. To initialize a machine again, or
+// before freeing it, drop its memory pages with Chip8ReleaseMemory.
+// LoadGame returns false, having said why on stderr, if the file won't open.
+void InitializeChip8(CHIP8* chip8);
+void Chip8Seed(CHIP8* chip8, uint32_t seed);
+bool LoadGame(CHIP8* chip8, char* game);
+void Chip8ReleaseMemory(CHIP8* chip8);
+
+// Copies guest memory out, or in. Addresses wrap at 4 KB. Writing only
+// takes private copies of pages whose bytes actually change, and tells the
+// code caches about them.
+void Chip8ReadMemory(const CHIP8* chip8, unsigned addr, uint8_t* out, unsigned len);
+void Chip8WriteMemory(CHIP8* chip8, unsigned addr, const uint8_t* bytes, unsigned len);
+
+// Pages of guest memory nothing else holds: ones the game wrote to since
+// they were last shared. The rest are the font, the ROM image, zeros or
+// pages a snapshot holds too.
+unsigned Chip8OwnedPages(const CHIP8* chip8);
+
+// Runs one instruction. Returns chip8->fault: a faulted machine only stops,
+// nothing else in the process is touched.
+Chip8Fault EmulateCycle(CHIP8* chip8);
+void Tick(CHIP8* chip8);
+
+// "unknown opcode", "stack overflow" and so on
+const char* Chip8FaultName(Chip8Fault fault);
+
+// Unpacks fb into one byte per pixel (0 or 1), for frontends that want it
+void Chip8GetGfx(const CHIP8* chip8, uint8_t gfx[GFX_ROWS][GFX_COLS]);
+
+// Runs `cycles` instructions with the fastest core enabled on this machine.
+// Gives exactly the same results as calling EmulateCycle that many times,
+// and also adds them to chip8->cycles, the clock input logs go by.
+// Loops that can't change anything before the next Tick or key event (a jump
+// to itself, or polling the delay timer) are spotted at their backward jump
+// and fast-forwarded; idle_skipped counts the cycles that saved.
+// Returns early when the machine halts in Fx0A (waiting is set): the cycles
+// left over would only have looked at key[] again. Once waiting, calls cost
+// one key check until a key is down, so the caller can park the machine.
+// A fault halts it the same way, for good, and is what Chip8Run returns.
+// With counters (stats.h) or a trace (trace.h) enabled, it steps
+// EmulateCycle so that every instruction is seen, instead of using the fast
+// cores or skipping idle loops.
+Chip8Fault Chip8Run(CHIP8* chip8, uint32_t cycles);
+
+// The predecode cache costs about 28 KB per machine, so it is opt in.
+// Disable it before freeing a machine that has it enabled.
+void Chip8EnablePredecode(CHIP8* chip8);
+void Chip8DisablePredecode(CHIP8* chip8);
+
+// The JIT translates basic blocks to x86-64 and takes priority over the
+// predecode cache. It quietly stays off on other hosts or when executable
+// memory can't be had. Disable it before freeing the machine.
+void Chip8EnableJit(CHIP8* chip8);
+void Chip8DisableJit(CHIP8* chip8);
 
-#endif 
\ No newline at end of file
+#endif
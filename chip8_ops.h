@@ -0,0 +1,223 @@
+// Pieces of opcode behaviour shared by every interpreter core. The switch in
+// EmulateCycle is the reference; the other cores must match it exactly, so
+// anything non-trivial lives here instead of being copied around.
+
+#ifndef CHIP_8_OPS
+#define CHIP_8_OPS
+
+#include "chip8.h"
+
+#ifdef DEBUG
+#define p(...) printf(__VA_ARGS__);
+#else
+#define p(...)
+#endif
+
+// Must be called whenever guest memory in [addr, addr + len) changes, so the
+// predecode cache and the JIT can throw away what they built from it
+void Chip8InvalidateCode(CHIP8* chip8, unsigned addr, unsigned len);
+
+// Call with the PC on a loop that was just jumped back into. If one trip
+// round it leaves V, I and the timers as they were, nothing can change until
+// the next Tick or key event, so whole trips are skipped. Returns how many of
+// `cycles` were used up, run or skipped.
+uint32_t Chip8SkipIdle(CHIP8* chip8, uint32_t cycles);
+
+// For a core that goes round a busy loop many times in one go, like the JIT's
+// blocks that jump to their own start: how many more jumps back to `pc`
+// Chip8SkipIdle lets by before it looks again, and counting `jumps` of them.
+uint32_t Chip8IdleBackoff(const CHIP8* chip8, uint16_t pc);
+void Chip8IdleLetBy(CHIP8* chip8, uint16_t pc, uint32_t jumps);
+
+// ---- guest memory ----
+
+// A page a machine can be the only holder of. Snapshots share pages by
+// taking a reference; whoever writes to a page somebody else also
+// holds gets a copy first. Static pages (font, zeros, ROM images) have no
+// Chip8Page and are always copied on the first write.
+struct Chip8Page
+{
+    uint32_t    refs;                           // holders, changed atomically
+    uint8_t     bytes[MEM_PAGE_SIZE];
+};
+
+#define MEM_PAGE(addr) (((addr) >> 8) & (MEM_PAGES - 1))
+#define MEM_OFFSET(addr) ((addr) & (MEM_PAGE_SIZE - 1))
+
+// Gives the machine a page of its own, copying what it had there
+void Chip8OwnPage(CHIP8* chip8, unsigned page);
+
+// Points a page at bytes that outlive the machine (a ROM image), dropping
+// what it had. The first write to the page copies it. Doesn't tell the code
+// caches.
+void Chip8MapPage(CHIP8* chip8, unsigned page, const uint8_t* bytes);
+
+static inline void Chip8PageRetain(struct Chip8Page* page){
+    if (page != NULL)
+    {
+        __atomic_add_fetch(&page->refs, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static inline void Chip8PageRelease(struct Chip8Page* page){
+    if (page != NULL && __atomic_sub_fetch(&page->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        free(page);
+    }
+}
+
+static inline bool page_is_own(const CHIP8* chip8, unsigned page){
+    const struct Chip8Page* ref = chip8->page_ref[page];
+
+    return ref != NULL && __atomic_load_n(&ref->refs, __ATOMIC_ACQUIRE) == 1;
+}
+
+static inline uint8_t mem_read(const CHIP8* chip8, unsigned addr){
+    return chip8->mem[MEM_PAGE(addr)][MEM_OFFSET(addr)];
+}
+
+// Up to 16 bytes. GCC turns a memcpy of unknown length into rep movsq,
+// which costs more to start than these take to copy.
+static inline void copy_small(uint8_t* dst, const uint8_t* src, unsigned len){
+    uint64_t head, tail;
+
+    if (len >= 8)
+    {
+        memcpy(&head, src, 8);
+        memcpy(&tail, src + len - 8, 8);
+        memcpy(dst, &head, 8);
+        memcpy(dst + len - 8, &tail, 8);
+        return;
+    }
+    for (unsigned i = 0; i < len; i++)
+    {
+        dst[i] = src[i];
+    }
+}
+
+// Fx33, Fx55, Fx65 and sprites move up to 16 bytes. Inside one page that
+// is one check and a copy, and nothing written can be the page pointers.
+// Across pages it's the general Chip8WriteMemory, kept out of line. Stores
+// don't tell the code caches, callers do.
+static inline void mem_store(CHIP8* chip8, unsigned addr, const uint8_t* bytes, unsigned len){
+    unsigned page = MEM_PAGE(addr);
+
+    if (MEM_OFFSET(addr) + len > MEM_PAGE_SIZE)
+    {
+        Chip8WriteMemory(chip8, addr, bytes, len);
+        return;
+    }
+    if (!page_is_own(chip8, page))
+    {
+        Chip8OwnPage(chip8, page);
+    }
+    copy_small(chip8->mem[page] + MEM_OFFSET(addr), bytes, len);
+}
+
+static inline void mem_load(const CHIP8* chip8, unsigned addr, uint8_t* out, unsigned len){
+    if (MEM_OFFSET(addr) + len > MEM_PAGE_SIZE)
+    {
+        Chip8ReadMemory(chip8, addr, out, len);
+        return;
+    }
+    copy_small(out, chip8->mem[MEM_PAGE(addr)] + MEM_OFFSET(addr), len);
+}
+
+// Only an odd PC at the end of a page has its two bytes on different pages
+static inline uint16_t fetch_opcode(const CHIP8* chip8, unsigned pc){
+    const uint8_t* bytes = chip8->mem[MEM_PAGE(pc)] + MEM_OFFSET(pc);
+
+    if (MEM_OFFSET(pc) != MEM_PAGE_SIZE - 1)
+    {
+        return bytes[0] << 8 | bytes[1];
+    }
+    return bytes[0] << 8 | mem_read(chip8, pc + 1);
+}
+
+#define IS_BIT_SET(byte, bit) (((0x80 >> (bit)) & (byte)) != 0x0)
+
+#define FONTSET_ADDRESS 0x00
+#define FONTSET_BYTES_PER_CHAR 5
+
+// xorshift32. Each machine has its own state, so machines don't disturb
+// each other's numbers and a seed gives the same game every time.
+static inline uint8_t randbyte(uint32_t* state){
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (uint8_t) (x >> 24);
+}
+
+// Spreads a seed over all 32 bits so that nearby seeds don't give similar
+// sequences. Never returns 0, which xorshift would be stuck on.
+static inline uint32_t rng_from_seed(uint32_t seed){
+    uint32_t x = seed + 0x9E3779B9u;
+
+    x = (x ^ (x >> 16)) * 0x85EBCA6Bu;
+    x = (x ^ (x >> 13)) * 0xC2B2AE35u;
+    x ^= x >> 16;
+    return x != 0 ? x : 1;
+}
+
+/*
+inline:
+A hint to the compiler to replace the function call with the actual code of the function at compile time.
+Reduces the overhead of a function call but may increase binary size if the function is used in many places.
+*/
+
+// This is basically Dxyn instruction
+
+// Rotate right by s (0..63). Compilers turn this into a single ror.
+static inline uint64_t rotr64(uint64_t v, unsigned s){
+    return (v >> s) | (v << ((64 - s) & 63));
+}
+
+// One sprite byte as a display row with its left edge at column x. The byte
+// goes in the top 8 bits (columns 0..7) and is rotated to x, which wraps
+// off the right edge like % GFX_COLS.
+static inline uint64_t sprite_row(uint8_t byte, uint8_t x){
+    return rotr64((uint64_t) byte << (GFX_COLS - 8), x % GFX_COLS);
+}
+
+// The display rows an n-row sprite at row y covers, one bit each, wrapping
+// past the bottom like % GFX_ROWS
+static inline uint32_t sprite_rows(uint8_t y, uint8_t n){
+    uint32_t rows = (1u << n) - 1;
+    unsigned s = y % GFX_ROWS;
+
+    return (rows << s) | (rows >> ((32 - s) & 31));
+}
+
+static inline void draw_sprite(CHIP8* chip8, uint8_t x, uint8_t y, uint8_t n){
+    unsigned byte_index;
+    uint8_t collision = 0;
+    const uint8_t* sprite = chip8->mem[MEM_PAGE(chip8->IndexRegister)] + MEM_OFFSET(chip8->IndexRegister);
+    uint8_t wrapped[15];
+
+    // Read in place unless the sprite runs into the next page
+    if (MEM_OFFSET(chip8->IndexRegister) + n > MEM_PAGE_SIZE)
+    {
+        Chip8ReadMemory(chip8, chip8->IndexRegister, wrapped, n);
+        sprite = wrapped;
+    }
+    for (byte_index = 0; byte_index < n; byte_index++)
+    {
+        uint8_t byte = sprite[byte_index];
+        uint64_t bits = sprite_row(byte, x);
+        uint64_t* rowp = &chip8->fb[(y + byte_index) % GFX_ROWS];
+
+        // Collision: any pixel that is on in both
+        collision |= (*rowp & bits) != 0;
+
+        // Draw the whole row at once
+        *rowp ^= bits;
+    }
+
+    chip8->registers[0xF] = collision;
+    chip8->dirty_rows |= sprite_rows(y, n);
+}
+
+#endif
@@ -0,0 +1,69 @@
+#include "clone.h"
+#include "chip8_ops.h"
+#include "predecode.h"
+#include "jit.h"
+#include "stats.h"
+#include "trace.h"
+
+void Chip8Clone(const CHIP8* parent, CHIP8* child){
+    memcpy(child, parent, CHIP8_MACHINE_BYTES);
+    for (unsigned page = 0; page < MEM_PAGES; page++)
+    {
+        Chip8PageRetain(parent->page_ref[page]);
+        child->page_ref[page] = parent->page_ref[page];
+        child->mem[page]      = parent->mem[page];
+    }
+    child->predecode    = NULL;
+    child->jit          = NULL;
+    child->stats        = NULL;
+    child->trace        = NULL;
+    child->idle_skipped = 0;
+    memcpy(child->idle_pc, parent->idle_pc, sizeof(child->idle_pc));
+    memcpy(child->idle_backoff, parent->idle_backoff, sizeof(child->idle_backoff));
+}
+
+bool Chip8PoolInit(Chip8Pool* pool, const CHIP8* parent, unsigned count){
+    pool->children = malloc((count ? count : 1) * sizeof(CHIP8));
+    if (pool->children == NULL)
+    {
+        return false;
+    }
+    pool->count = count;
+    Chip8InitState(&pool->parent);
+    Chip8SaveSnapshot(parent, &pool->parent);
+    for (unsigned i = 0; i < count; i++)
+    {
+        Chip8Clone(parent, &pool->children[i]);
+    }
+    return true;
+}
+
+void Chip8PoolFree(Chip8Pool* pool){
+    for (unsigned i = 0; i < pool->count; i++)
+    {
+        Chip8DisablePredecode(&pool->children[i]);
+        Chip8DisableJit(&pool->children[i]);
+        Chip8DisableStats(&pool->children[i]);
+        Chip8DisableTrace(&pool->children[i]);
+        Chip8ReleaseMemory(&pool->children[i]);
+    }
+    free(pool->children);
+    Chip8FreeState(&pool->parent);
+    pool->children = NULL;
+    pool->count    = 0;
+}
+
+void Chip8PoolSetParent(Chip8Pool* pool, const CHIP8* parent){
+    Chip8SaveSnapshot(parent, &pool->parent);
+}
+
+void Chip8PoolReset(Chip8Pool* pool){
+    for (unsigned i = 0; i < pool->count; i++)
+    {
+        Chip8RestoreSnapshot(&pool->children[i], &pool->parent);
+    }
+}
+
+void Chip8PoolResetChild(Chip8Pool* pool, unsigned child){
+    Chip8RestoreSnapshot(&pool->children[child], &pool->parent);
+}
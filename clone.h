@@ -0,0 +1,45 @@
+// Cloning machines, for search and testing that branch one state into many
+// children with different inputs. A clone copies the machine's registers,
+// display and clocks (a few hundred bytes) and shares every memory page
+// with its parent, so it costs about as much as a save state, not an
+// InitializeChip8 and LoadGame plus replaying the input. Parent and child
+// each get their own copy of a page when they first write to it.
+//
+// A pool keeps a set of children around, each with its own caches, and
+// puts them all back to one parent state at once. Going back keeps the
+// predecode cache and the JIT's blocks for every page the child didn't
+// change, so the children stay warm from one round to the next.
+
+#ifndef CHIP_8_CLONE
+#define CHIP_8_CLONE
+
+#include "chip8.h"
+#include "savestate.h"
+
+typedef struct
+{
+    Chip8State  parent;                         // the state every reset goes back to
+    CHIP8*      children;
+    unsigned    count;
+} Chip8Pool;
+
+// Sets up child, which must not be an initialized machine, as a copy of
+// parent. The child has no caches, counters or trace of its own; enable
+// them on it as on any machine. Free it like any machine, with
+// Chip8ReleaseMemory first.
+void Chip8Clone(const CHIP8* parent, CHIP8* child);
+
+// count children of parent. Returns false when out of memory.
+bool Chip8PoolInit(Chip8Pool* pool, const CHIP8* parent, unsigned count);
+
+// Drops the children's caches and memory and the pool's parent state
+void Chip8PoolFree(Chip8Pool* pool);
+
+// Makes parent the state the children go back to. Doesn't touch them.
+void Chip8PoolSetParent(Chip8Pool* pool, const CHIP8* parent);
+
+// Puts every child, or one, back to the parent state
+void Chip8PoolReset(Chip8Pool* pool);
+void Chip8PoolResetChild(Chip8Pool* pool, unsigned child);
+
+#endif
@@ -0,0 +1,65 @@
+#include "disasm.h"
+
+void Chip8Disassemble(uint16_t opcode, char out[DISASM_MAX]){
+    unsigned x   = (opcode >> 8) & 0xF;
+    unsigned y   = (opcode >> 4) & 0xF;
+    unsigned n   = opcode & 0xF;
+    unsigned kk  = opcode & 0xFF;
+    unsigned nnn = opcode & 0xFFF;
+
+    // Same decode as EmulateCycle, which only looks at kk for 0x0nnn
+    switch (opcode & 0xF000)
+    {
+        case 0x0000:
+            if (kk == 0xE0) { snprintf(out, DISASM_MAX, "CLS"); return; }
+            if (kk == 0xEE) { snprintf(out, DISASM_MAX, "RET"); return; }
+            break;
+        case 0x1000: snprintf(out, DISASM_MAX, "JP 0x%03x", nnn); return;
+        case 0x2000: snprintf(out, DISASM_MAX, "CALL 0x%03x", nnn); return;
+        case 0x3000: snprintf(out, DISASM_MAX, "SE V%X, 0x%02x", x, kk); return;
+        case 0x4000: snprintf(out, DISASM_MAX, "SNE V%X, 0x%02x", x, kk); return;
+        case 0x5000: snprintf(out, DISASM_MAX, "SE V%X, V%X", x, y); return;
+        case 0x6000: snprintf(out, DISASM_MAX, "LD V%X, 0x%02x", x, kk); return;
+        case 0x7000: snprintf(out, DISASM_MAX, "ADD V%X, 0x%02x", x, kk); return;
+        case 0x8000:
+            switch (n)
+            {
+                case 0x0: snprintf(out, DISASM_MAX, "LD V%X, V%X", x, y); return;
+                case 0x1: snprintf(out, DISASM_MAX, "OR V%X, V%X", x, y); return;
+                case 0x2: snprintf(out, DISASM_MAX, "AND V%X, V%X", x, y); return;
+                case 0x3: snprintf(out, DISASM_MAX, "XOR V%X, V%X", x, y); return;
+                case 0x4: snprintf(out, DISASM_MAX, "ADD V%X, V%X", x, y); return;
+                case 0x5: snprintf(out, DISASM_MAX, "SUB V%X, V%X", x, y); return;
+                case 0x6: snprintf(out, DISASM_MAX, "SHR V%X", x); return;
+                case 0x7: snprintf(out, DISASM_MAX, "SUBN V%X, V%X", x, y); return;
+                case 0xE: snprintf(out, DISASM_MAX, "SHL V%X", x); return;
+            }
+            break;
+        case 0x9000:
+            if (n == 0) { snprintf(out, DISASM_MAX, "SNE V%X, V%X", x, y); return; }
+            break;
+        case 0xA000: snprintf(out, DISASM_MAX, "LD I, 0x%03x", nnn); return;
+        case 0xB000: snprintf(out, DISASM_MAX, "JP V0, 0x%03x", nnn); return;
+        case 0xC000: snprintf(out, DISASM_MAX, "RND V%X, 0x%02x", x, kk); return;
+        case 0xD000: snprintf(out, DISASM_MAX, "DRW V%X, V%X, %u", x, y, n); return;
+        case 0xE000:
+            if (kk == 0x9E) { snprintf(out, DISASM_MAX, "SKP V%X", x); return; }
+            if (kk == 0xA1) { snprintf(out, DISASM_MAX, "SKNP V%X", x); return; }
+            break;
+        case 0xF000:
+            switch (kk)
+            {
+                case 0x07: snprintf(out, DISASM_MAX, "LD V%X, DT", x); return;
+                case 0x0A: snprintf(out, DISASM_MAX, "LD V%X, K", x); return;
+                case 0x15: snprintf(out, DISASM_MAX, "LD DT, V%X", x); return;
+                case 0x18: snprintf(out, DISASM_MAX, "LD ST, V%X", x); return;
+                case 0x1E: snprintf(out, DISASM_MAX, "ADD I, V%X", x); return;
+                case 0x29: snprintf(out, DISASM_MAX, "LD F, V%X", x); return;
+                case 0x33: snprintf(out, DISASM_MAX, "LD B, V%X", x); return;
+                case 0x55: snprintf(out, DISASM_MAX, "LD [I], V%X", x); return;
+                case 0x65: snprintf(out, DISASM_MAX, "LD V%X, [I]", x); return;
+            }
+            break;
+    }
+    snprintf(out, DISASM_MAX, "??? %04x", opcode);
+}
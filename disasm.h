@@ -0,0 +1,14 @@
+// CHIP-8 disassembler, in the usual mnemonics (CLS, LD Vx, kk, DRW, ...)
+
+#ifndef CHIP_8_DISASM
+#define CHIP_8_DISASM
+
+#include "chip8.h"
+
+#define DISASM_MAX 24                           // longest text plus the terminator
+
+// Writes the text for `opcode` to out. Opcodes EmulateCycle doesn't know
+// come out as "??? xxxx".
+void Chip8Disassemble(uint16_t opcode, char out[DISASM_MAX]);
+
+#endif
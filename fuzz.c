@@ -0,0 +1,973 @@
+// Coverage-guided fuzzer. Mutates ROM bytes and key schedules, runs every
+// case in process and keeps the ones that reach new code. Cases that fault
+// are shrunk and saved for replay.
+//
+// Usage: ./chip8_fuzz [options] [seed rom...]
+//
+// A case is a ROM image, a list of key changes by frame, and a frame
+// count. Each one runs on a clone (clone.h) of a blank machine, -i
+// instructions to the frame with a Tick after each frame, until
+// EmulateCycle returns a fault (chip8.h). With -e predecode or -e jit the
+// case runs through Chip8Run on that engine instead, so the fast cores get
+// fuzzed too; coverage still comes from a pass through EmulateCycle.
+// Faults are:
+//     opcode       an unknown opcode
+//     overflow     2nnn with all 16 stack entries in use
+//     underflow    00EE with an empty stack
+//     key          Ex9E or ExA1 with Vx past the last key
+//
+// Coverage is the set of PCs that ran and of edges between consecutive
+// PCs, hashed into a 64 KB map the way AFL does it. A case that sets
+// anything new in either goes into the corpus. All threads share one
+// corpus and one coverage map.
+//
+// A fault is saved once per unknown opcode, or once per PC for the other
+// kinds, as <dir>/crash-<kind>-<opcode or pc>.c8fz, after dropping key
+// changes, cutting the ROM down and zeroing what it doesn't need while it
+// still faults the same way.
+// ./chip8_fuzz -r <file> runs one again, on every engine unless -e picks
+// one, and says so if they don't end the same way.
+//
+// File format, little endian:
+//     "C8FZ", version, seed, frames, instructions per frame, ROM size,
+//     number of key changes (u32 each), the ROM, then each key change as
+//     frame (u16), key (u8), down (u8)
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "chip8.h"
+#include "clone.h"
+#include "disasm.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FUZZ_MAGIC          "C8FZ"
+#define FUZZ_VERSION        1
+#define FUZZ_HEADER_SIZE    28
+#define MAX_EVENTS          64
+#define EDGE_MAP            65536
+#define MAX_CRASHES         1024
+
+#define DEFAULT_SECONDS     60
+#define DEFAULT_FRAMES      60
+#define DEFAULT_CYCLES_PER_FRAME 500
+#define DEFAULT_OUT_DIR     "fuzz-out"
+
+typedef struct
+{
+    uint16_t    frame;                          // applied before this frame runs
+    uint8_t     key;
+    uint8_t     down;
+} FuzzEvent;
+
+typedef struct
+{
+    uint8_t     rom[MAX_GAME_SIZE];
+    uint32_t    rom_size;
+    FuzzEvent   events[MAX_EVENTS];             // sorted by frame
+    uint32_t    num_events;
+    uint32_t    frames;
+} FuzzCase;
+
+// Short names of each Chip8Fault, for file names
+static const char* fault_names[CHIP8_FAULT_COUNT] = { "none", "opcode", "overflow", "underflow", "key" };
+
+typedef struct
+{
+    Chip8Fault  kind;
+    uint16_t    pc;
+    uint16_t    opcode;
+    uint32_t    frame;
+    uint64_t    cycle;                          // instructions run before it
+} Fault;
+
+typedef struct
+{
+    CHIP8       blank;                          // every case starts as a clone of this
+    uint64_t    rng;
+    uint8_t     pc_map[MEM_SIZE];               // this run's coverage
+    uint8_t     edge_map[EDGE_MAP];
+    Chip8Pool   pool;                           // -e predecode or jit: one child, with the engine on
+} Worker;
+
+// Settings, fixed once the workers start
+static uint32_t seed                = 1;
+static uint32_t frames              = DEFAULT_FRAMES;
+static uint32_t cycles_per_frame    = DEFAULT_CYCLES_PER_FRAME;
+static const char* out_dir          = DEFAULT_OUT_DIR;
+static const char* engine           = "switch";
+
+// Shared between the workers, under corpus_lock. Coverage is read without
+// the lock to see if a run found anything, and only set with it.
+static pthread_mutex_t corpus_lock = PTHREAD_MUTEX_INITIALIZER;
+static FuzzCase**  corpus;
+static size_t      corpus_size;
+static size_t      corpus_capacity;
+static uint8_t     covered_pcs[MEM_SIZE];
+static uint8_t     covered_edges[EDGE_MAP];
+static unsigned    num_pcs;
+static unsigned    num_edges;
+
+static pthread_mutex_t crash_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t    crashes[MAX_CRASHES];        // kind << 16 | fault_key of every fault saved
+static size_t      num_crashes;
+static uint64_t    dropped;                     // new faults with no room to save them
+
+static uint64_t    execs;                       // atomic
+static int         stop;                        // atomic
+
+// ---- random numbers ----
+
+static uint64_t next_random(uint64_t* state){
+    // xorshift64*
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t random_below(Worker* w, uint32_t n){
+    return (uint32_t) (next_random(&w->rng) >> 32) % n;
+}
+
+// ---- running a case ----
+
+static void apply_events(CHIP8* chip8, const FuzzCase* c, uint32_t frame, uint32_t* next){
+    while (*next < c->num_events && c->events[*next].frame <= frame)
+    {
+        chip8->key[c->events[*next].key] = c->events[*next].down;
+        (*next)++;
+    }
+}
+
+// Steps c through EmulateCycle on a clone of w->blank. With record set the
+// run's coverage goes into w's maps.
+static Fault step_case(Worker* w, const FuzzCase* c, bool record){
+    Fault fault = { CHIP8_OK, 0, 0, 0, 0 };
+    uint32_t next = 0;
+    uint16_t prev = 0;
+    CHIP8 chip8;
+
+    Chip8Clone(&w->blank, &chip8);
+    Chip8WriteMemory(&chip8, 0x200, c->rom, c->rom_size);
+
+    for (uint32_t frame = 0; frame < c->frames && fault.kind == CHIP8_OK; frame++)
+    {
+        apply_events(&chip8, c, frame, &next);
+        for (uint32_t i = 0; i < cycles_per_frame; i++)
+        {
+            uint16_t pc = chip8.PC;
+
+            if (record)
+            {
+                w->pc_map[pc] = 1;
+                w->edge_map[((unsigned) prev << 4 ^ pc) & (EDGE_MAP - 1)] = 1;
+                prev = pc;
+            }
+            fault.kind = EmulateCycle(&chip8);
+            if (fault.kind != CHIP8_OK)
+            {
+                fault.pc     = chip8.PC;
+                fault.opcode = chip8.opcode;
+                fault.frame  = frame;
+                break;
+            }
+            // Halted in Fx0A, nothing more happens until the next key change
+            if (chip8.waiting)
+            {
+                break;
+            }
+            fault.cycle++;
+        }
+        Tick(&chip8);
+    }
+
+    Chip8ReleaseMemory(&chip8);
+    return fault;
+}
+
+// Runs c a frame at a time through Chip8Run on w's pooled child, which
+// keeps its engine's caches for the pages the last case left alone.
+// Counts no instructions, the fast cores don't say how many ran.
+static Fault run_engine(Worker* w, const FuzzCase* c){
+    Fault fault = { CHIP8_OK, 0, 0, 0, 0 };
+    CHIP8* chip8 = &w->pool.children[0];
+    uint32_t next = 0;
+
+    Chip8PoolResetChild(&w->pool, 0);
+    Chip8WriteMemory(chip8, 0x200, c->rom, c->rom_size);
+
+    for (uint32_t frame = 0; frame < c->frames; frame++)
+    {
+        apply_events(chip8, c, frame, &next);
+        fault.kind = Chip8Run(chip8, cycles_per_frame);
+        if (fault.kind != CHIP8_OK)
+        {
+            fault.pc     = chip8->PC;
+            fault.opcode = chip8->opcode;
+            fault.frame  = frame;
+            break;
+        }
+        Tick(chip8);
+    }
+    return fault;
+}
+
+// Runs c on the engine picked with -e. With record set the run's coverage
+// goes into w's maps.
+static Fault run_case(Worker* w, const FuzzCase* c, bool record){
+    if (strcmp(engine, "switch") == 0)
+    {
+        return step_case(w, c, record);
+    }
+    if (record)
+    {
+        step_case(w, c, true);
+    }
+    return run_engine(w, c);
+}
+
+static bool same_fault(const Fault* a, const Fault* b){
+    return a->kind == b->kind && a->pc == b->pc && a->opcode == b->opcode;
+}
+
+// ---- coverage ----
+
+static bool has_new(const uint8_t* map, const uint8_t* covered, size_t size){
+    for (size_t i = 0; i < size; i += 8)
+    {
+        uint64_t word;
+
+        memcpy(&word, map + i, 8);
+        if (word == 0)
+        {
+            continue;
+        }
+        for (size_t j = i; j < i + 8; j++)
+        {
+            if (map[j] && !__atomic_load_n(&covered[j], __ATOMIC_RELAXED))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static unsigned merge(const uint8_t* map, uint8_t* covered, size_t size){
+    unsigned added = 0;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        if (map[i] && !covered[i])
+        {
+            __atomic_store_n(&covered[i], 1, __ATOMIC_RELAXED);
+            added++;
+        }
+    }
+    return added;
+}
+
+// Adds c to the corpus, and w's last run to the coverage
+static void add_case(Worker* w, const FuzzCase* c){
+    FuzzCase* copy = malloc(sizeof(FuzzCase));
+
+    if (copy == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    *copy = *c;
+
+    pthread_mutex_lock(&corpus_lock);
+    num_pcs   += merge(w->pc_map, covered_pcs, MEM_SIZE);
+    num_edges += merge(w->edge_map, covered_edges, EDGE_MAP);
+    if (corpus_size == corpus_capacity)
+    {
+        corpus_capacity = corpus_capacity ? 2 * corpus_capacity : 64;
+        corpus = realloc(corpus, corpus_capacity * sizeof(FuzzCase*));
+        if (corpus == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    corpus[corpus_size++] = copy;
+    pthread_mutex_unlock(&corpus_lock);
+}
+
+static void keep_if_new(Worker* w, const FuzzCase* c){
+    if (has_new(w->pc_map, covered_pcs, MEM_SIZE) ||
+        has_new(w->edge_map, covered_edges, EDGE_MAP))
+    {
+        add_case(w, c);
+    }
+}
+
+// ---- case files ----
+
+static uint8_t* put(uint8_t* p, uint32_t value, int bytes){
+    for (int i = 0; i < bytes; i++)
+    {
+        *p++ = (uint8_t) (value >> (8 * i));
+    }
+    return p;
+}
+
+static uint32_t get(const uint8_t* p, int bytes){
+    uint32_t value = 0;
+
+    for (int i = 0; i < bytes; i++)
+    {
+        value |= (uint32_t) p[i] << (8 * i);
+    }
+    return value;
+}
+
+static bool save_case(const FuzzCase* c, const char* path){
+    uint8_t header[FUZZ_HEADER_SIZE];
+    uint8_t* p = header;
+    FILE* fptr = fopen(path, "wb");
+
+    if (fptr == NULL)
+    {
+        fprintf(stderr, "Unable to write case: %s\n", path);
+        return false;
+    }
+    memcpy(p, FUZZ_MAGIC, 4);
+    p = put(p + 4, FUZZ_VERSION, 4);
+    p = put(p, seed, 4);
+    p = put(p, c->frames, 4);
+    p = put(p, cycles_per_frame, 4);
+    p = put(p, c->rom_size, 4);
+    put(p, c->num_events, 4);
+    fwrite(header, 1, FUZZ_HEADER_SIZE, fptr);
+    fwrite(c->rom, 1, c->rom_size, fptr);
+    for (uint32_t i = 0; i < c->num_events; i++)
+    {
+        uint8_t event[4];
+
+        put(event, c->events[i].frame, 2);
+        event[2] = c->events[i].key;
+        event[3] = c->events[i].down;
+        fwrite(event, 1, 4, fptr);
+    }
+    if (ferror(fptr) | fclose(fptr))
+    {
+        fprintf(stderr, "Unable to write case: %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+// Also sets the seed and frame length the case was found with
+static bool load_case(FuzzCase* c, const char* path){
+    uint8_t header[FUZZ_HEADER_SIZE];
+    FILE* fptr = fopen(path, "rb");
+    bool ok;
+
+    if (fptr == NULL)
+    {
+        fprintf(stderr, "Unable to open case: %s\n", path);
+        return false;
+    }
+    memset(c, 0, sizeof(FuzzCase));
+    ok = fread(header, 1, FUZZ_HEADER_SIZE, fptr) == FUZZ_HEADER_SIZE &&
+         memcmp(header, FUZZ_MAGIC, 4) == 0 && get(header + 4, 4) == FUZZ_VERSION;
+    if (ok)
+    {
+        seed             = get(header + 8, 4);
+        c->frames        = get(header + 12, 4);
+        cycles_per_frame = get(header + 16, 4);
+        c->rom_size      = get(header + 20, 4);
+        c->num_events    = get(header + 24, 4);
+        // Same limits as on the command line
+        ok = c->frames >= 1 && c->frames <= 0xFFFF && cycles_per_frame >= 1 &&
+             c->rom_size <= MAX_GAME_SIZE && c->num_events <= MAX_EVENTS &&
+             fread(c->rom, 1, c->rom_size, fptr) == c->rom_size;
+    }
+    for (uint32_t i = 0; ok && i < c->num_events; i++)
+    {
+        uint8_t event[4];
+
+        ok = fread(event, 1, 4, fptr) == 4 && event[2] < KEYPAD_SIZE &&
+             (i == 0 || get(event, 2) >= c->events[i - 1].frame);
+        c->events[i].frame = (uint16_t) get(event, 2);
+        c->events[i].key   = event[2];
+        c->events[i].down  = event[3] != 0;
+    }
+    fclose(fptr);
+    if (!ok)
+    {
+        fprintf(stderr, "Not a case this build can read: %s\n", path);
+    }
+    return ok;
+}
+
+// ---- mutation ----
+
+// Opcodes worth dropping in whole, with random operands: the ones that
+// move the PC, the stack or I, and the memory ops
+static const uint16_t templates[] =
+{
+    0x00EE, 0x1000, 0x2000, 0xB000, 0xA000, 0x3000, 0x4000, 0x5000, 0x9000,
+    0xE09E, 0xE0A1, 0xF00A, 0xF01E, 0xF029, 0xF033, 0xF055, 0xF065, 0xD000
+};
+
+static void sort_events(FuzzCase* c){
+    for (uint32_t i = 1; i < c->num_events; i++)
+    {
+        FuzzEvent e = c->events[i];
+        uint32_t j = i;
+
+        while (j > 0 && c->events[j - 1].frame > e.frame)
+        {
+            c->events[j] = c->events[j - 1];
+            j--;
+        }
+        c->events[j] = e;
+    }
+}
+
+static void mutate(Worker* w, FuzzCase* c){
+    int rounds = 1 + random_below(w, 4);
+
+    for (int r = 0; r < rounds; r++)
+    {
+        uint32_t at = c->rom_size ? random_below(w, c->rom_size) : 0;
+        uint32_t even = at & ~1u;
+
+        switch (random_below(w, c->rom_size ? 8 : 3))
+        {
+            case 0:                             // add a key change
+                if (c->num_events < MAX_EVENTS)
+                {
+                    FuzzEvent* e = &c->events[c->num_events++];
+                    e->frame = (uint16_t) random_below(w, c->frames);
+                    e->key   = (uint8_t) random_below(w, KEYPAD_SIZE);
+                    e->down  = (uint8_t) random_below(w, 2);
+                }
+                break;
+            case 1:                             // drop one
+                if (c->num_events > 0)
+                {
+                    uint32_t i = random_below(w, c->num_events);
+                    c->events[i] = c->events[--c->num_events];
+                }
+                break;
+            case 2:                             // move one
+                if (c->num_events > 0)
+                {
+                    c->events[random_below(w, c->num_events)].frame = (uint16_t) random_below(w, c->frames);
+                }
+                break;
+            case 3:
+                c->rom[at] ^= (uint8_t) (1u << random_below(w, 8));
+                break;
+            case 4:
+                c->rom[at] = (uint8_t) random_below(w, 256);
+                break;
+            case 5:                             // a whole instruction
+                if (even + 1 < c->rom_size)
+                {
+                    uint16_t op = templates[random_below(w, sizeof(templates) / sizeof(templates[0]))];
+
+                    // Fill in the operand bits the template left at zero
+                    op |= (uint16_t) (random_below(w, 0x10000) & (op & 0x00FF ? 0x0F00 : 0x0FFF));
+                    c->rom[even]     = (uint8_t) (op >> 8);
+                    c->rom[even + 1] = (uint8_t) op;
+                }
+                break;
+            case 6:                             // copy an instruction from elsewhere
+            {
+                uint32_t from = random_below(w, c->rom_size) & ~1u;
+
+                if (even + 1 < c->rom_size && from + 1 < c->rom_size)
+                {
+                    c->rom[even]     = c->rom[from];
+                    c->rom[even + 1] = c->rom[from + 1];
+                }
+                break;
+            }
+            case 7:                             // small numbers in operands, jumps nearby
+                if (even + 1 < c->rom_size)
+                {
+                    c->rom[even + 1] = (uint8_t) (c->rom[even + 1] + random_below(w, 9) - 4);
+                }
+                break;
+        }
+    }
+    sort_events(c);
+}
+
+// ---- faults ----
+
+// Keeps trial in c if it still faults like `want`
+static bool try_case(Worker* w, FuzzCase* c, const FuzzCase* trial, const Fault* want){
+    Fault got = run_case(w, trial, false);
+
+    if (same_fault(&got, want))
+    {
+        *c = *trial;
+        return true;
+    }
+    return false;
+}
+
+// Shrinks c as far as it still faults like `want`: no key changes after
+// the fault, then none that aren't needed, then the ROM cut down from the
+// end. What's left is cleared to zeros: first every byte the run never
+// executed, which keeps whatever it reads as sprites or data only if that
+// changes the fault, then halves, quarters and so on down to single
+// instructions, wherever that makes no difference. Zero bytes at the end
+// are the same as no bytes, so they go too. w's coverage maps are
+// overwritten.
+static void minimize(Worker* w, FuzzCase* c, const Fault* want){
+    FuzzCase trial;
+    uint32_t step;
+
+    c->frames = want->frame + 1;
+    while (c->num_events > 0 && c->events[c->num_events - 1].frame > want->frame)
+    {
+        c->num_events--;
+    }
+
+    for (uint32_t i = c->num_events; i-- > 0; )
+    {
+        trial = *c;
+        memmove(&trial.events[i], &trial.events[i + 1], (trial.num_events - i - 1) * sizeof(FuzzEvent));
+        trial.num_events--;
+        try_case(w, c, &trial, want);
+    }
+
+    for (step = c->rom_size / 2; step > 0; )
+    {
+        trial = *c;
+        trial.rom_size -= step;
+        memset(trial.rom + trial.rom_size, 0, step);
+        if (try_case(w, c, &trial, want))
+        {
+            step = step < c->rom_size ? step : c->rom_size;
+        }
+        else
+        {
+            step /= 2;
+        }
+    }
+
+    memset(w->pc_map, 0, sizeof(w->pc_map));
+    run_case(w, c, true);
+    trial = *c;
+    for (uint32_t i = 0; i < trial.rom_size; i++)
+    {
+        unsigned addr = 0x200 + i;
+
+        if (!w->pc_map[addr] && !w->pc_map[(addr - 1) & MEM_MASK])
+        {
+            trial.rom[i] = 0;
+        }
+    }
+    try_case(w, c, &trial, want);
+
+    for (step = c->rom_size / 2; step >= 2; step /= 2)
+    {
+        for (uint32_t start = 0; start < c->rom_size; start += step)
+        {
+            uint32_t len = c->rom_size - start < step ? c->rom_size - start : step;
+            bool zero = true;
+
+            for (uint32_t i = start; i < start + len && zero; i++)
+            {
+                zero = c->rom[i] == 0;
+            }
+            if (!zero)
+            {
+                trial = *c;
+                memset(trial.rom + start, 0, len);
+                try_case(w, c, &trial, want);
+            }
+        }
+    }
+
+    while (c->rom_size > 0 && c->rom[c->rom_size - 1] == 0)
+    {
+        c->rom_size--;
+    }
+}
+
+static void describe(const Fault* f, char* out, size_t size){
+    char text[DISASM_MAX];
+
+    Chip8Disassemble(f->opcode, text);
+    switch (f->kind)
+    {
+        case CHIP8_FAULT_OPCODE:
+            snprintf(out, size, "unknown opcode %04x at 0x%03x", f->opcode, f->pc);
+            break;
+        default:
+            snprintf(out, size, "%s at 0x%03x: %s", Chip8FaultName(f->kind), f->pc, text);
+            break;
+    }
+}
+
+// Faults are told apart by the opcode when it's unknown, as running into
+// the same junk (usually 0000) from anywhere is the same bug, and by the PC
+// otherwise
+static uint16_t fault_key(const Fault* f){
+    return f->kind == CHIP8_FAULT_OPCODE ? f->opcode : f->pc;
+}
+
+static void report_crash(Worker* w, const FuzzCase* c, const Fault* f){
+    uint32_t key = (uint32_t) f->kind << 16 | fault_key(f);
+    char path[1024], text[128];
+    FuzzCase small = *c;
+    unsigned kept = 0;
+    bool seen = false;
+
+    pthread_mutex_lock(&crash_lock);
+    for (size_t i = 0; i < num_crashes; i++)
+    {
+        seen |= crashes[i] == key;
+    }
+    // Past MAX_CRASHES they're only counted
+    if (!seen && num_crashes == MAX_CRASHES)
+    {
+        seen = true;
+        dropped++;
+    }
+    else if (!seen)
+    {
+        crashes[num_crashes++] = key;
+    }
+    pthread_mutex_unlock(&crash_lock);
+    if (seen)
+    {
+        return;
+    }
+
+    minimize(w, &small, f);
+    snprintf(path, sizeof(path), f->kind == CHIP8_FAULT_OPCODE ? "%s/crash-%s-%04x.c8fz" : "%s/crash-%s-%03x.c8fz",
+             out_dir, fault_names[f->kind], fault_key(f));
+    describe(f, text, sizeof(text));
+    for (uint32_t i = 0; i < small.rom_size; i++)
+    {
+        kept += small.rom[i] != 0;
+    }
+    if (save_case(&small, path))
+    {
+        fprintf(stderr, "%s, frame %u: %u ROM bytes, %u of them not zero, %u key changes, saved to %s\n",
+                text, (unsigned) f->frame, (unsigned) small.rom_size, kept, (unsigned) small.num_events, path);
+    }
+}
+
+// ---- workers ----
+
+static void init_worker(Worker* w, unsigned id){
+    InitializeChip8(&w->blank);
+    Chip8Seed(&w->blank, seed);
+    w->rng = ((uint64_t) seed << 32 | id) * 0x9E3779B97F4A7C15ULL + 1;
+    w->pool.children = NULL;
+    w->pool.count    = 0;
+
+    if (strcmp(engine, "switch") == 0)
+    {
+        return;
+    }
+    if (!Chip8PoolInit(&w->pool, &w->blank, 1))
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    if (strcmp(engine, "predecode") == 0)
+    {
+        Chip8EnablePredecode(&w->pool.children[0]);
+    }
+    else
+    {
+        Chip8EnableJit(&w->pool.children[0]);
+    }
+}
+
+static void free_worker(Worker* w){
+    if (w->pool.children != NULL)
+    {
+        Chip8PoolFree(&w->pool);
+    }
+    Chip8ReleaseMemory(&w->blank);
+}
+
+static void* worker_main(void* arg){
+    Worker* w = arg;
+    FuzzCase c;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED))
+    {
+        Fault fault;
+
+        pthread_mutex_lock(&corpus_lock);
+        c = *corpus[random_below(w, (uint32_t) corpus_size)];
+        pthread_mutex_unlock(&corpus_lock);
+
+        mutate(w, &c);
+        memset(w->pc_map, 0, sizeof(w->pc_map));
+        memset(w->edge_map, 0, sizeof(w->edge_map));
+        fault = run_case(w, &c, true);
+        __atomic_add_fetch(&execs, 1, __ATOMIC_RELAXED);
+
+        if (fault.kind != CHIP8_OK)
+        {
+            report_crash(w, &c, &fault);
+        }
+        else
+        {
+            keep_if_new(w, &c);
+        }
+    }
+    return NULL;
+}
+
+static double now_seconds(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Runs c on the engine picked with -e and prints how it ends
+static Fault replay_on(const FuzzCase* c){
+    Worker* w = malloc(sizeof(Worker));
+    Fault fault;
+    char text[128];
+
+    if (w == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    init_worker(w, 0);
+    fault = run_case(w, c, false);
+    free_worker(w);
+    free(w);
+
+    printf("%s: ", engine);
+    if (fault.kind == CHIP8_OK)
+    {
+        printf("no fault in %u frames\n", (unsigned) c->frames);
+        return fault;
+    }
+    describe(&fault, text, sizeof(text));
+    printf("%s, frame %u", text, (unsigned) fault.frame);
+    if (strcmp(engine, "switch") == 0)
+    {
+        printf(", after %llu instructions", (unsigned long long) fault.cycle);
+    }
+    printf("\n");
+    return fault;
+}
+
+// Exits 1 if the case faults, and 3 if the engines don't agree on how
+static int replay(const char* path, bool every_engine){
+    static const char* engines[] = { "switch", "predecode", "jit" };
+    FuzzCase c;
+    Fault first, fault;
+
+    if (!load_case(&c, path))
+    {
+        exit(2);
+    }
+    if (!every_engine)
+    {
+        return replay_on(&c).kind != CHIP8_OK;
+    }
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+    {
+        engine = engines[i];
+        fault  = replay_on(&c);
+        if (i == 0)
+        {
+            first = fault;
+        }
+        else if (!same_fault(&fault, &first) || fault.frame != first.frame)
+        {
+            printf("The engines don't agree\n");
+            return 3;
+        }
+    }
+    return first.kind != CHIP8_OK;
+}
+
+static void usage(){
+    fprintf(stderr,
+        "Usage: ./chip8_fuzz [options] [seed rom...]\n"
+        "       ./chip8_fuzz [-e <engine>] -r <case>\n"
+        "  -j <threads>   worker threads (default: one per core)\n"
+        "  -d <seconds>   how long to run (default %d, 0 = until -n)\n"
+        "  -n <cases>     stop after this many cases\n"
+        "  -f <frames>    frames per case (default %d)\n"
+        "  -i <cycles>    instructions per frame (default %d)\n"
+        "  -S <seed>      random seed, for the fuzzer and the machines (default 1)\n"
+        "  -o <dir>       where crashing cases go (default %s)\n"
+        "  -e <engine>    switch, predecode or jit (default switch)\n"
+        "  -r <case>      run one saved case on -e, or every engine, and say how it ends\n",
+        DEFAULT_SECONDS, DEFAULT_FRAMES, DEFAULT_CYCLES_PER_FRAME, DEFAULT_OUT_DIR);
+    exit(2);
+}
+
+int main(int argc, char* argv[])
+{
+    static const char* default_roms[] = { "IBMLogo.ch8", "Tetris.ch8", "SpaceInvaders.ch8" };
+    const char** roms = default_roms;
+    int num_roms = sizeof(default_roms) / sizeof(default_roms[0]);
+    int num_workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    double seconds = DEFAULT_SECONDS, start, last_report;
+    uint64_t max_execs = 0;
+    const char* replay_path = NULL;
+    bool every_engine = true;
+    Worker* workers;
+    pthread_t* threads;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:d:n:f:i:S:o:e:r:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'j': num_workers = atoi(optarg); break;
+            case 'd': seconds = atof(optarg); break;
+            case 'n': max_execs = strtoull(optarg, NULL, 10); break;
+            case 'f': frames = strtoul(optarg, NULL, 10); break;
+            case 'i': cycles_per_frame = strtoul(optarg, NULL, 10); break;
+            case 'S': seed = strtoul(optarg, NULL, 10); break;
+            case 'o': out_dir = optarg; break;
+            case 'e': engine = optarg; every_engine = false; break;
+            case 'r': replay_path = optarg; break;
+            default: usage();
+        }
+    }
+    if (strcmp(engine, "switch") != 0 && strcmp(engine, "predecode") != 0 && strcmp(engine, "jit") != 0)
+    {
+        usage();
+    }
+    if (replay_path != NULL)
+    {
+        return replay(replay_path, every_engine);
+    }
+    if (num_workers < 1 || frames < 1 || frames > 0xFFFF || cycles_per_frame < 1 ||
+        (seconds <= 0 && max_execs == 0))
+    {
+        usage();
+    }
+    if (optind < argc)
+    {
+        roms = (const char**) &argv[optind];
+        num_roms = argc - optind;
+    }
+    if (mkdir(out_dir, 0777) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "Unable to create %s\n", out_dir);
+        exit(2);
+    }
+
+    workers = malloc(num_workers * sizeof(Worker));
+    threads = malloc(num_workers * sizeof(pthread_t));
+    if (workers == NULL || threads == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (int i = 0; i < num_workers; i++)
+    {
+        init_worker(&workers[i], (unsigned) i);
+    }
+
+    // The seeds go in whatever they cover, so every worker has a start
+    for (int i = 0; i < num_roms; i++)
+    {
+        FuzzCase c;
+        Fault fault;
+        FILE* fptr = fopen(roms[i], "rb");
+
+        if (fptr == NULL)
+        {
+            fprintf(stderr, "Unable to open game: %s\n", roms[i]);
+            exit(2);
+        }
+        memset(&c, 0, sizeof(c));
+        c.rom_size = (uint32_t) fread(c.rom, 1, MAX_GAME_SIZE, fptr);
+        c.frames = frames;
+        fclose(fptr);
+
+        memset(workers[0].pc_map, 0, sizeof(workers[0].pc_map));
+        memset(workers[0].edge_map, 0, sizeof(workers[0].edge_map));
+        fault = run_case(&workers[0], &c, true);
+        if (fault.kind != CHIP8_OK)
+        {
+            report_crash(&workers[0], &c, &fault);
+        }
+        else
+        {
+            // Even with nothing new, so that every seed gets mutated
+            add_case(&workers[0], &c);
+        }
+    }
+    if (corpus_size == 0)
+    {
+        fprintf(stderr, "Every seed faults, nothing to mutate\n");
+        exit(1);
+    }
+
+    start = last_report = now_seconds();
+    for (int i = 0; i < num_workers; i++)
+    {
+        pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+    }
+    while (!stop)
+    {
+        struct timespec tenth = { 0, 100000000 };
+        double now;
+        uint64_t done;
+
+        nanosleep(&tenth, NULL);
+        now  = now_seconds();
+        done = __atomic_load_n(&execs, __ATOMIC_RELAXED);
+        if ((seconds > 0 && now - start >= seconds) || (max_execs && done >= max_execs))
+        {
+            __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+        }
+        if (now - last_report >= 1 || stop)
+        {
+            pthread_mutex_lock(&corpus_lock);
+            pthread_mutex_lock(&crash_lock);
+            fprintf(stderr, "%llu cases, %.0f/s, corpus %zu, %u PCs, %u edges, %zu faults",
+                    (unsigned long long) done, done / (now - start), corpus_size, num_pcs,
+                    num_edges, num_crashes);
+            if (dropped)
+            {
+                fprintf(stderr, " (%llu more not saved)", (unsigned long long) dropped);
+            }
+            fprintf(stderr, "\n");
+            pthread_mutex_unlock(&crash_lock);
+            pthread_mutex_unlock(&corpus_lock);
+            last_report = now;
+        }
+    }
+    for (int i = 0; i < num_workers; i++)
+    {
+        pthread_join(threads[i], NULL);
+        free_worker(&workers[i]);
+    }
+
+    for (size_t i = 0; i < corpus_size; i++)
+    {
+        free(corpus[i]);
+    }
+    free(corpus);
+    free(workers);
+    free(threads);
+    return 0;
+}
@@ -0,0 +1,220 @@
+// The predecoded handlers, one per Chip8Op. They live in a header so the
+// threaded core can inline them into its dispatch loop while predecode.c
+// takes their addresses for the handler table.
+
+#ifndef CHIP_8_HANDLERS
+#define CHIP_8_HANDLERS
+
+#include "chip8.h"
+#include "chip8_ops.h"
+#include "predecode.h"
+
+#define V (chip8->registers)
+
+static inline void exec_00E0(CHIP8* chip8, const Chip8Decoded* d){
+    (void) d;
+    memset(chip8->fb, 0, sizeof(uint64_t)*GFX_ROWS);
+    chip8->dirty_rows = ~0u;
+    chip8->draw_flag = true;
+    chip8->PC += 2;
+}
+
+// A call, return or key skip that would go out of range is handed to
+// EmulateCycle, which faults the machine and sets waiting. The loops check
+// waiting after these and stop, as they do for Fx0A.
+
+static inline void exec_00EE(CHIP8* chip8, const Chip8Decoded* d){
+    (void) d;
+    if (chip8->stkptr == 0)
+    {
+        EmulateCycle(chip8);
+        return;
+    }
+    chip8->PC = chip8->stack[--chip8->stkptr];
+}
+
+static inline void exec_1nnn(CHIP8* chip8, const Chip8Decoded* d){
+    chip8->PC = d->nnn;
+}
+
+static inline void exec_2nnn(CHIP8* chip8, const Chip8Decoded* d){
+    if (chip8->stkptr >= STACK_SIZE)
+    {
+        EmulateCycle(chip8);
+        return;
+    }
+    chip8->stack[chip8->stkptr++] = chip8->PC + 2;
+    chip8->PC = d->nnn;
+}
+
+static inline void exec_3xkk(CHIP8* chip8, const Chip8Decoded* d){
+    chip8->PC += (V[d->x] == d->kk) ? 4 : 2;
+}
+
+static inline void exec_4xkk(CHIP8* chip8, const Chip8Decoded* d){
+    chip8->PC += (V[d->x] != d->kk) ? 4 : 2;
+}
+
+static inline void exec_5xy0(CHIP8* chip8, const Chip8Decoded* d){
+    chip8->PC += (V[d->x] == V[d->y]) ? 4 : 2;
+}
+
+static inline void exec_6xkk(CHIP8* chip8, const Chip8Decoded* d){
+    V[d->x] = d->kk;
+    chip8->PC += 2;
+}
+
+static inline void exec_7xkk(CHIP8* chip8, const Chip8Decoded* d){
+    V[d->x] += d->kk;
+    chip8->PC += 2;
+}
+
+static inline void exec_8xy0(CHIP8* chip8, const Chip8Decoded* d){
+    V[d->x] = V[d->y];
+    chip8->PC += 2;
+}
+
+static inline void exec_8xy1(CHIP8* chip8, const Chip8Decoded* d){
+    V[d->x] |= V[d->y];
+    chip8->PC += 2;
+}
+
+static inline void exec_8xy2(CHIP8* chip8, const Chip8Decoded* d){
+    V[d->x] &= V[d->y];
+    chip8->PC += 2;
+}
+
+static inline void exec_8xy3(CHIP8* chip8, const Chip8Decoded* d){
+    V[d->x] ^= V[d->y];
+    chip8->PC += 2;
+}
+
+static inline void exec_8xy4(CHIP8* chip8, const Chip8Decoded* d){
+    V[0xF] = ((int) V[d->x] + (int) V[d->y]) > 255 ? 1 : 0;
+    V[d->x] = V[d->x] + V[d->y];
+    chip8->PC += 2;
+}
+
+static inline void exec_8xy5(CHIP8* chip8, const Chip8Decoded* d){
+    V[0xF] = (V[d->x] > V[d->y]) ? 1 : 0;
+    V[d->x] = V[d->x] - V[d->y];
+    chip8->PC += 2;
+}
+
+static inline void exec_8xy6(CHIP8* chip8, const Chip8Decoded* d){
+    V[0xF] = V[d->x] & 0x1;
+    V[d->x] = V[d->x] >> 1;
+    chip8->PC += 2;
+}
+
+static inline void exec_8xy7(CHIP8* chip8, const Chip8Decoded* d){
+    V[0xF] = (V[d->y] > V[d->x]) ? 1 : 0;
+    V[d->x] = V[d->y] - V[d->x];
+    chip8->PC += 2;
+}
+
+static inline void exec_8xyE(CHIP8* chip8, const Chip8Decoded* d){
+    V[0xF] = (V[d->x] >> 7) & 0x1;
+    V[d->x] = V[d->x] << 1;
+    chip8->PC += 2;
+}
+
+static inline void exec_9xy0(CHIP8* chip8, const Chip8Decoded* d){
+    chip8->PC += (V[d->x] != V[d->y]) ? 4 : 2;
+}
+
+static inline void exec_Annn(CHIP8* chip8, const Chip8Decoded* d){
+    chip8->IndexRegister = d->nnn;
+    chip8->PC += 2;
+}
+
+static inline void exec_Bnnn(CHIP8* chip8, const Chip8Decoded* d){
+    chip8->PC = (d->nnn + V[0]) & MEM_MASK;
+}
+
+static inline void exec_Cxkk(CHIP8* chip8, const Chip8Decoded* d){
+    V[d->x] = randbyte(&chip8->rng) & d->kk;
+    chip8->PC += 2;
+}
+
+static inline void exec_Dxyn(CHIP8* chip8, const Chip8Decoded* d){
+    draw_sprite(chip8, V[d->x], V[d->y], d->kk & 0xF);
+    chip8->PC += 2;
+    chip8->draw_flag = true;
+}
+
+static inline void exec_Ex9E(CHIP8* chip8, const Chip8Decoded* d){
+    if (V[d->x] >= KEYPAD_SIZE)
+    {
+        EmulateCycle(chip8);
+        return;
+    }
+    chip8->PC += (chip8->key[V[d->x]]) ? 4 : 2;
+}
+
+static inline void exec_ExA1(CHIP8* chip8, const Chip8Decoded* d){
+    if (V[d->x] >= KEYPAD_SIZE)
+    {
+        EmulateCycle(chip8);
+        return;
+    }
+    chip8->PC += (!chip8->key[V[d->x]]) ? 4 : 2;
+}
+
+static inline void exec_Fx07(CHIP8* chip8, const Chip8Decoded* d){
+    V[d->x] = chip8->DelayTimer;
+    chip8->PC += 2;
+}
+
+static inline void exec_Fx15(CHIP8* chip8, const Chip8Decoded* d){
+    chip8->DelayTimer = V[d->x];
+    chip8->PC += 2;
+}
+
+static inline void exec_Fx18(CHIP8* chip8, const Chip8Decoded* d){
+    chip8->SoundTimer = V[d->x];
+    chip8->PC += 2;
+}
+
+static inline void exec_Fx1E(CHIP8* chip8, const Chip8Decoded* d){
+    V[0xF] = (chip8->IndexRegister + V[d->x] > 0xFFF) ? 1 : 0;
+    chip8->IndexRegister = chip8->IndexRegister + V[d->x];
+    chip8->PC += 2;
+}
+
+static inline void exec_Fx29(CHIP8* chip8, const Chip8Decoded* d){
+    chip8->IndexRegister = FONTSET_BYTES_PER_CHAR * V[d->x];
+    chip8->PC += 2;
+}
+
+static inline void exec_Fx33(CHIP8* chip8, const Chip8Decoded* d){
+    uint16_t I = chip8->IndexRegister;
+    uint8_t bcd[3] = { (V[d->x] % 1000) / 100, (V[d->x] % 100) / 10, V[d->x] % 10 };
+
+    mem_store(chip8, I, bcd, 3);
+    chip8->PC += 2;
+    // Last, this may well overwrite d itself
+    Chip8InvalidateCode(chip8, I, 3);
+}
+
+static inline void exec_Fx55(CHIP8* chip8, const Chip8Decoded* d){
+    uint16_t I = chip8->IndexRegister;
+    int x = d->x;
+
+    mem_store(chip8, I, V, x + 1);
+    chip8->IndexRegister += x + 1;
+    chip8->PC += 2;
+    Chip8InvalidateCode(chip8, I, x + 1);
+}
+
+static inline void exec_Fx65(CHIP8* chip8, const Chip8Decoded* d){
+    int x = d->x;
+
+    mem_load(chip8, chip8->IndexRegister, V, x + 1);
+    chip8->IndexRegister += x + 1;
+    chip8->PC += 2;
+}
+
+#undef V
+
+#endif
@@ -0,0 +1,175 @@
+#include "inputlog.h"
+
+#define MAX_LINE 256
+
+void Chip8LogInit(Chip8InputLog* log, uint32_t seed){
+    log->events   = NULL;
+    log->count    = 0;
+    log->capacity = 0;
+    log->next     = 0;
+    log->seed     = seed;
+}
+
+void Chip8LogFree(Chip8InputLog* log){
+    free(log->events);
+    Chip8LogInit(log, log->seed);
+}
+
+static void append(Chip8InputLog* log, uint64_t cycle, uint32_t ticks, Chip8InputKind kind, uint8_t key){
+    if (log->count == log->capacity)
+    {
+        size_t capacity = log->capacity ? 2 * log->capacity : 1024;
+        Chip8InputEvent* events = realloc(log->events, capacity * sizeof(Chip8InputEvent));
+
+        if (events == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        log->events   = events;
+        log->capacity = capacity;
+    }
+
+    Chip8InputEvent* e = &log->events[log->count++];
+    e->cycle = cycle;
+    e->ticks = ticks;
+    e->kind  = (uint8_t) kind;
+    e->key   = key;
+}
+
+void Chip8LogKey(Chip8InputLog* log, const CHIP8* chip8, uint8_t key, bool down){
+    append(log, chip8->cycles, chip8->ticks, down ? INPUT_KEY_DOWN : INPUT_KEY_UP, key);
+}
+
+void Chip8LogTick(Chip8InputLog* log, const CHIP8* chip8){
+    append(log, chip8->cycles, chip8->ticks, INPUT_TICK, 0);
+}
+
+void Chip8LogTruncate(Chip8InputLog* log, const CHIP8* chip8){
+    // Events are in (cycle, ticks) order. Anything at the machine's (cycle,
+    // ticks) or later hadn't happened yet in the state it was put back to.
+    while (log->count > 0)
+    {
+        const Chip8InputEvent* e = &log->events[log->count - 1];
+
+        if (e->cycle < chip8->cycles || (e->cycle == chip8->cycles && e->ticks < chip8->ticks))
+        {
+            break;
+        }
+        log->count--;
+    }
+    if (log->next > log->count)
+    {
+        log->next = log->count;
+    }
+}
+
+bool Chip8LogReplay(Chip8InputLog* log, CHIP8* chip8, uint32_t cycles){
+    uint64_t end = chip8->cycles + cycles;
+
+    while (log->next < log->count && log->events[log->next].cycle <= end)
+    {
+        const Chip8InputEvent* e = &log->events[log->next++];
+
+        if (e->cycle > chip8->cycles)
+        {
+            Chip8Run(chip8, (uint32_t) (e->cycle - chip8->cycles));
+        }
+        if (e->kind == INPUT_TICK)
+        {
+            Tick(chip8);
+        }
+        else
+        {
+            chip8->key[e->key & 0xF] = e->kind == INPUT_KEY_DOWN;
+        }
+    }
+    if (chip8->cycles < end)
+    {
+        Chip8Run(chip8, (uint32_t) (end - chip8->cycles));
+    }
+    return log->next < log->count;
+}
+
+bool Chip8LogSave(const Chip8InputLog* log, const char* path){
+    FILE* fptr = fopen(path, "w");
+
+    if (fptr == NULL)
+    {
+        fprintf(stderr, "Unable to write input log: %s\n", path);
+        return false;
+    }
+
+    fprintf(fptr, "seed %u\n", (unsigned) log->seed);
+    for (size_t i = 0; i < log->count; i++)
+    {
+        const Chip8InputEvent* e = &log->events[i];
+
+        if (e->kind == INPUT_TICK)
+        {
+            fprintf(fptr, "%llu tick\n", (unsigned long long) e->cycle);
+        }
+        else
+        {
+            fprintf(fptr, "%llu %x %s\n", (unsigned long long) e->cycle, e->key,
+                    e->kind == INPUT_KEY_DOWN ? "down" : "up");
+        }
+    }
+
+    if (fclose(fptr) != 0)
+    {
+        fprintf(stderr, "Unable to write input log: %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool Chip8LogLoad(Chip8InputLog* log, const char* path){
+    FILE* fptr = fopen(path, "r");
+    char line[MAX_LINE];
+    unsigned line_no = 0;
+    uint32_t ticks = 0;
+
+    if (fptr == NULL)
+    {
+        fprintf(stderr, "Unable to open input log: %s\n", path);
+        return false;
+    }
+
+    Chip8LogInit(log, 0);
+    while (fgets(line, sizeof(line), fptr) != NULL)
+    {
+        unsigned long long cycle;
+        unsigned seed, key;
+        char what[8];
+
+        line_no++;
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+        if (sscanf(line, "seed %u", &seed) == 1)
+        {
+            log->seed = seed;
+        }
+        else if (sscanf(line, "%llu %7s", &cycle, what) == 2 && strcmp(what, "tick") == 0)
+        {
+            append(log, cycle, ticks++, INPUT_TICK, 0);
+        }
+        else if (sscanf(line, "%llu %x %7s", &cycle, &key, what) == 3 && key < KEYPAD_SIZE &&
+                 (strcmp(what, "down") == 0 || strcmp(what, "up") == 0))
+        {
+            append(log, cycle, ticks, what[0] == 'd' ? INPUT_KEY_DOWN : INPUT_KEY_UP, (uint8_t) key);
+        }
+        else
+        {
+            fprintf(stderr, "%s:%u: bad input log line\n", path, line_no);
+            fclose(fptr);
+            Chip8LogFree(log);
+            return false;
+        }
+    }
+
+    fclose(fptr);
+    return true;
+}
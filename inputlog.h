@@ -0,0 +1,61 @@
+// Input logs. Everything that reaches a machine from outside is a key going
+// down or up, or a Tick. A log records each one against the machine's clock
+// (chip8->cycles, the instructions asked of Chip8Run so far), so a replay
+// feeds them in at exactly the same instruction no matter how fast it runs.
+// Together with the seed this reproduces a session bit for bit.
+//
+// On disk it is text, one event per line:
+//     seed <n>
+//     <cycle> <key in hex> <down|up>
+//     <cycle> tick
+// Key lines are the same as in a runner input script (see runner.c).
+
+#ifndef CHIP_8_INPUTLOG
+#define CHIP_8_INPUTLOG
+
+#include "chip8.h"
+
+typedef enum
+{
+    INPUT_KEY_UP = 0,
+    INPUT_KEY_DOWN,
+    INPUT_TICK,
+} Chip8InputKind;
+
+typedef struct
+{
+    uint64_t        cycle;                      // chip8->cycles when it happened
+    uint32_t        ticks;                      // chip8->ticks before it happened
+    uint8_t         kind;                       // Chip8InputKind
+    uint8_t         key;
+} Chip8InputEvent;
+
+typedef struct
+{
+    Chip8InputEvent* events;
+    size_t          count;
+    size_t          capacity;
+    size_t          next;                       // replay position
+    uint32_t        seed;                       // what the machine was seeded with
+} Chip8InputLog;
+
+void Chip8LogInit(Chip8InputLog* log, uint32_t seed);
+void Chip8LogFree(Chip8InputLog* log);
+
+// Recording. Call these as the frontend does the same thing to the machine.
+void Chip8LogKey(Chip8InputLog* log, const CHIP8* chip8, uint8_t key, bool down);
+void Chip8LogTick(Chip8InputLog* log, const CHIP8* chip8);
+
+// Forgets everything that happened at or after the machine's clock, for when
+// it was put back to an earlier state (rewind, loading a state)
+void Chip8LogTruncate(Chip8InputLog* log, const CHIP8* chip8);
+
+// Replay. Runs `cycles` instructions, pressing keys and ticking the timers
+// where the log says. Returns false once the log has run out.
+bool Chip8LogReplay(Chip8InputLog* log, CHIP8* chip8, uint32_t cycles);
+
+// Both say why on stderr and return false on failure
+bool Chip8LogSave(const Chip8InputLog* log, const char* path);
+bool Chip8LogLoad(Chip8InputLog* log, const char* path);
+
+#endif
@@ -0,0 +1,883 @@
+#define _DEFAULT_SOURCE
+
+#include "chip8.h"
+#include "chip8_ops.h"
+#include "jit.h"
+
+#include <stddef.h>
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+// Host registers, numbered the way the x86 encoding wants them
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// rdi holds the CHIP8 pointer, esi the cycle budget, r11d the cycles used by
+// earlier trips round a looping block, and rax/rdx are scratch. Everything
+// else can hold a V register. The callee-saved ones get pushed in the prologue.
+static const uint8_t pool[] = { RCX, R8, R9, R10, RBX, RBP, R12, R13, R14, R15 };
+#define POOL_SIZE ((int) sizeof(pool))
+
+#define OFF_V       ((int32_t) offsetof(CHIP8, registers))
+#define OFF_I       ((int32_t) offsetof(CHIP8, IndexRegister))
+#define OFF_PC      ((int32_t) offsetof(CHIP8, PC))
+#define OFF_OPCODE  ((int32_t) offsetof(CHIP8, opcode))
+#define OFF_DT      ((int32_t) offsetof(CHIP8, DelayTimer))
+#define OFF_ST      ((int32_t) offsetof(CHIP8, SoundTimer))
+#define OFF_STACK   ((int32_t) offsetof(CHIP8, stack))
+#define OFF_SP      ((int32_t) offsetof(CHIP8, stkptr))
+#define OFF_KEY     ((int32_t) offsetof(CHIP8, key))
+
+// Longest code one guest instruction can turn into (a skip carries a whole
+// exit path), plus prologue/epilogue. One that can fault also has a check and
+// a jump to the block's fault exit, which is about as long as any other exit.
+#define EXIT_BYTES      (16 * 9 + 16 * 2 + 48)
+#define MAX_INSN_BYTES  (64 + EXIT_BYTES)
+#define FAULT_BYTES     32
+#define MAX_EDGE_BYTES  (16 * 9 + EXIT_BYTES + 32)
+
+typedef struct
+{
+    uint8_t*    p;
+    int8_t      host[16];                       // V index -> host reg, -1 = none
+    int         used;
+    unsigned    all;                            // V registers the block holds
+    uint8_t*    loop;                           // top of the block body
+    uint8_t*    fault;                          // the block's fault exit, NULL = none
+} Emitter;
+
+static bool is_callee_saved(int r){
+    return r == RBX || r == RBP || r >= R12;
+}
+
+// ---- raw encoding ----
+
+static void emit8(Emitter* e, uint8_t b){
+    *e->p++ = b;
+}
+
+static void emit32(Emitter* e, uint32_t v){
+    memcpy(e->p, &v, 4);
+    e->p += 4;
+}
+
+static void emit16(Emitter* e, uint16_t v){
+    memcpy(e->p, &v, 2);
+    e->p += 2;
+}
+
+static void rex(Emitter* e, int reg, int rm){
+    if (reg >= 8 || rm >= 8)
+    {
+        emit8(e, 0x40 | ((reg >> 3) << 2) | (rm >> 3));
+    }
+}
+
+static void modrm_reg(Emitter* e, int reg, int rm){
+    emit8(e, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// [rdi + disp32]
+static void modrm_ctx(Emitter* e, int reg, int32_t disp){
+    emit8(e, 0x80 | ((reg & 7) << 3) | RDI);
+    emit32(e, disp);
+}
+
+// op r32, r32 with the usual "op rm, reg" direction (add 01, or 09, ...)
+static void alu_rr(Emitter* e, uint8_t op, int dst, int src){
+    rex(e, src, dst);
+    emit8(e, op);
+    modrm_reg(e, src, dst);
+}
+
+// op r32, imm32 (group 1: add /0, or /1, and /4, sub /5, xor /6, cmp /7)
+static void alu_ri(Emitter* e, int digit, int dst, uint32_t imm){
+    rex(e, 0, dst);
+    emit8(e, 0x81);
+    modrm_reg(e, digit, dst);
+    emit32(e, imm);
+}
+
+#define ADD 0x01
+#define OR  0x09
+#define AND 0x21
+#define SUB 0x29
+#define XOR 0x31
+#define CMP 0x39
+#define MOV 0x89
+
+static void mov_ri(Emitter* e, int dst, uint32_t imm){
+    rex(e, 0, dst);
+    emit8(e, 0xB8 + (dst & 7));
+    emit32(e, imm);
+}
+
+// shl/shr r32, imm8 (group 2: shl /4, shr /5)
+static void shift_ri(Emitter* e, int digit, int dst, uint8_t count){
+    rex(e, 0, dst);
+    emit8(e, 0xC1);
+    modrm_reg(e, digit, dst);
+    emit8(e, count);
+}
+
+// setcc al; movzx dst, al
+static void setcc_zx(Emitter* e, uint8_t cc, int dst){
+    emit8(e, 0x0F); emit8(e, 0x90 | cc); modrm_reg(e, 0, RAX);
+    rex(e, dst, RAX);
+    emit8(e, 0x0F); emit8(e, 0xB6); modrm_reg(e, dst, RAX);
+}
+
+#define CC_B    0x2
+#define CC_E    0x4
+#define CC_NE   0x5
+#define CC_A    0x7
+
+static void load_byte(Emitter* e, int dst, int32_t off){
+    rex(e, dst, 0);
+    emit8(e, 0x0F); emit8(e, 0xB6); modrm_ctx(e, dst, off);
+}
+
+static void load_word(Emitter* e, int dst, int32_t off){
+    rex(e, dst, 0);
+    emit8(e, 0x0F); emit8(e, 0xB7); modrm_ctx(e, dst, off);
+}
+
+// mov [rdi + off], al / ax (only used with rax and rdx)
+static void store_byte(Emitter* e, int src, int32_t off){
+    emit8(e, 0x88); modrm_ctx(e, src, off);
+}
+
+static void store_word(Emitter* e, int src, int32_t off){
+    emit8(e, 0x66); emit8(e, 0x89); modrm_ctx(e, src, off);
+}
+
+static void store_word_imm(Emitter* e, int32_t off, uint16_t imm){
+    emit8(e, 0x66); emit8(e, 0xC7); modrm_ctx(e, 0, off);
+    emit16(e, imm);
+}
+
+// [rdi + rax*2 + off]
+static void modrm_stack(Emitter* e, int reg, int32_t off){
+    emit8(e, 0x84 | ((reg & 7) << 3));
+    emit8(e, 0x47);
+    emit32(e, off);
+}
+
+// ---- guest instructions ----
+
+static int vreg(Emitter* e, int v){
+    return e->host[v];
+}
+
+// Makes sure every V register in `mask` has a host register. Returns false
+// if the block has run out of them.
+static bool alloc_regs(Emitter* e, unsigned mask){
+    int needed = 0;
+
+    for (int v = 0; v < 16; v++)
+    {
+        if ((mask >> v) & 1 && e->host[v] < 0)
+        {
+            needed++;
+        }
+    }
+    if (e->used + needed > POOL_SIZE)
+    {
+        return false;
+    }
+    for (int v = 0; v < 16; v++)
+    {
+        if ((mask >> v) & 1 && e->host[v] < 0)
+        {
+            e->host[v] = pool[e->used++];
+        }
+    }
+    return true;
+}
+
+typedef enum
+{
+    KIND_BODY,                                  // falls through
+    KIND_SKIP,                                  // falls through, exits if taken
+    KIND_END,                                   // sets PC itself
+    KIND_CALL                                   // ends the block in EmulateCycle
+} Kind;
+
+// What an opcode is to the JIT and which V registers it touches
+static Kind classify(uint16_t opcode, unsigned* mask){
+    unsigned x = (opcode >> 8) & 0xF, y = (opcode >> 4) & 0xF, n = opcode & 0xF;
+    unsigned kk = opcode & 0xFF;
+    unsigned X = 1u << x, Y = 1u << y, F = 1u << 0xF;
+
+    *mask = 0;
+    switch (opcode & 0xF000)
+    {
+        case 0x0000:
+            return (kk == 0xEE) ? KIND_END : KIND_CALL;
+        case 0x1000:
+        case 0x2000:
+            return KIND_END;
+        case 0x3000:
+        case 0x4000:
+            *mask = X;
+            return KIND_SKIP;
+        case 0x5000:
+            *mask = X | Y;
+            return KIND_SKIP;
+        case 0x6000:
+        case 0x7000:
+            *mask = X;
+            return KIND_BODY;
+        case 0x8000:
+            switch (n)
+            {
+                case 0x0: case 0x1: case 0x2: case 0x3:
+                    *mask = X | Y;
+                    return KIND_BODY;
+                case 0x4: case 0x5: case 0x6: case 0x7: case 0xE:
+                    *mask = X | Y | F;
+                    return KIND_BODY;
+                default:
+                    return KIND_CALL;
+            }
+        case 0x9000:
+            *mask = n == 0 ? X | Y : 0;
+            return n == 0 ? KIND_SKIP : KIND_CALL;
+        case 0xA000:
+            return KIND_BODY;
+        case 0xB000:
+            *mask = 1;
+            return KIND_END;
+        case 0xE000:
+            *mask = (kk == 0x9E || kk == 0xA1) ? X : 0;
+            return (kk == 0x9E || kk == 0xA1) ? KIND_SKIP : KIND_CALL;
+        case 0xF000:
+            switch (kk)
+            {
+                case 0x07: case 0x15: case 0x18: case 0x29:
+                    *mask = X;
+                    return KIND_BODY;
+                case 0x1E:
+                    *mask = X | F;
+                    return KIND_BODY;
+                default:
+                    return KIND_CALL;
+            }
+        default:
+            return KIND_CALL;
+    }
+}
+
+// Calls, returns and key skips check the stack or Vx and can fault
+static bool can_fault(uint16_t opcode){
+    switch (opcode & 0xF000)
+    {
+        case 0x0000: return (opcode & 0xFF) == 0xEE;
+        case 0x2000: return true;
+        case 0xE000: return (opcode & 0xFF) == 0x9E || (opcode & 0xFF) == 0xA1;
+        default:     return false;
+    }
+}
+
+static void push_pop(Emitter* e, bool push){
+    for (int i = 0; i < e->used; i++)
+    {
+        int r = pool[push ? i : e->used - 1 - i];
+        if (is_callee_saved(r))
+        {
+            rex(e, 0, r);
+            emit8(e, (push ? 0x50 : 0x58) + (r & 7));
+        }
+    }
+}
+
+// Writes the guest registers back, restores ours and returns
+// r11d + `done` cycles to Chip8RunJit
+static void emit_exit(Emitter* e, unsigned done){
+    for (int v = 0; v < 16; v++)
+    {
+        if ((e->all >> v) & 1)
+        {
+            alu_rr(e, MOV, RAX, e->host[v]);
+            store_byte(e, RAX, OFF_V + v);
+        }
+    }
+    push_pop(e, false);
+    alu_rr(e, MOV, RAX, R11);
+    alu_ri(e, 0, RAX, done);
+    emit8(e, 0xC3);
+}
+
+// jcc rel32 with the offset filled in later by patch()
+static uint8_t* jcc(Emitter* e, uint8_t cc){
+    emit8(e, 0x0F); emit8(e, 0x80 | cc);
+    emit32(e, 0);
+    return e->p;
+}
+
+static void patch(uint8_t* after_jump, uint8_t* target){
+    int32_t rel = (int32_t) (target - after_jump);
+    memcpy(after_jump - 4, &rel, 4);
+}
+
+// The way out of a block for an instruction that would fault, shared by all
+// of them and placed ahead of the block's entry. Comes in with PC in ax and
+// the instruction's index + 1 above it. Writes the guest registers back and
+// leaves through EmulateCycle, which runs the instruction from the top and
+// faults the machine. Returns r11d + index + 1 cycles, as if it had run.
+static void emit_fault_stub(Emitter* e){
+    e->fault = e->p;
+    store_word(e, RAX, OFF_PC);
+    shift_ri(e, 5, RAX, 16);
+    alu_rr(e, ADD, R11, RAX);
+    for (int v = 0; v < 16; v++)
+    {
+        if ((e->all >> v) & 1)
+        {
+            alu_rr(e, MOV, RAX, e->host[v]);
+            store_byte(e, RAX, OFF_V + v);
+        }
+    }
+    push_pop(e, false);
+
+    // push r11; mov rax, EmulateCycle; call rax; pop rdx. The push keeps
+    // the cycle count and lines the stack up for the call.
+    uint64_t target = (uint64_t) (uintptr_t) EmulateCycle;
+    emit8(e, 0x41); emit8(e, 0x53);
+    emit8(e, 0x48); emit8(e, 0xB8);
+    emit32(e, (uint32_t) target);
+    emit32(e, (uint32_t) (target >> 32));
+    emit8(e, 0xFF); emit8(e, 0xD0);
+    emit8(e, 0x5A);
+    alu_rr(e, MOV, RAX, RDX);
+    emit8(e, 0xC3);
+}
+
+// mov eax, (index + 1) << 16 | pc; jmp fault stub
+static void emit_fault_exit(Emitter* e, uint16_t pc, unsigned index){
+    mov_ri(e, RAX, (index + 1) << 16 | pc);
+    emit8(e, 0xE9);
+    emit32(e, 0);
+    patch(e->p, e->fault);
+}
+
+// Every sequence below does the same thing in the same order as the matching
+// case in EmulateCycle, including which value of VF is seen when x or y is F.
+// `index` is the instruction's position in the block.
+static void emit_insn(Emitter* e, uint16_t opcode, uint16_t pc, unsigned index){
+    unsigned kk = opcode & 0xFF, nnn = opcode & 0xFFF, n = opcode & 0xF;
+    int x  = vreg(e, (opcode >> 8) & 0xF);
+    int y  = vreg(e, (opcode >> 4) & 0xF);
+    int vf = vreg(e, 0xF);
+    uint8_t cont_cc = 0;
+    uint8_t* jump;
+
+    switch (opcode & 0xF000)
+    {
+        case 0x0000:                            // 00EE
+            load_word(e, RAX, OFF_SP);
+            alu_ri(e, 7, RAX, 0);
+            jump = jcc(e, CC_NE);
+            emit_fault_exit(e, pc, index);
+            patch(jump, e->p);
+            load_word(e, RAX, OFF_SP);
+            alu_ri(e, 5, RAX, 1);
+            store_word(e, RAX, OFF_SP);
+            load_word(e, RAX, OFF_SP);
+            emit8(e, 0x0F); emit8(e, 0xB7); modrm_stack(e, RDX, OFF_STACK);
+            store_word(e, RDX, OFF_PC);
+            break;
+        case 0x1000:
+            store_word_imm(e, OFF_PC, nnn);
+            break;
+        case 0x2000:
+            load_word(e, RAX, OFF_SP);
+            alu_ri(e, 7, RAX, STACK_SIZE);
+            jump = jcc(e, CC_B);
+            emit_fault_exit(e, pc, index);
+            patch(jump, e->p);
+            emit8(e, 0x66); emit8(e, 0xC7); modrm_stack(e, 0, OFF_STACK);
+            emit16(e, pc + 2);
+            alu_ri(e, 0, RAX, 1);
+            store_word(e, RAX, OFF_SP);
+            store_word_imm(e, OFF_PC, nnn);
+            break;
+        case 0x3000:
+            alu_ri(e, 7, x, kk);
+            cont_cc = CC_NE;
+            break;
+        case 0x4000:
+            alu_ri(e, 7, x, kk);
+            cont_cc = CC_E;
+            break;
+        case 0x5000:
+            alu_rr(e, CMP, x, y);
+            cont_cc = CC_NE;
+            break;
+        case 0x9000:
+            alu_rr(e, CMP, x, y);
+            cont_cc = CC_E;
+            break;
+        case 0x6000:
+            mov_ri(e, x, kk);
+            break;
+        case 0x7000:
+            alu_ri(e, 0, x, kk);
+            alu_ri(e, 4, x, 0xFF);
+            break;
+        case 0x8000:
+            switch (n)
+            {
+                case 0x0: alu_rr(e, MOV, x, y); break;
+                case 0x1: alu_rr(e, OR,  x, y); break;
+                case 0x2: alu_rr(e, AND, x, y); break;
+                case 0x3: alu_rr(e, XOR, x, y); break;
+                case 0x4:
+                    alu_rr(e, MOV, RAX, x);
+                    alu_rr(e, ADD, RAX, y);
+                    shift_ri(e, 5, RAX, 8);
+                    alu_rr(e, MOV, vf, RAX);
+                    alu_rr(e, ADD, x, y);
+                    alu_ri(e, 4, x, 0xFF);
+                    break;
+                case 0x5:
+                    alu_rr(e, CMP, x, y);
+                    setcc_zx(e, CC_A, RAX);
+                    alu_rr(e, MOV, vf, RAX);
+                    alu_rr(e, SUB, x, y);
+                    alu_ri(e, 4, x, 0xFF);
+                    break;
+                case 0x6:
+                    alu_rr(e, MOV, RAX, x);
+                    alu_ri(e, 4, RAX, 1);
+                    alu_rr(e, MOV, vf, RAX);
+                    shift_ri(e, 5, x, 1);
+                    break;
+                case 0x7:
+                    alu_rr(e, CMP, y, x);
+                    setcc_zx(e, CC_A, RAX);
+                    alu_rr(e, MOV, vf, RAX);
+                    alu_rr(e, MOV, RAX, y);
+                    alu_rr(e, SUB, RAX, x);
+                    alu_ri(e, 4, RAX, 0xFF);
+                    alu_rr(e, MOV, x, RAX);
+                    break;
+                case 0xE:
+                    alu_rr(e, MOV, RAX, x);
+                    shift_ri(e, 5, RAX, 7);
+                    alu_rr(e, MOV, vf, RAX);
+                    shift_ri(e, 4, x, 1);
+                    alu_ri(e, 4, x, 0xFF);
+                    break;
+            }
+            break;
+        case 0xA000:
+            store_word_imm(e, OFF_I, nnn);
+            break;
+        case 0xB000:
+            alu_rr(e, MOV, RAX, vreg(e, 0));
+            alu_ri(e, 0, RAX, nnn);
+            alu_ri(e, 4, RAX, MEM_MASK);
+            store_word(e, RAX, OFF_PC);
+            break;
+        case 0xE000:
+            alu_ri(e, 7, x, KEYPAD_SIZE);
+            jump = jcc(e, CC_B);
+            emit_fault_exit(e, pc, index);
+            patch(jump, e->p);
+
+            // cmp byte [rdi + Vx + key], 0
+            if (x >= 8)
+            {
+                emit8(e, 0x42);
+            }
+            emit8(e, 0x80);
+            emit8(e, 0x80 | (7 << 3) | 0x04);
+            emit8(e, ((x & 7) << 3) | RDI);
+            emit32(e, OFF_KEY);
+            emit8(e, 0);
+            cont_cc = (kk == 0x9E) ? CC_E : CC_NE;
+            break;
+        case 0xF000:
+            switch (kk)
+            {
+                case 0x07:
+                    load_byte(e, x, OFF_DT);
+                    break;
+                case 0x15:
+                    alu_rr(e, MOV, RAX, x);
+                    store_byte(e, RAX, OFF_DT);
+                    break;
+                case 0x18:
+                    alu_rr(e, MOV, RAX, x);
+                    store_byte(e, RAX, OFF_ST);
+                    break;
+                case 0x1E:
+                    load_word(e, RAX, OFF_I);
+                    alu_rr(e, ADD, RAX, x);
+                    alu_ri(e, 7, RAX, 0xFFF);
+                    setcc_zx(e, CC_A, RDX);
+                    alu_rr(e, MOV, vf, RDX);
+                    load_word(e, RAX, OFF_I);
+                    alu_rr(e, ADD, RAX, x);
+                    store_word(e, RAX, OFF_I);
+                    break;
+                case 0x29:
+                    alu_rr(e, MOV, RAX, x);
+                    shift_ri(e, 4, RAX, 2);
+                    alu_rr(e, ADD, RAX, x);
+                    store_word(e, RAX, OFF_I);
+                    break;
+            }
+            break;
+    }
+
+    if (cont_cc)
+    {
+        // Skip taken: leave the block at pc + 4. Not taken: carry on.
+        jump = jcc(e, cont_cc);
+        store_word_imm(e, OFF_PC, pc + 4);
+        store_word_imm(e, OFF_OPCODE, opcode);
+        emit_exit(e, index + 1);
+        patch(jump, e->p);
+    }
+}
+
+static void flush(struct Chip8Jit* jit){
+    jit->code_used  = 0;
+    jit->num_blocks = 0;
+    memset(jit->block_of, 0, sizeof(jit->block_of));
+    memset(jit->page_has_code, 0, sizeof(jit->page_has_code));
+}
+
+static Chip8Block* new_block(struct Chip8Jit* jit, uint16_t start){
+    Chip8Block* b = &jit->blocks[++jit->num_blocks];
+
+    memset(b, 0, sizeof(*b));
+    b->start = start;
+    jit->block_of[start - JIT_BASE] = jit->num_blocks;
+    return b;
+}
+
+static Chip8Block* translate(CHIP8* chip8, uint16_t start){
+    struct Chip8Jit* jit = chip8->jit;
+    uint16_t opcodes[JIT_MAX_BLOCK];
+    unsigned mask;
+    int count = 0, faults = 0;
+    Kind last = KIND_BODY;
+    Emitter e;
+    Chip8Block* b;
+
+    // Work out how far the block goes and which V registers it needs
+    memset(e.host, -1, sizeof(e.host));
+    e.used = 0;
+    e.all  = 0;
+    // Blocks stop short of the guard slots, so no PC they store can wrap
+    for (unsigned pc = start; count < JIT_MAX_BLOCK && pc < MEM_PC_GUARD; pc += 2)
+    {
+        uint16_t opcode = fetch_opcode(chip8, pc);
+        Kind kind = classify(opcode, &mask);
+
+        if (!alloc_regs(&e, mask))
+        {
+            break;
+        }
+        e.all |= mask;
+        opcodes[count++] = opcode;
+        faults += can_fault(opcode);
+        if (kind == KIND_END || kind == KIND_CALL)
+        {
+            last = kind;
+            break;
+        }
+    }
+
+    // Make room first so nothing below has to worry about running out
+    if (jit->num_blocks >= JIT_MAX_BLOCKS ||
+        jit->code_used + count * MAX_INSN_BYTES + (faults ? EXIT_BYTES : 0) + faults * FAULT_BYTES +
+        MAX_EDGE_BYTES > JIT_CODE_SIZE)
+    {
+        flush(jit);
+    }
+
+    e.p = jit->code + jit->code_used;
+    e.fault = NULL;
+    if (faults)
+    {
+        emit_fault_stub(&e);
+    }
+    b = new_block(jit, start);
+    b->code  = (Chip8BlockFn) (uintptr_t) e.p;
+    b->count = count;
+    b->bytes = 2 * count;
+    b->back  = ((opcodes[count - 1] & 0xF000) == 0x1000 &&
+                (opcodes[count - 1] & 0x0FFF) <= start + 2 * (count - 1)) ? opcodes[count - 1] & 0x0FFF : 0;
+
+    // Prologue: save what we clobber and pull the guest registers in
+    push_pop(&e, true);
+    for (int v = 0; v < 16; v++)
+    {
+        if ((e.all >> v) & 1)
+        {
+            load_byte(&e, e.host[v], OFF_V + v);
+        }
+    }
+    alu_rr(&e, XOR, R11, R11);
+    e.loop = e.p;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (i == count - 1 && last == KIND_CALL)
+        {
+            break;
+        }
+        emit_insn(&e, opcodes[i], start + 2 * i, i);
+    }
+
+    if (last == KIND_CALL)
+    {
+        // Leave the last instruction to the interpreter. PC points at it and
+        // EmulateCycle sets opcode itself.
+        store_word_imm(&e, OFF_PC, start + 2 * (count - 1));
+        for (int v = 0; v < 16; v++)
+        {
+            if ((e.all >> v) & 1)
+            {
+                alu_rr(&e, MOV, RAX, e.host[v]);
+                store_byte(&e, RAX, OFF_V + v);
+            }
+        }
+        push_pop(&e, false);
+
+        // sub rsp, 8; mov rax, EmulateCycle; call rax; add rsp, 8
+        uint64_t target = (uint64_t) (uintptr_t) EmulateCycle;
+        emit8(&e, 0x48); emit8(&e, 0x83); emit8(&e, 0xEC); emit8(&e, 0x08);
+        emit8(&e, 0x48); emit8(&e, 0xB8);
+        emit32(&e, (uint32_t) target);
+        emit32(&e, (uint32_t) (target >> 32));
+        emit8(&e, 0xFF); emit8(&e, 0xD0);
+        emit8(&e, 0x48); emit8(&e, 0x83); emit8(&e, 0xC4); emit8(&e, 0x08);
+        mov_ri(&e, RAX, count);
+        emit8(&e, 0xC3);
+    }
+    else
+    {
+        uint16_t final = opcodes[count - 1];
+
+        if (last == KIND_BODY)
+        {
+            store_word_imm(&e, OFF_PC, start + 2 * count);
+        }
+        store_word_imm(&e, OFF_OPCODE, final);
+
+        if ((final & 0xF000) == 0x1000 && (final & 0x0FFF) == start)
+        {
+            // The block jumps back to itself, which is what busy loops look
+            // like. Go round again natively while the budget has room for a
+            // whole trip: r11d += count; if (r11d + count <= esi) loop.
+            alu_ri(&e, 0, R11, count);
+            alu_rr(&e, MOV, RAX, R11);
+            alu_ri(&e, 0, RAX, count);
+            alu_rr(&e, CMP, RAX, RSI);
+            uint8_t* out = jcc(&e, CC_A);
+            emit8(&e, 0xE9);
+            emit32(&e, 0);
+            patch(e.p, e.loop);
+            patch(out, e.p);
+            emit_exit(&e, 0);
+        }
+        else
+        {
+            emit_exit(&e, count);
+        }
+    }
+
+    jit->code_used = e.p - jit->code;
+    for (unsigned a = start; a < (unsigned) start + b->bytes; a += JIT_GUEST_PAGE)
+    {
+        jit->page_has_code[a / JIT_GUEST_PAGE] = 1;
+    }
+    jit->page_has_code[(start + b->bytes - 1) / JIT_GUEST_PAGE] = 1;
+    return b;
+}
+
+void Chip8JitInvalidate(CHIP8* chip8, unsigned addr, unsigned len){
+    struct Chip8Jit* jit = chip8->jit;
+    unsigned end = addr + len, first, page;
+    bool touched = false;
+
+    if (len == 0 || addr >= MEM_SIZE)
+    {
+        return;
+    }
+    if (end > MEM_SIZE)
+    {
+        end = MEM_SIZE;
+    }
+
+    // Cheap way out for the common case of writes into plain data
+    for (page = addr / JIT_GUEST_PAGE; page <= (end - 1) / JIT_GUEST_PAGE; page++)
+    {
+        touched |= jit->page_has_code[page];
+    }
+    if (!touched)
+    {
+        return;
+    }
+
+    // A block that overlaps the write starts at most JIT_MAX_BLOCK
+    // instructions before it
+    first = addr > JIT_BASE + 2 * JIT_MAX_BLOCK ? addr - 2 * JIT_MAX_BLOCK : JIT_BASE;
+    for (unsigned a = first; a < end; a++)
+    {
+        uint16_t* slot = &jit->block_of[a - JIT_BASE];
+        if (*slot && a + jit->blocks[*slot].bytes > addr)
+        {
+            *slot = 0;
+        }
+    }
+}
+
+void Chip8EnableJit(CHIP8* chip8){
+    struct Chip8Jit* jit;
+
+    if (chip8->jit != NULL)
+    {
+        return;
+    }
+
+    jit = malloc(sizeof(struct Chip8Jit));
+    if (jit == NULL)
+    {
+        return;
+    }
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED)
+    {
+        // No executable memory (W^X policy or similar), stay interpreted
+        free(jit);
+        return;
+    }
+    flush(jit);
+    chip8->jit = jit;
+}
+
+void Chip8DisableJit(CHIP8* chip8){
+    if (chip8->jit == NULL)
+    {
+        return;
+    }
+    munmap(chip8->jit->code, JIT_CODE_SIZE);
+    free(chip8->jit);
+    chip8->jit = NULL;
+}
+
+void Chip8RunJit(CHIP8* chip8, uint32_t cycles){
+    struct Chip8Jit* jit = chip8->jit;
+
+    while (cycles)
+    {
+        unsigned offset = (unsigned) chip8->PC - JIT_BASE;
+        Chip8Block* b;
+
+        // Below 0x200 and the guard slots at the top run interpreted
+        if (offset >= MEM_PC_GUARD - JIT_BASE)
+        {
+            EmulateCycle(chip8);
+            cycles--;
+        }
+        else
+        {
+            uint16_t index = jit->block_of[offset];
+            uint32_t budget = cycles;
+            b = index ? &jit->blocks[index] : translate(chip8, chip8->PC);
+
+            // Look for an idle loop before going into a block that jumps to
+            // its own start, which would otherwise spin natively through the
+            // budget
+            if (b->back == b->start)
+            {
+                uint32_t used = Chip8SkipIdle(chip8, cycles);
+
+                if (used > 0)
+                {
+                    cycles -= used;
+                    continue;
+                }
+
+                // Busy for now. Go round natively only as many times as the
+                // backoff has jumps left, so the loop is looked at again
+                // after as many trips as in the other cores.
+                uint32_t trips = Chip8IdleBackoff(chip8, b->start) + 1;
+                if (trips < cycles / b->count)
+                {
+                    budget = trips * b->count;
+                }
+            }
+
+            // Blocks run whole, so near the end of the budget step instead
+            if (b->count > cycles)
+            {
+                EmulateCycle(chip8);
+                cycles--;
+            }
+            else
+            {
+                // The block may flush the cache on the way, keep what's needed
+                uint16_t back = b->back != b->start ? b->back : 0;
+                uint16_t self = b->back == b->start ? b->start : 0;
+                uint32_t count = b->count, ran = b->code(chip8, budget);
+
+                // Every trip after the first was a jump back the backoff
+                // didn't see
+                cycles -= ran;
+                if (self != 0 && ran > count)
+                {
+                    Chip8IdleLetBy(chip8, self, ran / count - 1);
+                }
+
+                // A loop of several blocks is looked at after its jump back,
+                // with PC on the loop's start, as the interpreters do. Going
+                // in with PC on the jump would cut the loop into new blocks.
+                if (back != 0 && chip8->PC == back && !chip8->waiting)
+                {
+                    cycles -= Chip8SkipIdle(chip8, cycles);
+                }
+            }
+        }
+
+        // Fx0A and faults always leave a block through EmulateCycle, so a
+        // halt can only show up here between blocks
+        if (chip8->waiting)
+        {
+            return;
+        }
+    }
+}
+
+#else
+
+// Not an x86-64 host: the JIT never switches on and Chip8Run interprets
+
+void Chip8EnableJit(CHIP8* chip8){
+    (void) chip8;
+}
+
+void Chip8DisableJit(CHIP8* chip8){
+    (void) chip8;
+}
+
+void Chip8RunJit(CHIP8* chip8, uint32_t cycles){
+    while (cycles-- && !chip8->waiting)
+    {
+        EmulateCycle(chip8);
+    }
+}
+
+void Chip8JitInvalidate(CHIP8* chip8, unsigned addr, unsigned len){
+    (void) chip8; (void) addr; (void) len;
+}
+
+#endif
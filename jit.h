@@ -0,0 +1,46 @@
+// x86-64 basic block JIT. A block starts at the PC and runs straight through
+// register, timer, I and skip opcodes until a jump, call or return, which it
+// translates too. A taken skip leaves the block early. Anything else (Dxyn,
+// Cxkk, memory ops, Fx0A, ...) also ends the block, which then calls
+// EmulateCycle to run it. V0-VF live in host registers for the length of a
+// block.
+
+#ifndef CHIP_8_JIT
+#define CHIP_8_JIT
+
+#include "chip8.h"
+
+#define JIT_BASE            0x200
+#define JIT_ENTRIES         (MEM_SIZE - JIT_BASE)  // blocks can start at odd addresses too
+#define JIT_MAX_BLOCKS      1024
+#define JIT_CODE_SIZE       (64 * 1024)
+#define JIT_MAX_BLOCK       32                  // instructions per block
+#define JIT_GUEST_PAGE      256                 // invalidation granularity
+
+// Runs the block, possibly several times over if it loops back to its own
+// start, without going past `budget` instructions. Returns how many ran.
+typedef uint32_t (*Chip8BlockFn)(CHIP8* chip8, uint32_t budget);
+
+typedef struct
+{
+    Chip8BlockFn    code;
+    uint16_t        start;                      // guest address
+    uint16_t        bytes;                      // guest bytes covered
+    uint16_t        count;                      // instructions
+    uint16_t        back;                       // target of a jump back it ends in, may be an idle loop; 0 = none
+} Chip8Block;
+
+struct Chip8Jit
+{
+    uint8_t*        code;                       // RWX buffer, bump allocated
+    size_t          code_used;
+    uint16_t        block_of[JIT_ENTRIES];      // index into blocks, 0 = none
+    uint16_t        num_blocks;
+    uint8_t         page_has_code[MEM_SIZE / JIT_GUEST_PAGE];
+    Chip8Block      blocks[JIT_MAX_BLOCKS + 1]; // blocks[0] is unused
+};
+
+void Chip8RunJit(CHIP8* chip8, uint32_t cycles);
+void Chip8JitInvalidate(CHIP8* chip8, unsigned addr, unsigned len);
+
+#endif
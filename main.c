@@ -1,39 +1,102 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "chip8.h"
+#include "scaler.h"
+#include "savestate.h"
+#include "rewind.h"
+#include "inputlog.h"
+#include "stats.h"
+#include "trace.h"
 
 #include<GL/gl.h>
 #include<GL/glu.h>
 #include<GL/glext.h>
 #include<GL/glut.h>
 
-#include<sys/time.h>
+#include<unistd.h>
 
-#define PIXEL_SIZE 10
+#define DEFAULT_SCALE 10
 
 #define CLOCK_HZ 60
-#define CLOCK_RATE_MS ((int) ((1.0/ CLOCK_HZ)*1000 + 0.5))
+#define FRAME_NS (1000000000L / CLOCK_HZ)
 
-#define BLACK 0
-#define WHITE 255
+#define DEFAULT_IPS 600                 // instructions per second
+#define UNLIMITED_SLICE 10000           // instructions between clock checks at -r 0
+#define DEFAULT_REWIND_MB 4
 
-#define SCREEN_ROWS (GFX_ROWS * PIXEL_SIZE)
-#define SCREEN_COLS (GFX_COLS * PIXEL_SIZE)
+#define KEY_BACKSPACE 8
 
-unsigned char screen[SCREEN_ROWS][SCREEN_COLS][3];
+#define BLACK 0
+#define WHITE 255
 
-extern uint8_t key[KEYPAD_SIZE];
-extern uint8_t gfx[GFX_ROWS][GFX_COLS];
-extern bool chip8_draw_flag;
+// Window-sized RGB image of the display, rebuilt on every resize
+Chip8Scaler scaler;
+Chip8Filter filter = SCALER_NEAREST;
+
+// The scaler's image lives in this texture too, so a frame only uploads the
+// rows that changed and the window is redrawn from the texture
+GLuint screen_tex;
+
+// The GLUT frontend drives a single machine
+CHIP8 chip8;
+
+// Emulation runs in 60 Hz frames: a batch of instructions, one Tick, one
+// draw, then sleep until the frame is due to end
+long ips = DEFAULT_IPS;                 // 0 = as fast as the host goes
+uint64_t frame_no;
+struct timespec deadline;               // end of the current frame
+bool parked;                            // halted in Fx0A or by a fault, loop is off until a key
+bool fault_reported;                    // the machine's fault has been printed
+char* state_path;                       // F5 saves here, F9 loads, "<game>.state"
+char* trace_path;                       // F3 and faults dump the trace here, "<game>.trace"
+uint32_t trace_records;                 // -t, 0 = not tracing from the start
+
+// Every frame goes into the rewind ring. Holding Backspace plays it backwards.
+Chip8Rewind history;
+long rewind_mb = DEFAULT_REWIND_MB;     // 0 = off
+bool rewinding;
+uint32_t rewind_steps;                  // frames stepped back while Backspace was held
+double rewind_us;                       // time those steps took
+
+// -w records every key and Tick into input_log, -p plays one back instead
+// of taking keys from the keyboard. Either way the run can be repeated.
+Chip8InputLog input_log;
+const char* record_path;
+bool recording;
+bool replaying;
+
+// Instructions to run in frame f. ips is spread over the frames of each
+// second so the total comes out exact, and it only depends on f, never on
+// how late a frame ran, so a run does the same thing on any host.
+uint32_t frame_cycles(uint64_t f){
+    return (uint32_t) ((f + 1) * ips / CLOCK_HZ - f * ips / CLOCK_HZ);
+}
 
-struct timeval clock_prev;
+void add_ns(struct timespec *t, long ns){
+    t->tv_nsec += ns;
+    while (t->tv_nsec >= 1000000000L)
+    {
+        t->tv_nsec -= 1000000000L;
+        t->tv_sec++;
+    }
+}
 
-int timediff_ms(struct timeval *end, struct timeval *start){
-    int diff = (end->tv_sec - start->tv_sec)*1000 + (end->tv_usec - start->tv_usec)/1000;
-    return diff;
+bool before(const struct timespec *a, const struct timespec *b){
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
 }
 
 void gfx_setup(){
-    memset(screen, BLACK, sizeof(unsigned char) * SCREEN_ROWS * SCREEN_COLS * 3);
+    scaler.colors[0] = BLACK;
+    scaler.colors[1] = WHITE;
     glClear(GL_COLOR_BUFFER_BIT);
+
+    // Sized in reshape_window, which GLUT calls before the first draw
+    glGenTextures(1, &screen_tex);
+    glBindTexture(GL_TEXTURE_2D, screen_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glEnable(GL_TEXTURE_2D);
 }
 
 int keymap(unsigned char k) {
@@ -62,96 +125,472 @@ int keymap(unsigned char k) {
     }
 }
 
+// Every Tick and key change goes through these, so the input log sees them
+void tick(){
+    if (recording)
+    {
+        Chip8LogTick(&input_log, &chip8);
+    }
+    Tick(&chip8);
+}
+
+void set_key(int index, bool down){
+    if (recording && chip8.key[index] != down)
+    {
+        Chip8LogKey(&input_log, &chip8, (uint8_t) index, down);
+    }
+    chip8.key[index] = down;
+}
+
+void save_log(){
+    if (recording)
+    {
+        Chip8LogSave(&input_log, record_path);
+    }
+}
+
+// One frame of rewind, run instead of the machine while Backspace is held
+void rewind_frame(){
+    uint8_t keys[KEYPAD_SIZE];
+    struct timespec t0, t1;
+
+    // Keep the keys that are down now, not the ones from back then
+    memcpy(keys, chip8.key, sizeof(keys));
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (Chip8RewindStep(&history, &chip8))
+    {
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        rewind_steps++;
+        rewind_us += (t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3;
+
+        // The log goes back in time with the machine
+        if (recording)
+        {
+            Chip8LogTruncate(&input_log, &chip8);
+        }
+    }
+    for (int k = 0; k < KEYPAD_SIZE; k++)
+    {
+        set_key(k, keys[k]);
+    }
+}
+
+void rewind_report(){
+    double per_frame = history.frames ? (double) history.used / history.frames : 0;
+
+    fprintf(stderr, "Rewound %u frames, %.2f us each. %u frames (%.1f s) left in %zu KB, "
+            "%.0f KB per minute recorded.\n",
+            rewind_steps, rewind_steps ? rewind_us / rewind_steps : 0.0,
+            history.frames, history.frames / (double) CLOCK_HZ, history.used / 1024,
+            per_frame * CLOCK_HZ * 60 / 1024);
+}
+
+void loop();
+
+// Starts the frame loop again after the machine was parked in Fx0A. The
+// timers kept running in real time while it slept, so catch them up.
+void unpark(){
+    struct timespec now;
+    uint64_t frames = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    while (before(&deadline, &now) && frames < UINT8_MAX)
+    {
+        add_ns(&deadline, FRAME_NS);
+        frames++;
+    }
+    for (uint64_t f = 0; f < frames; f++)
+    {
+        tick();
+    }
+    frame_no += frames;
+    deadline = now;
+
+    parked = false;
+    glutIdleFunc(loop);
+}
+
 void keypress(unsigned char k, int x, int y){
     (void) x; (void) y;
 
+    if (replaying)
+    {
+        return;                         // the log has the keys
+    }
+    if (k == KEY_BACKSPACE && history.ring != NULL)
+    {
+        rewinding = true;
+        rewind_steps = 0;
+        rewind_us = 0;
+        if (parked)
+        {
+            unpark();
+        }
+        return;
+    }
+
     int index = keymap(k);
     if(index >= 0){
-        key[index] = 1;
+        set_key(index, true);
+        if (parked)
+        {
+            unpark();
+        }
     }
 }
 
 void keyrelease(unsigned char k, int x, int y){
     (void) x; (void) y;
 
+    if (replaying)
+    {
+        return;
+    }
+    if (k == KEY_BACKSPACE && rewinding)
+    {
+        rewind_report();
+        rewinding = false;
+        return;
+    }
+
     int index = keymap(k);
     if(index >= 0){
-        key[index] = 0;
+        set_key(index, false);
     }
 }
 
-void paint_pixel(int row, int col, unsigned char color){
-    row = SCREEN_ROWS - 1 - row;
-    screen[row][col][0] = screen[row][col][1] = screen[row][col][2] = color;
-}
+void special_key(int k, int x, int y){
+    (void) x; (void) y;
 
-void paint_cell(int row, int col, unsigned char color) {
-    int pixel_row = row * PIXEL_SIZE;
-    int pixel_col = col * PIXEL_SIZE;
-    int drow, dcol;
+    if (k == GLUT_KEY_F2)
+    {
+        // Counters on, or off with a report of what they saw
+        if (chip8.stats == NULL)
+        {
+            Chip8EnableStats(&chip8);
+            fprintf(stderr, "Counting instructions, F2 again for the report\n");
+        }
+        else
+        {
+            Chip8StatsReport(&chip8, stderr, STATS_DEFAULT_TOP);
+            Chip8DisableStats(&chip8);
+        }
+    }
+    else if (k == GLUT_KEY_F3)
+    {
+        // Dump what the trace holds, or start one
+        if (chip8.trace == NULL)
+        {
+            Chip8EnableTrace(&chip8, TRACE_DEFAULT_RECORDS, trace_path);
+            fprintf(stderr, "Tracing, F3 again to write it to %s\n", trace_path);
+        }
+        else
+        {
+            Chip8TraceDump(&chip8, trace_path);
+        }
+    }
+    else if (k == GLUT_KEY_F5)
+    {
+        Chip8SaveStateFile(&chip8, state_path);
+    }
+    else if (k == GLUT_KEY_F9 && Chip8LoadStateFile(&chip8, state_path))
+    {
+        // A state from who knows where can't be reached by replaying a log
+        if (recording)
+        {
+            fprintf(stderr, "Loaded a state, the input log ends here\n");
+            save_log();
+            recording = false;
+        }
+        replaying = false;
 
-    for (drow = 0; drow < PIXEL_SIZE; drow++) {
-        for (dcol = 0; dcol < PIXEL_SIZE; dcol++) {
-            paint_pixel(pixel_row + drow, pixel_col + dcol, color);
+        if (parked)
+        {
+            // Run a frame to draw it, and to park again if it is waiting too
+            unpark();
         }
     }
 }
 
-void draw(){
-    int row, col;
+// Rescales the rows marked dirty since the last frame and uploads each run
+// of them to the texture
+void update_screen(){
+    uint32_t dirty = Chip8ScalerAffected(&scaler, chip8.dirty_rows);
+    int row, first, line, count;
 
-    glClear(GL_COLOR_BUFFER_BIT);
+    chip8.dirty_rows = 0;
 
     for (row = 0; row < GFX_ROWS; row++)
     {
-        for (col = 0; col < GFX_COLS; col++)
+        if (!(dirty & (1u << row)))
         {
-            paint_cell(row, col, gfx[row][col] ? WHITE : BLACK);
+            continue;
         }
+
+        first = row;
+        while (row < GFX_ROWS && (dirty & (1u << row)))
+        {
+            row++;
+        }
+
+        Chip8ScalerRender(&scaler, chip8.fb, first, row, &line, &count);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, line, scaler.width, count, GL_RGB, GL_UNSIGNED_BYTE,
+                        (void *) (scaler.rgb + (size_t) line * scaler.width * 3));
     }
-    
-    glDrawPixels(SCREEN_COLS, SCREEN_ROWS, GL_RGB, GL_UNSIGNED_BYTE, (void *) screen);
+}
+
+void draw(){
+    if (scaler.rgb == NULL)
+    {
+        return;
+    }
+    update_screen();
+
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    glBegin(GL_QUADS);
+        glTexCoord2f(0, 0); glVertex2f(-1, -1);
+        glTexCoord2f(1, 0); glVertex2f( 1, -1);
+        glTexCoord2f(1, 1); glVertex2f( 1,  1);
+        glTexCoord2f(0, 1); glVertex2f(-1,  1);
+    glEnd();
 
     glutSwapBuffers();
 }
 
+// Runs instructions live, or from the input log while replaying
+void run_cycles(uint32_t cycles){
+    if (!replaying)
+    {
+        Chip8Run(&chip8, cycles);
+    }
+    else if (!Chip8LogReplay(&input_log, &chip8, cycles))
+    {
+        fprintf(stderr, "Replay finished at instruction %llu, the keyboard is live again\n",
+                (unsigned long long) chip8.cycles);
+        replaying = false;
+    }
+
+    // The machine stays halted on the bad instruction. Say so once; a rewind
+    // or a loaded state gets it going again.
+    if (chip8.fault != CHIP8_OK && !fault_reported)
+    {
+        fprintf(stderr, "%s at 0x%03x, opcode %04x. Rewind or load a state to go on.\n",
+                Chip8FaultName(chip8.fault), chip8.PC, chip8.opcode);
+    }
+    fault_reported = chip8.fault != CHIP8_OK;
+}
+
+void run_frame(){
+    struct timespec now;
+
+    if (ips > 0)
+    {
+        run_cycles(frame_cycles(frame_no));
+        return;
+    }
+
+    // Unlimited: keep running until this frame's time is used up, leaving
+    // the rest of the frame for drawing
+    do
+    {
+        uint64_t skipped = chip8.idle_skipped;
+
+        run_cycles(UNLIMITED_SLICE);
+        if (chip8.idle_skipped != skipped && !replaying)
+        {
+            // Sitting in an idle loop, which only a Tick or a key can
+            // get it out of. Sleep off the rest of the frame.
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    } while (before(&now, &deadline) && (!chip8.waiting || replaying));
+}
+
 void loop(){
-    struct timeval clock_now;
-    gettimeofday(&clock_now, NULL);
+    struct timespec now;
 
-    EmulateCycle();
+    add_ns(&deadline, FRAME_NS);
 
-    if (chip8_draw_flag)
+    if (rewinding)
+    {
+        rewind_frame();
+    }
+    else
+    {
+        // A replay ticks the timers itself, where the log says
+        bool replayed = replaying;
+
+        run_frame();
+        if (!replayed)
+        {
+            tick();
+        }
+        frame_no++;
+        if (history.ring != NULL)
+        {
+            Chip8RewindPush(&history, &chip8);
+        }
+    }
+
+    if (chip8.draw_flag)
     {
         draw();
-        chip8_draw_flag = false;
+        chip8.draw_flag = false;
     }
 
-    if (timediff_ms(&clock_now, &clock_prev) >= CLOCK_RATE_MS) {
-        Tick();
-        clock_prev = clock_now;
+    if (chip8.waiting && !rewinding && !replaying)
+    {
+        // Nothing to run until a key goes down. Take the loop off the idle
+        // callback so GLUT blocks in its event wait; keypress puts it back.
+        // deadline stays at the end of this frame for unpark to count from.
+        parked = true;
+        glutIdleFunc(NULL);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (before(&now, &deadline))
+    {
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    }
+    else
+    {
+        // Running late (window drag, slow host, unlimited mode). Start the
+        // next frame from now instead of racing to catch up.
+        deadline = now;
     }
-    
 }
 
+// The scaler renders at window size, so the texture maps 1:1 onto the window
 void reshape_window(GLsizei w, GLsizei h) {
-    (void) w; (void) h;
+    glViewport(0, 0, w, h);
+
+    if (!Chip8ScalerResize(&scaler, w, h, filter))
+    {
+        fprintf(stderr, "Out of memory for a %dx%d window\n", (int) w, (int) h);
+        exit(1);
+    }
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+
+    chip8.dirty_rows = ~0u;
+    chip8.draw_flag = true;
 }
 
-int main(int argc, char const *argv[])
+void usage(){
+    fprintf(stderr,
+        "Usage: ./chip8_emulator [options] <game>\n"
+        "  -s <scale>     window pixels per CHIP-8 pixel, fractions allowed (default %d)\n"
+        "  -F <filter>    nearest or scale2x (default nearest)\n"
+        "  -r <hz>        instructions per second, 0 = unlimited (default %d)\n"
+        "  -R <MB>        rewind buffer size, 0 = off (default %d)\n"
+        "  -S <seed>      seed for the random numbers (default: the time)\n"
+        "  -w <log>       record keys and timer ticks to an input log\n"
+        "  -p <log>       play an input log back, the seed comes from the log\n"
+        "  -t <records>   trace the last this many instructions from the start\n"
+        "F2 starts counting instructions, and F2 again prints where they went.\n"
+        "F3 starts a trace, and F3 again writes it to <game>.trace.\n"
+        "F5 saves the machine to <game>.state and F9 loads it back.\n"
+        "Hold Backspace to rewind.\n",
+        DEFAULT_SCALE, DEFAULT_IPS, DEFAULT_REWIND_MB);
+    exit(2);
+}
+
+int main(int argc, char *argv[])
 {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: ./play <game>\n");
+    double scale = DEFAULT_SCALE;
+    uint32_t seed = (uint32_t) time(NULL);
+    const char* replay_path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:F:r:R:S:w:p:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 's': scale = atof(optarg); break;
+            case 'r': ips = atol(optarg); break;
+            case 'R': rewind_mb = atol(optarg); break;
+            case 'S': seed = (uint32_t) strtoul(optarg, NULL, 0); break;
+            case 'w': record_path = optarg; break;
+            case 'p': replay_path = optarg; break;
+            case 't': trace_records = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'F':
+                if (strcmp(optarg, "nearest") == 0)
+                {
+                    filter = SCALER_NEAREST;
+                }
+                else if (strcmp(optarg, "scale2x") == 0)
+                {
+                    filter = SCALER_SCALE2X;
+                }
+                else
+                {
+                    usage();
+                }
+                break;
+            default: usage();
+        }
+    }
+    if (optind != argc - 1 || scale < 0.1 || scale > 100 || ips < 0 ||
+        rewind_mb < 0 || rewind_mb > 4096 || (record_path != NULL && replay_path != NULL))
+    {
+        usage();
+    }
+
+    if (replay_path != NULL)
+    {
+        if (!Chip8LogLoad(&input_log, replay_path))
+        {
+            exit(2);
+        }
+        seed = input_log.seed;
+        replaying = true;
+    }
+    else if (record_path != NULL)
+    {
+        Chip8LogInit(&input_log, seed);
+        recording = true;
+        atexit(save_log);
+    }
+
+    InitializeChip8(&chip8);
+    Chip8Seed(&chip8, seed);
+    if (!LoadGame(&chip8, argv[optind]))
+    {
         exit(2);
     }
+    Chip8EnablePredecode(&chip8);
+    Chip8EnableJit(&chip8);
 
-    InitializeChip8();
-    LoadGame(argv[1]);
+    state_path = malloc(strlen(argv[optind]) + sizeof(".state"));
+    if (state_path == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    sprintf(state_path, "%s.state", argv[optind]);
+
+    trace_path = malloc(strlen(argv[optind]) + sizeof(".trace"));
+    if (trace_path == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    sprintf(trace_path, "%s.trace", argv[optind]);
+    if (trace_records > 0)
+    {
+        Chip8EnableTrace(&chip8, trace_records, trace_path);
+    }
+
+    if (rewind_mb > 0 && !Chip8RewindInit(&history, (size_t) rewind_mb << 20))
+    {
+        fprintf(stderr, "No memory for a %ld MB rewind buffer, rewind is off\n", rewind_mb);
+    }
 
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGBA);
 
-    glutInitWindowSize(SCREEN_COLS, SCREEN_ROWS);
+    glutInitWindowSize((int) (GFX_COLS * scale + 0.5), (int) (GFX_ROWS * scale + 0.5));
     glutInitWindowPosition(0, 0);
     glutCreateWindow("chip8");
 
@@ -161,10 +600,12 @@ int main(int argc, char const *argv[])
 
     glutKeyboardFunc(keypress);
     glutKeyboardUpFunc(keyrelease);
+    glutIgnoreKeyRepeat(1);
+    glutSpecialFunc(special_key);
 
     gfx_setup();
 
-    gettimeofday(&clock_prev, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
 
     glutMainLoop(); 
     
@@ -0,0 +1,112 @@
+// Guest memory pages (chip8_ops.h). A machine starts out with nothing of
+// its own: page 0 is the font and the rest are zeros, all shared by every
+// machine. Writes take copies a page at a time.
+
+#include "chip8.h"
+#include "chip8_ops.h"
+
+// Page 0 as every machine starts with it, the font at FONTSET_ADDRESS
+static const uint8_t font_page[MEM_PAGE_SIZE] =
+{
+	0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+	0x20, 0x60, 0x20, 0x20, 0x70, // 1
+	0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+	0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+	0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+	0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+	0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+	0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+	0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+	0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+	0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+	0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+	0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+	0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+	0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+	0xF0, 0x80, 0xF0, 0x80, 0x80  // F
+};
+
+static const uint8_t zero_page[MEM_PAGE_SIZE];
+
+void Chip8MapPage(CHIP8* chip8, unsigned page, const uint8_t* bytes){
+    Chip8PageRelease(chip8->page_ref[page]);
+    chip8->page_ref[page] = NULL;
+    chip8->mem[page] = (uint8_t*) bytes;
+}
+
+void Chip8OwnPage(CHIP8* chip8, unsigned page){
+    struct Chip8Page* own = malloc(sizeof(struct Chip8Page));
+
+    if (own == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    own->refs = 1;
+    memcpy(own->bytes, chip8->mem[page], MEM_PAGE_SIZE);
+    Chip8PageRelease(chip8->page_ref[page]);
+    chip8->page_ref[page] = own;
+    chip8->mem[page] = own->bytes;
+}
+
+void Chip8ReleaseMemory(CHIP8* chip8){
+    Chip8MapPage(chip8, 0, font_page);
+    for (unsigned page = 1; page < MEM_PAGES; page++)
+    {
+        Chip8MapPage(chip8, page, zero_page);
+    }
+}
+
+void Chip8ReadMemory(const CHIP8* chip8, unsigned addr, uint8_t* out, unsigned len){
+    while (len > 0)
+    {
+        unsigned offset = MEM_OFFSET(addr);
+        unsigned n = MEM_PAGE_SIZE - offset < len ? MEM_PAGE_SIZE - offset : len;
+
+        memcpy(out, chip8->mem[MEM_PAGE(addr)] + offset, n);
+        addr += n;
+        out  += n;
+        len  -= n;
+    }
+}
+
+void Chip8WriteMemory(CHIP8* chip8, unsigned addr, const uint8_t* bytes, unsigned len){
+    while (len > 0)
+    {
+        unsigned page   = MEM_PAGE(addr);
+        unsigned offset = MEM_OFFSET(addr);
+        unsigned n = MEM_PAGE_SIZE - offset < len ? MEM_PAGE_SIZE - offset : len;
+
+        if (memcmp(chip8->mem[page] + offset, bytes, n) != 0)
+        {
+            // A whole page of zeros can go back to sharing, which is most
+            // of memory in a save state
+            if (n == MEM_PAGE_SIZE && memcmp(bytes, zero_page, MEM_PAGE_SIZE) == 0)
+            {
+                Chip8MapPage(chip8, page, zero_page);
+            }
+            else
+            {
+                if (!page_is_own(chip8, page))
+                {
+                    Chip8OwnPage(chip8, page);
+                }
+                memcpy(chip8->mem[page] + offset, bytes, n);
+            }
+            Chip8InvalidateCode(chip8, page * MEM_PAGE_SIZE + offset, n);
+        }
+        addr  += n;
+        bytes += n;
+        len   -= n;
+    }
+}
+
+unsigned Chip8OwnedPages(const CHIP8* chip8){
+    unsigned owned = 0;
+
+    for (unsigned page = 0; page < MEM_PAGES; page++)
+    {
+        owned += page_is_own(chip8, page);
+    }
+    return owned;
+}
@@ -0,0 +1,210 @@
+#include "chip8.h"
+#include "chip8_ops.h"
+#include "predecode.h"
+#include "handlers.h"
+
+// Every handler in handlers.h does exactly what the matching case in
+// EmulateCycle does. Anything rare or awkward (Fx0A, bad opcodes) is handed to
+// EmulateCycle.
+
+static void exec_decode(CHIP8* chip8, const Chip8Decoded* d);
+
+static void exec_fallback(CHIP8* chip8, const Chip8Decoded* d){
+    (void) d;
+    EmulateCycle(chip8);
+}
+
+static const Chip8Handler handlers[OP_COUNT] =
+{
+    [OP_DECODE]   = exec_decode,
+    [OP_FALLBACK] = exec_fallback,
+    [OP_00E0] = exec_00E0, [OP_00EE] = exec_00EE,
+    [OP_1nnn] = exec_1nnn, [OP_2nnn] = exec_2nnn, [OP_3xkk] = exec_3xkk,
+    [OP_4xkk] = exec_4xkk, [OP_5xy0] = exec_5xy0, [OP_6xkk] = exec_6xkk,
+    [OP_7xkk] = exec_7xkk,
+    [OP_8xy0] = exec_8xy0, [OP_8xy1] = exec_8xy1, [OP_8xy2] = exec_8xy2,
+    [OP_8xy3] = exec_8xy3, [OP_8xy4] = exec_8xy4, [OP_8xy5] = exec_8xy5,
+    [OP_8xy6] = exec_8xy6, [OP_8xy7] = exec_8xy7, [OP_8xyE] = exec_8xyE,
+    [OP_9xy0] = exec_9xy0, [OP_Annn] = exec_Annn, [OP_Bnnn] = exec_Bnnn,
+    [OP_Cxkk] = exec_Cxkk, [OP_Dxyn] = exec_Dxyn,
+    [OP_Ex9E] = exec_Ex9E, [OP_ExA1] = exec_ExA1,
+    [OP_Fx07] = exec_Fx07, [OP_Fx15] = exec_Fx15, [OP_Fx18] = exec_Fx18,
+    [OP_Fx1E] = exec_Fx1E, [OP_Fx29] = exec_Fx29, [OP_Fx33] = exec_Fx33,
+    [OP_Fx55] = exec_Fx55, [OP_Fx65] = exec_Fx65,
+};
+
+static Chip8Op decode_op(uint16_t opcode){
+    uint8_t n  = opcode & 0x000F;
+    uint8_t kk = opcode & 0x00FF;
+
+    switch (opcode & 0xF000)
+    {
+        case 0x0000:
+            // EmulateCycle only looks at kk here, so 0x0nE0 clears too
+            if (kk == 0xE0) return OP_00E0;
+            if (kk == 0xEE) return OP_00EE;
+            return OP_FALLBACK;
+        case 0x1000: return OP_1nnn;
+        case 0x2000: return OP_2nnn;
+        case 0x3000: return OP_3xkk;
+        case 0x4000: return OP_4xkk;
+        case 0x5000: return OP_5xy0;
+        case 0x6000: return OP_6xkk;
+        case 0x7000: return OP_7xkk;
+        case 0x8000:
+            switch (n)
+            {
+                case 0x0: return OP_8xy0;
+                case 0x1: return OP_8xy1;
+                case 0x2: return OP_8xy2;
+                case 0x3: return OP_8xy3;
+                case 0x4: return OP_8xy4;
+                case 0x5: return OP_8xy5;
+                case 0x6: return OP_8xy6;
+                case 0x7: return OP_8xy7;
+                case 0xE: return OP_8xyE;
+                default:  return OP_FALLBACK;
+            }
+        case 0x9000: return n == 0 ? OP_9xy0 : OP_FALLBACK;
+        case 0xA000: return OP_Annn;
+        case 0xB000: return OP_Bnnn;
+        case 0xC000: return OP_Cxkk;
+        case 0xD000: return OP_Dxyn;
+        case 0xE000:
+            if (kk == 0x9E) return OP_Ex9E;
+            if (kk == 0xA1) return OP_ExA1;
+            return OP_FALLBACK;
+        default:
+            switch (kk)
+            {
+                case 0x07: return OP_Fx07;
+                case 0x15: return OP_Fx15;
+                case 0x18: return OP_Fx18;
+                case 0x1E: return OP_Fx1E;
+                case 0x29: return OP_Fx29;
+                case 0x33: return OP_Fx33;
+                case 0x55: return OP_Fx55;
+                case 0x65: return OP_Fx65;
+                default:   return OP_FALLBACK;   // Fx0A waits for a key
+            }
+    }
+}
+
+void Chip8Decode(uint16_t opcode, Chip8Decoded* d){
+    d->op      = decode_op(opcode);
+    d->handler = handlers[d->op];
+    d->opcode  = opcode;
+    d->nnn     = opcode & 0x0FFF;
+    d->x       = (opcode >> 8) & 0x000F;
+    d->y       = (opcode >> 4) & 0x000F;
+    d->kk      = opcode & 0x00FF;
+}
+
+static void exec_decode(CHIP8* chip8, const Chip8Decoded* d){
+    Chip8Decoded* entry = (Chip8Decoded*) d;
+    uint16_t PC = chip8->PC;
+
+    Chip8Decode(fetch_opcode(chip8, PC), entry);
+    chip8->opcode = entry->opcode;
+    entry->handler(chip8, entry);
+}
+
+static void reset_entries(Chip8Decoded* first, unsigned count){
+    for (unsigned i = 0; i < count; i++)
+    {
+        first[i].handler = exec_decode;
+        first[i].op      = OP_DECODE;
+    }
+}
+
+void Chip8PredecodeInvalidate(CHIP8* chip8, unsigned addr, unsigned len){
+    unsigned first, last;
+
+    if (len == 0)
+    {
+        return;
+    }
+
+    // An instruction at even address e covers bytes e and e + 1
+    first = addr & ~1u;
+    last  = (addr + len - 1) & ~1u;
+    if (last < PREDECODE_BASE || first >= MEM_SIZE)
+    {
+        return;
+    }
+    if (first < PREDECODE_BASE)
+    {
+        first = PREDECODE_BASE;
+    }
+    if (last >= MEM_SIZE)
+    {
+        last = MEM_SIZE - 2;
+    }
+
+    reset_entries(&chip8->predecode->entries[(first - PREDECODE_BASE) / 2],
+                  (last - first) / 2 + 1);
+}
+
+void Chip8EnablePredecode(CHIP8* chip8){
+    if (chip8->predecode != NULL)
+    {
+        return;
+    }
+
+    chip8->predecode = malloc(sizeof(struct Chip8Predecode));
+    if (chip8->predecode == NULL)
+    {
+        // No cache is not fatal, Chip8Run just uses EmulateCycle
+        return;
+    }
+    reset_entries(chip8->predecode->entries, PREDECODE_ENTRIES);
+}
+
+void Chip8DisablePredecode(CHIP8* chip8){
+    free(chip8->predecode);
+    chip8->predecode = NULL;
+}
+
+void Chip8RunPredecoded(CHIP8* chip8, uint32_t cycles){
+    Chip8Decoded* entries = chip8->predecode->entries;
+
+    while (cycles--)
+    {
+        // Odd addresses, code below 0x200 and the guard slots at the top
+        // are not cached
+        unsigned offset = (unsigned) chip8->PC - PREDECODE_BASE;
+        if ((offset & 1) || offset >= MEM_PC_GUARD - PREDECODE_BASE)
+        {
+            EmulateCycle(chip8);
+            if (chip8->waiting)
+            {
+                return;
+            }
+            if ((chip8->opcode & 0xF000) == 0x1000 && chip8->PC <= PREDECODE_BASE + offset)
+            {
+                cycles -= Chip8SkipIdle(chip8, cycles);
+            }
+            continue;
+        }
+
+        const Chip8Decoded* d = &entries[offset / 2];
+        chip8->opcode = d->opcode;
+        d->handler(chip8, d);
+
+        // One compare keeps the rest off the hot path: the fallback can halt
+        // in Fx0A, a call, return or key skip can fault, and a jump back may
+        // close an idle loop. OP_DECODE entries have been rewritten to their
+        // real op by now.
+        if (d->op <= OP_1nnn)
+        {
+            if (chip8->waiting)
+            {
+                return;
+            }
+            if (d->op == OP_1nnn && d->nnn <= PREDECODE_BASE + offset)
+            {
+                cycles -= Chip8SkipIdle(chip8, cycles);
+            }
+        }
+    }
+}
@@ -0,0 +1,63 @@
+// Predecoded instruction cache. One entry per even address in 0x200..0xFFF
+// holds the instruction already split into its handler and operands, so the
+// hot loop does one indirect call per instruction instead of a fetch, a
+// decode and two switches.
+
+#ifndef CHIP_8_PREDECODE
+#define CHIP_8_PREDECODE
+
+#include "chip8.h"
+
+#define PREDECODE_BASE      0x200
+#define PREDECODE_ENTRIES   ((MEM_SIZE - PREDECODE_BASE) / 2)
+
+// Handler ids, named after the opcode they run. Chip8RunPredecoded picks out
+// the ops up to OP_1nnn with one compare, so keep those first: the ones that
+// can end up in EmulateCycle, which may halt the machine, then the jump.
+typedef enum
+{
+    OP_DECODE = 0,                              // entry not decoded yet
+    OP_FALLBACK,                                // let EmulateCycle deal with it
+    OP_00EE, OP_2nnn, OP_Ex9E, OP_ExA1,         // fault through EmulateCycle
+    OP_1nnn,
+    OP_00E0, OP_3xkk, OP_4xkk, OP_5xy0, OP_6xkk, OP_7xkk,
+    OP_8xy0, OP_8xy1, OP_8xy2, OP_8xy3, OP_8xy4, OP_8xy5, OP_8xy6, OP_8xy7, OP_8xyE,
+    OP_9xy0, OP_Annn, OP_Bnnn, OP_Cxkk, OP_Dxyn,
+    OP_Fx07, OP_Fx15, OP_Fx18, OP_Fx1E, OP_Fx29, OP_Fx33, OP_Fx55, OP_Fx65,
+    OP_COUNT
+} Chip8Op;
+
+typedef struct Chip8Decoded Chip8Decoded;
+typedef void (*Chip8Handler)(CHIP8* chip8, const Chip8Decoded* d);
+
+struct Chip8Decoded
+{
+    Chip8Handler    handler;                    // runs the instruction
+    uint16_t        opcode;                     // raw opcode, for chip8->opcode
+    uint16_t        nnn;
+    uint8_t         op;                         // Chip8Op of handler
+    uint8_t         x;
+    uint8_t         y;
+    uint8_t         kk;                         // n is kk & 0xF
+};
+
+struct Chip8Predecode
+{
+    Chip8Decoded    entries[PREDECODE_ENTRIES];
+};
+
+// Drops the entries covering guest memory [addr, addr + len)
+void Chip8PredecodeInvalidate(CHIP8* chip8, unsigned addr, unsigned len);
+
+// Chip8Run with the cache enabled
+void Chip8RunPredecoded(CHIP8* chip8, uint32_t cycles);
+
+#ifdef CHIP8_THREADED
+// Same, but with labels-as-values dispatch (threaded.c)
+void Chip8RunThreaded(CHIP8* chip8, uint32_t cycles);
+#endif
+
+// Fills in *d for the instruction `opcode`
+void Chip8Decode(uint16_t opcode, Chip8Decoded* d);
+
+#endif
@@ -0,0 +1,221 @@
+#include "rewind.h"
+
+// A record is the encoded delta with its length on both ends, so the ring
+// can be walked from either side: drop from the old end, pop from the new.
+//
+//     len (4 bytes) | delta (len bytes) | len (4 bytes)
+//
+// The delta is a list of (skip, count, count bytes) with skip and count as
+// LEB128. Each one means: leave `skip` bytes alone, then XOR the next
+// `count` bytes with the ones given. Bytes past the last one are unchanged.
+#define RECORD_OVERHEAD 8
+
+bool Chip8RewindInit(Chip8Rewind* rw, size_t bytes){
+    if (bytes < REWIND_MAX_RECORD + RECORD_OVERHEAD)
+    {
+        return false;
+    }
+    rw->ring = malloc(bytes);
+    if (rw->ring == NULL)
+    {
+        return false;
+    }
+    rw->capacity = bytes;
+    rw->head     = 0;
+    rw->used     = 0;
+    rw->frames   = 0;
+    rw->started  = false;
+    return true;
+}
+
+void Chip8RewindFree(Chip8Rewind* rw){
+    free(rw->ring);
+    rw->ring     = NULL;
+    rw->capacity = 0;
+    rw->used     = 0;
+    rw->frames   = 0;
+    rw->started  = false;
+}
+
+// ---- ring access, wrapping at the end ----
+
+static void ring_write(Chip8Rewind* r, size_t pos, const uint8_t* src, size_t n){
+    size_t first = r->capacity - pos < n ? r->capacity - pos : n;
+
+    memcpy(r->ring + pos, src, first);
+    memcpy(r->ring, src + first, n - first);
+}
+
+static void ring_read(const Chip8Rewind* r, size_t pos, uint8_t* dst, size_t n){
+    size_t first = r->capacity - pos < n ? r->capacity - pos : n;
+
+    memcpy(dst, r->ring + pos, first);
+    memcpy(dst + first, r->ring, n - first);
+}
+
+// pos moved on by delta, wrapping. Pass capacity - n to move back by n.
+static size_t ring_pos(const Chip8Rewind* r, size_t pos, size_t delta){
+    return (pos + delta) % r->capacity;
+}
+
+static uint32_t ring_len(const Chip8Rewind* r, size_t pos){
+    uint8_t b[4];
+
+    ring_read(r, pos, b, 4);
+    return (uint32_t) b[0] | (uint32_t) b[1] << 8 | (uint32_t) b[2] << 16 | (uint32_t) b[3] << 24;
+}
+
+// ---- delta encoding ----
+
+static uint8_t* put_varint(uint8_t* p, size_t v){
+    while (v >= 0x80)
+    {
+        *p++ = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t) v;
+    return p;
+}
+
+static const uint8_t* get_varint(const uint8_t* p, size_t* v){
+    int shift = 0;
+
+    *v = 0;
+    do
+    {
+        *v |= (size_t) (*p & 0x7F) << shift;
+        shift += 7;
+    } while (*p++ & 0x80);
+    return p;
+}
+
+// Encodes a ^ b into out, returns the length. A literal run only ends at
+// two equal bytes in a row, since a lone one costs more to skip than to copy.
+static size_t encode_delta(const uint8_t* a, const uint8_t* b, size_t n, uint8_t* out){
+    uint8_t* p = out;
+    size_t i = 0;
+
+    while (i < n)
+    {
+        size_t start = i;
+        size_t end;
+
+        // Equal bytes, a word at a time while that lasts
+        while (i + 8 <= n)
+        {
+            uint64_t x, y;
+            memcpy(&x, a + i, 8);
+            memcpy(&y, b + i, 8);
+            if (x != y)
+            {
+                break;
+            }
+            i += 8;
+        }
+        while (i < n && a[i] == b[i])
+        {
+            i++;
+        }
+        if (i == n)
+        {
+            break;
+        }
+
+        end = i;
+        while (end < n && (a[end] != b[end] || (end + 1 < n && a[end + 1] != b[end + 1])))
+        {
+            end++;
+        }
+
+        p = put_varint(p, i - start);
+        p = put_varint(p, end - i);
+        for (; i < end; i++)
+        {
+            *p++ = a[i] ^ b[i];
+        }
+    }
+    return (size_t) (p - out);
+}
+
+static void apply_delta(uint8_t* dst, const uint8_t* delta, size_t len){
+    const uint8_t* p = delta;
+    const uint8_t* end = delta + len;
+    size_t pos = 0;
+
+    while (p < end)
+    {
+        size_t skip, count;
+
+        p = get_varint(p, &skip);
+        p = get_varint(p, &count);
+        pos += skip;
+        for (size_t i = 0; i < count; i++)
+        {
+            dst[pos++] ^= *p++;
+        }
+    }
+}
+
+// ---- the ring ----
+
+static void drop_oldest(Chip8Rewind* r){
+    size_t tail = ring_pos(r, r->head, r->capacity - r->used);
+    size_t size = ring_len(r, tail) + RECORD_OVERHEAD;
+
+    r->used -= size;
+    r->frames--;
+}
+
+void Chip8RewindPush(Chip8Rewind* rw, const CHIP8* chip8){
+    uint8_t b[4];
+    size_t len;
+
+    if (!rw->started)
+    {
+        Chip8SaveFlat(chip8, rw->newest);
+        rw->started = true;
+        return;
+    }
+
+    // The delta takes the new frame back to the one before it
+    Chip8SaveFlat(chip8, rw->frame);
+    len = encode_delta(rw->frame, rw->newest, CHIP8_FLAT_BYTES, rw->scratch);
+    while (rw->capacity - rw->used < len + RECORD_OVERHEAD)
+    {
+        drop_oldest(rw);
+    }
+
+    b[0] = (uint8_t) len;
+    b[1] = (uint8_t) (len >> 8);
+    b[2] = (uint8_t) (len >> 16);
+    b[3] = (uint8_t) (len >> 24);
+    ring_write(rw, rw->head, b, 4);
+    ring_write(rw, ring_pos(rw, rw->head, 4), rw->scratch, len);
+    ring_write(rw, ring_pos(rw, rw->head, 4 + len), b, 4);
+    rw->head = ring_pos(rw, rw->head, len + RECORD_OVERHEAD);
+    rw->used += len + RECORD_OVERHEAD;
+    rw->frames++;
+
+    memcpy(rw->newest, rw->frame, CHIP8_FLAT_BYTES);
+}
+
+bool Chip8RewindStep(Chip8Rewind* rw, CHIP8* chip8){
+    size_t len, start;
+
+    if (rw->frames == 0)
+    {
+        return false;
+    }
+
+    len   = ring_len(rw, ring_pos(rw, rw->head, rw->capacity - 4));
+    start = ring_pos(rw, rw->head, rw->capacity - 4 - len);
+    ring_read(rw, start, rw->scratch, len);
+    apply_delta(rw->newest, rw->scratch, len);
+
+    rw->head = ring_pos(rw, rw->head, rw->capacity - len - RECORD_OVERHEAD);
+    rw->used -= len + RECORD_OVERHEAD;
+    rw->frames--;
+
+    Chip8RestoreFlat(chip8, rw->newest);
+    return true;
+}
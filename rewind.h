@@ -0,0 +1,44 @@
+// Rewind buffer. Push the machine once per frame and step back through the
+// frames later. Only the newest frame is kept whole. Every older frame is
+// stored as the XOR of it and the frame after it, run-length encoded. Most
+// frames change a few registers, a sprite or two and a couple of bytes of
+// memory, so a record is usually tens of bytes rather than 4.5 KB.
+//
+// Records live in a byte ring. When it fills up the oldest frames drop off,
+// so the memory use is fixed no matter how long the session runs.
+
+#ifndef CHIP_8_REWIND
+#define CHIP_8_REWIND
+
+#include "chip8.h"
+#include "savestate.h"
+
+// Worst case for one record, with every byte of the machine different
+#define REWIND_MAX_RECORD (2 * CHIP8_FLAT_BYTES + 16)
+
+typedef struct
+{
+    uint8_t*    ring;
+    size_t      capacity;                       // bytes in ring
+    size_t      head;                           // where the next record goes
+    size_t      used;                           // bytes of records, oldest starts at head - used
+    uint32_t    frames;                         // records in the ring, one per frame you can step back
+    bool        started;                        // newest holds a frame
+    uint8_t     newest[CHIP8_FLAT_BYTES];       // the last frame pushed, or stepped back to
+    uint8_t     frame[CHIP8_FLAT_BYTES];        // frame being pushed
+    uint8_t     scratch[REWIND_MAX_RECORD];     // record being encoded
+} Chip8Rewind;
+
+// Sets up a ring of `bytes` bytes. Returns false when out of memory or too
+// small for even one record.
+bool Chip8RewindInit(Chip8Rewind* rw, size_t bytes);
+void Chip8RewindFree(Chip8Rewind* rw);
+
+// Records the machine as the newest frame
+void Chip8RewindPush(Chip8Rewind* rw, const CHIP8* chip8);
+
+// Puts the machine back to the frame before the newest and makes that the
+// newest. Returns false when there is nothing older left.
+bool Chip8RewindStep(Chip8Rewind* rw, CHIP8* chip8);
+
+#endif
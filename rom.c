@@ -0,0 +1,169 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "rom.h"
+#include "chip8_ops.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+void Chip8RomStoreInit(Chip8RomStore* store){
+    memset(store, 0, sizeof(Chip8RomStore));
+}
+
+void Chip8RomStoreFree(Chip8RomStore* store){
+    for (size_t i = 0; i < store->num_roms; i++)
+    {
+        munmap((void*) store->roms[i]->data, store->roms[i]->map_size);
+        free(store->roms[i]);
+    }
+    for (size_t i = 0; i < store->num_paths; i++)
+    {
+        free(store->paths[i].path);
+    }
+    free(store->roms);
+    free(store->paths);
+    Chip8RomStoreInit(store);
+}
+
+static uint64_t hash_bytes(const uint8_t* bytes, size_t size){
+    // FNV-1a, same as the runner's framebuffer hash
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static void* grow(void* array, size_t* capacity, size_t size){
+    size_t new_capacity = *capacity ? 2 * *capacity : 16;
+
+    array = realloc(array, new_capacity * size);
+    if (array == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return array;
+}
+
+// Maps the file. Returns NULL if it can't, having said why.
+static Chip8Rom* map_rom(const char* path){
+    struct stat st;
+    Chip8Rom* rom;
+    void* data;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "Unable to open game: %s\n", path);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return NULL;
+    }
+    if (st.st_size == 0)
+    {
+        fprintf(stderr, "Empty game: %s\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        fprintf(stderr, "Unable to map game: %s\n", path);
+        return NULL;
+    }
+
+    rom = malloc(sizeof(Chip8Rom));
+    if (rom == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    rom->data     = data;
+    rom->map_size = (size_t) st.st_size;
+
+    // Like LoadGame, anything past the end of memory is left out
+    rom->size     = rom->map_size < MAX_GAME_SIZE ? rom->map_size : MAX_GAME_SIZE;
+    rom->hash     = hash_bytes(rom->data, rom->size);
+    return rom;
+}
+
+const Chip8Rom* Chip8RomOpen(Chip8RomStore* store, const char* path){
+    Chip8Rom* rom;
+    Chip8RomPath* entry;
+    bool shared = false;
+
+    for (size_t i = 0; i < store->num_paths; i++)
+    {
+        if (strcmp(store->paths[i].path, path) == 0)
+        {
+            return store->paths[i].rom;
+        }
+    }
+
+    rom = map_rom(path);
+    if (rom == NULL)
+    {
+        return NULL;
+    }
+
+    // A new path may still be a game we have. Keep the first mapping.
+    for (size_t i = 0; i < store->num_roms; i++)
+    {
+        Chip8Rom* have = store->roms[i];
+
+        if (have->hash == rom->hash && have->size == rom->size &&
+            memcmp(have->data, rom->data, rom->size) == 0)
+        {
+            munmap((void*) rom->data, rom->map_size);
+            free(rom);
+            rom = have;
+            shared = true;
+            break;
+        }
+    }
+    if (!shared)
+    {
+        if (store->num_roms == store->rom_capacity)
+        {
+            store->roms = grow(store->roms, &store->rom_capacity, sizeof(Chip8Rom*));
+        }
+        store->roms[store->num_roms++] = rom;
+    }
+
+    if (store->num_paths == store->path_capacity)
+    {
+        store->paths = grow(store->paths, &store->path_capacity, sizeof(Chip8RomPath));
+    }
+    entry = &store->paths[store->num_paths++];
+    entry->path = malloc(strlen(path) + 1);
+    if (entry->path == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    strcpy(entry->path, path);
+    entry->rom = rom;
+    return rom;
+}
+
+void Chip8LoadRom(CHIP8* chip8, const Chip8Rom* rom){
+    // The machine's pages point straight into the mapping. A partial last
+    // page reads zeros past the end of the file, as the mapping is whole OS
+    // pages and those are a multiple of MEM_PAGE_SIZE.
+    for (size_t offset = 0; offset < rom->size; offset += MEM_PAGE_SIZE)
+    {
+        Chip8MapPage(chip8, MEM_PAGE(0x200 + offset), rom->data + offset);
+    }
+    Chip8InvalidateCode(chip8, 0x200, rom->size);
+}
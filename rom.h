@@ -0,0 +1,55 @@
+// ROM image store. Each ROM file is mapped read only once and identified by
+// a hash of its contents, so any number of machines can load the same game
+// without touching the file again. Opening a path the store has seen is a
+// lookup, and two paths with the same bytes share one image.
+//
+// A store isn't thread safe. Open every ROM up front, from one thread; the
+// images it hands out are read only and can then be loaded from any thread.
+// Machines loaded from an image read it in place, so the store has to
+// outlive them.
+
+#ifndef CHIP_8_ROM
+#define CHIP_8_ROM
+
+#include "chip8.h"
+
+typedef struct
+{
+    const uint8_t*  data;                       // the mapped file, read only
+    size_t          size;                       // bytes a machine gets, at most MAX_GAME_SIZE
+    size_t          map_size;                   // bytes mapped
+    uint64_t        hash;                       // FNV-1a of data[0, size)
+} Chip8Rom;
+
+typedef struct
+{
+    char*           path;
+    Chip8Rom*       rom;
+} Chip8RomPath;
+
+typedef struct
+{
+    Chip8Rom**      roms;                       // one per distinct content
+    size_t          num_roms;
+    size_t          rom_capacity;
+    Chip8RomPath*   paths;                      // every path opened, pointing into roms
+    size_t          num_paths;
+    size_t          path_capacity;
+} Chip8RomStore;
+
+void Chip8RomStoreInit(Chip8RomStore* store);
+
+// Unmaps every image. Free or re-initialize the machines that loaded one
+// first (Chip8ReleaseMemory).
+void Chip8RomStoreFree(Chip8RomStore* store);
+
+// The image for the file at path, mapping it the first time. Returns NULL,
+// and says why on stderr, if it can't be opened or mapped.
+const Chip8Rom* Chip8RomOpen(Chip8RomStore* store, const char* path);
+
+// LoadGame from an image, with no file access and no copying: the pages
+// from 0x200 share the image until the game writes to them. Bytes between
+// the end of the image and the end of its last page read as zero.
+void Chip8LoadRom(CHIP8* chip8, const Chip8Rom* rom);
+
+#endif
@@ -0,0 +1,852 @@
+// Headless batch runner: runs lots of ROM jobs over all cores, no GL needed.
+//
+// Usage: ./chip8_runner [options] <jobfile>
+//
+// Every line of the job file is one job:
+//     <rom> [input_script]
+// Empty lines and lines starting with '#' are skipped.
+//
+// An input script has one key transition per line:
+//     <cycle> <key in hex> <down|up>
+// The transition is applied right before instruction number <cycle> runs.
+// Lines go in cycle order.
+//
+// Each job runs to the cycle or frame budget and writes one CSV line:
+//     job,rom,exit,cycles,frames,fb_hash
+//
+// With -P, every job also counts its instructions (stats.h) and the reports
+// go to stderr after the results, in job order. With -t, every job keeps a
+// trace of its last instructions (trace.h), which is written to
+// job<N>.trace if the job faults.
+//
+// A job that faults (an unknown opcode, the stack running over or under, a
+// key skip on a Vx past key F) ends with the frame it faulted in, with exit
+// "fault", and the rest carry on. What went wrong, and where, goes to stderr.
+//
+// With -e simd, jobs that share a ROM are packed up to CHIP8_LANES at a time
+// into one lockstep Chip8Batch (batch.h), and the group is scheduled as a
+// single task.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "chip8.h"
+#include "batch.h"
+#include "rom.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#define DEFAULT_CYCLES_PER_FRAME 10
+#define DEFAULT_QUANTUM_FRAMES 64
+#define MAX_LINE 1024
+
+typedef struct
+{
+    uint64_t    cycle;                          // run before this instruction
+    uint8_t     key;
+    uint8_t     down;
+} KeyEvent;
+
+typedef struct
+{
+    char*       rom;
+    const Chip8Rom* image;                      // shared, every job of this ROM loads from it
+    KeyEvent*   events;
+    size_t      num_events;
+} JobSpec;
+
+typedef enum
+{
+    EXIT_NONE = 0,
+    EXIT_CYCLES,                                // cycle budget reached
+    EXIT_FRAMES,                                // frame budget reached
+    EXIT_FAULT,                                 // the machine faulted
+} ExitReason;
+
+static const char* exit_names[] = { "none", "cycles", "frames", "fault" };
+
+typedef struct
+{
+    const JobSpec*  spec;
+    CHIP8*          chip8;                      // only allocated while running
+    size_t          next_event;
+    uint64_t        cycles;
+    uint64_t        frames;
+    uint32_t        frame_cycles;               // cycles into the current frame
+    ExitReason      exit;
+    uint8_t         fault;                      // Chip8Fault, and where it happened
+    uint16_t        fault_pc;
+    uint16_t        fault_opcode;
+    uint64_t        fault_frames;               // -e simd only: frames when the fault was seen
+    uint64_t        fb_hash;
+    uint64_t        idle_skipped;               // of cycles, fast-forwarded in idle loops
+    unsigned        own_pages;                  // memory pages the game wrote, the rest were shared
+    char*           report;                     // -P only, Chip8StatsReport's output
+} Job;
+
+// -e simd only: jobs running as the lanes of one batch
+typedef struct
+{
+    size_t          jobs[CHIP8_LANES];
+    unsigned        lanes;
+    Chip8Batch*     batch;                      // only allocated while running
+} Group;
+
+// One deque per worker. The owner pushes and pops at the bottom, thieves take
+// from the top. A mutex per deque is plenty here because a task is a whole
+// slice of frames, not a single instruction.
+typedef struct
+{
+    pthread_mutex_t lock;
+    size_t*         tasks;
+    size_t          capacity;
+    size_t          top;
+    size_t          bottom;
+} Deque;
+
+typedef struct
+{
+    Deque           deque;
+    unsigned        seed;
+    uint64_t        cycles;
+} Worker;
+
+static Job*     jobs;
+static size_t   num_jobs;
+static Group*   groups;
+static size_t   num_groups;
+static Worker*  workers;
+static int      num_workers;
+
+static uint64_t max_cycles          = 0;        // 0 = no limit
+static uint64_t max_frames          = 600;      // 0 = no limit
+static uint32_t cycles_per_frame    = DEFAULT_CYCLES_PER_FRAME;
+static uint32_t quantum_frames      = DEFAULT_QUANTUM_FRAMES;
+static const char* engine           = "switch";
+static uint32_t seed                = 1;        // every job starts from the same one
+static bool     profile             = false;
+static uint32_t trace_records       = 0;        // 0 = no trace
+
+static pthread_mutex_t  remaining_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t           remaining;
+
+static void deque_push(Deque* d, size_t task){
+    pthread_mutex_lock(&d->lock);
+    d->tasks[d->bottom++ % d->capacity] = task;
+    pthread_mutex_unlock(&d->lock);
+}
+
+static bool deque_pop(Deque* d, size_t* task){
+    bool ok = false;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom > d->top)
+    {
+        *task = d->tasks[--d->bottom % d->capacity];
+        ok = true;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+static bool deque_steal(Deque* d, size_t* task){
+    bool ok = false;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom > d->top)
+    {
+        *task = d->tasks[d->top++ % d->capacity];
+        ok = true;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+static uint64_t hash_fb(const CHIP8* chip8){
+    // FNV-1a over the packed framebuffer
+    const uint8_t* bytes = (const uint8_t*) chip8->fb;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < sizeof(chip8->fb); i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Applies the job's due key events, to its machine or to its batch lane
+static void apply_events(Job* job, Chip8Batch* batch, unsigned lane){
+    const JobSpec* spec = job->spec;
+
+    while (job->next_event < spec->num_events &&
+           spec->events[job->next_event].cycle <= job->cycles)
+    {
+        const KeyEvent* ev = &spec->events[job->next_event++];
+        if (batch != NULL)
+        {
+            Chip8BatchSetKey(batch, lane, ev->key, ev->down);
+        }
+        else
+        {
+            job->chip8->key[ev->key] = ev->down;
+        }
+    }
+}
+
+// Cuts a run of `chunk` instructions short at the job's next key event or at
+// the cycle budget, whichever comes first
+static uint64_t clip_chunk(const Job* job, uint64_t chunk){
+    if (job->next_event < job->spec->num_events &&
+        job->spec->events[job->next_event].cycle - job->cycles < chunk)
+    {
+        chunk = job->spec->events[job->next_event].cycle - job->cycles;
+    }
+    if (max_cycles && max_cycles - job->cycles < chunk)
+    {
+        chunk = max_cycles - job->cycles;
+    }
+    return chunk;
+}
+
+static void record_fault(Job* job, const CHIP8* chip8){
+    job->exit         = EXIT_FAULT;
+    job->fault        = chip8->fault;
+    job->fault_pc     = chip8->PC;
+    job->fault_opcode = chip8->opcode;
+}
+
+// Runs one slice of a job. Returns true once the job is finished.
+static bool run_slice(Job* job, uint64_t* executed){
+    uint64_t start = job->cycles;
+
+    if (job->chip8 == NULL)
+    {
+        job->chip8 = malloc(sizeof(CHIP8));
+        if (job->chip8 == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        InitializeChip8(job->chip8);
+        Chip8Seed(job->chip8, seed);
+        Chip8LoadRom(job->chip8, job->spec->image);
+        if (strcmp(engine, "predecode") == 0)
+        {
+            Chip8EnablePredecode(job->chip8);
+        }
+        else if (strcmp(engine, "jit") == 0)
+        {
+            Chip8EnableJit(job->chip8);
+        }
+        if (profile)
+        {
+            Chip8EnableStats(job->chip8);
+        }
+        if (trace_records > 0)
+        {
+            char path[32];
+
+            sprintf(path, "job%zu.trace", (size_t) (job - jobs));
+            Chip8EnableTrace(job->chip8, trace_records, path);
+        }
+    }
+
+    for (uint32_t f = 0; f < quantum_frames; f++)
+    {
+        while (job->frame_cycles < cycles_per_frame)
+        {
+            uint64_t chunk = cycles_per_frame - job->frame_cycles;
+
+            if (max_cycles && job->cycles >= max_cycles)
+            {
+                job->exit = EXIT_CYCLES;
+                goto done;
+            }
+            apply_events(job, NULL, 0);
+
+            // Run straight up to whatever comes first: end of frame, next
+            // key event or the cycle budget
+            chunk = clip_chunk(job, chunk);
+
+            Chip8Run(job->chip8, (uint32_t) chunk);
+            job->cycles += chunk;
+            job->frame_cycles += chunk;
+        }
+
+        Tick(job->chip8);
+        job->frame_cycles = 0;
+        job->frames++;
+
+        // A faulted job ends with the frame, the same with any engine
+        if (job->chip8->fault != CHIP8_OK)
+        {
+            goto done;
+        }
+        if (max_frames && job->frames >= max_frames)
+        {
+            job->exit = EXIT_FRAMES;
+            goto done;
+        }
+    }
+
+    *executed += job->cycles - start;
+    return false;
+
+done:
+    *executed += job->cycles - start;
+    if (job->chip8->fault != CHIP8_OK)
+    {
+        record_fault(job, job->chip8);
+    }
+    job->fb_hash = hash_fb(job->chip8);
+    job->idle_skipped = job->chip8->idle_skipped;
+    job->own_pages = Chip8OwnedPages(job->chip8);
+    if (profile)
+    {
+        size_t size;
+        FILE* out = open_memstream(&job->report, &size);
+
+        if (out == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        Chip8StatsReport(job->chip8, out, STATS_DEFAULT_TOP);
+        fclose(out);
+        Chip8DisableStats(job->chip8);
+    }
+    Chip8DisableTrace(job->chip8);
+    Chip8DisablePredecode(job->chip8);
+    Chip8DisableJit(job->chip8);
+    Chip8ReleaseMemory(job->chip8);
+    free(job->chip8);
+    job->chip8 = NULL;
+    return true;
+}
+
+// run_slice for a group of lanes. All lanes share one clock, so the chunk is
+// cut at the earliest key event of any lane.
+static bool run_group_slice(Group* group, uint64_t* executed){
+    Job* lead = &jobs[group->jobs[0]];
+    uint64_t start = lead->cycles;
+    ExitReason reason;
+    unsigned lane;
+
+    if (group->batch == NULL)
+    {
+        CHIP8* chip8 = malloc(sizeof(CHIP8));
+
+        group->batch = Chip8BatchCreate();
+        if (chip8 == NULL || group->batch == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        for (lane = 0; lane < group->lanes; lane++)
+        {
+            InitializeChip8(chip8);
+            Chip8Seed(chip8, seed);
+            Chip8LoadRom(chip8, jobs[group->jobs[lane]].spec->image);
+            Chip8BatchSetLane(group->batch, lane, chip8);
+            Chip8ReleaseMemory(chip8);
+        }
+        free(chip8);
+    }
+
+    for (uint32_t f = 0; f < quantum_frames; f++)
+    {
+        while (lead->frame_cycles < cycles_per_frame)
+        {
+            uint64_t chunk = cycles_per_frame - lead->frame_cycles;
+
+            if (max_cycles && lead->cycles >= max_cycles)
+            {
+                reason = EXIT_CYCLES;
+                goto done;
+            }
+            for (lane = 0; lane < group->lanes; lane++)
+            {
+                Job* job = &jobs[group->jobs[lane]];
+                apply_events(job, group->batch, lane);
+                chunk = clip_chunk(job, chunk);
+            }
+
+            Chip8BatchRun(group->batch, (uint32_t) chunk);
+            for (lane = 0; lane < group->lanes; lane++)
+            {
+                jobs[group->jobs[lane]].cycles += chunk;
+                jobs[group->jobs[lane]].frame_cycles += chunk;
+            }
+        }
+
+        Chip8BatchTick(group->batch);
+        for (lane = 0; lane < group->lanes; lane++)
+        {
+            Job* job = &jobs[group->jobs[lane]];
+
+            job->frame_cycles = 0;
+            job->frames++;
+
+            // The lane is halted for good. The group runs on, but the job
+            // ends here as it would on its own.
+            if (group->batch->fault[lane] != CHIP8_OK && job->fault_frames == 0)
+            {
+                job->fault_frames = job->frames;
+            }
+        }
+
+        if (max_frames && lead->frames >= max_frames)
+        {
+            reason = EXIT_FRAMES;
+            goto done;
+        }
+    }
+
+    *executed += (lead->cycles - start) * group->lanes;
+    return false;
+
+done:
+    *executed += (lead->cycles - start) * group->lanes;
+    {
+        CHIP8* chip8 = malloc(sizeof(CHIP8));
+
+        if (chip8 == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        InitializeChip8(chip8);
+        for (lane = 0; lane < group->lanes; lane++)
+        {
+            Job* job = &jobs[group->jobs[lane]];
+
+            // Over the image, so only pages the game wrote are counted
+            Chip8LoadRom(chip8, job->spec->image);
+            Chip8BatchGetLane(group->batch, lane, chip8);
+            job->exit = reason;
+            if (chip8->fault != CHIP8_OK)
+            {
+                record_fault(job, chip8);
+            }
+            if (job->fault_frames != 0)
+            {
+                job->frames = job->fault_frames;
+                job->cycles = job->frames * cycles_per_frame;
+            }
+            job->fb_hash = hash_fb(chip8);
+            job->own_pages = Chip8OwnedPages(chip8);
+            Chip8ReleaseMemory(chip8);
+        }
+        free(chip8);
+    }
+    Chip8BatchFree(group->batch);
+    group->batch = NULL;
+    return true;
+}
+
+// Packs jobs into groups of up to CHIP8_LANES that share a ROM image, so
+// copies of one game under different names go together too
+static void make_groups(){
+    groups = calloc(num_jobs, sizeof(Group));
+    num_groups = 0;
+
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        Group* group = NULL;
+
+        for (size_t g = 0; g < num_groups; g++)
+        {
+            if (groups[g].lanes < CHIP8_LANES &&
+                jobs[groups[g].jobs[0]].spec->image == jobs[i].spec->image)
+            {
+                group = &groups[g];
+                break;
+            }
+        }
+        if (group == NULL)
+        {
+            group = &groups[num_groups++];
+        }
+        group->jobs[group->lanes++] = i;
+    }
+}
+
+static bool run_task(size_t task, uint64_t* executed){
+    if (groups != NULL)
+    {
+        return run_group_slice(&groups[task], executed);
+    }
+    return run_slice(&jobs[task], executed);
+}
+
+static bool find_task(int self, size_t* task){
+    Worker* me = &workers[self];
+
+    if (deque_pop(&me->deque, task))
+    {
+        return true;
+    }
+
+    // Own deque is empty, go steal. Start from a random victim so the
+    // thieves spread out instead of all hammering worker 0.
+    int start = rand_r(&me->seed) % num_workers;
+    for (int i = 0; i < num_workers; i++)
+    {
+        int victim = (start + i) % num_workers;
+        if (victim != self && deque_steal(&workers[victim].deque, task))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void* worker_main(void* arg){
+    int self = (int) (intptr_t) arg;
+    Worker* me = &workers[self];
+    size_t task;
+
+    while (true)
+    {
+        if (!find_task(self, &task))
+        {
+            pthread_mutex_lock(&remaining_lock);
+            size_t left = remaining;
+            pthread_mutex_unlock(&remaining_lock);
+            if (left == 0)
+            {
+                break;
+            }
+            // Someone is still busy on a slice that may come back
+            sched_yield();
+            continue;
+        }
+
+        if (run_task(task, &me->cycles))
+        {
+            pthread_mutex_lock(&remaining_lock);
+            remaining--;
+            pthread_mutex_unlock(&remaining_lock);
+        }
+        else
+        {
+            deque_push(&me->deque, task);
+        }
+    }
+    return NULL;
+}
+
+static char* copy_string(const char* s){
+    char* copy = malloc(strlen(s) + 1);
+    if (copy != NULL)
+    {
+        strcpy(copy, s);
+    }
+    return copy;
+}
+
+static bool load_events(const char* path, JobSpec* spec){
+    FILE* fptr = fopen(path, "r");
+    char line[MAX_LINE];
+    size_t capacity = 0;
+
+    if (fptr == NULL)
+    {
+        fprintf(stderr, "Unable to open input script: %s\n", path);
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), fptr) != NULL)
+    {
+        unsigned long long cycle;
+        unsigned key;
+        char state[8];
+
+        if (line[0] == '#' || line[0] == '\n')
+        {
+            continue;
+        }
+        if (sscanf(line, "%llu %x %7s", &cycle, &key, state) != 3 || key >= KEYPAD_SIZE ||
+            (strcmp(state, "down") != 0 && strcmp(state, "up") != 0))
+        {
+            fprintf(stderr, "Bad input script line in %s: %s", path, line);
+            fclose(fptr);
+            return false;
+        }
+        // Jobs apply events in order and stop at the first one still ahead,
+        // so a line out of order would land late
+        if (spec->num_events > 0 && cycle < spec->events[spec->num_events - 1].cycle)
+        {
+            fprintf(stderr, "Input script %s goes back in time at: %s", path, line);
+            fclose(fptr);
+            return false;
+        }
+
+        if (spec->num_events == capacity)
+        {
+            KeyEvent* events;
+
+            capacity = capacity ? capacity * 2 : 16;
+            events = realloc(spec->events, capacity * sizeof(KeyEvent));
+            if (events == NULL)
+            {
+                fprintf(stderr, "Out of memory\n");
+                fclose(fptr);
+                return false;
+            }
+            spec->events = events;
+        }
+        spec->events[spec->num_events].cycle = cycle;
+        spec->events[spec->num_events].key   = key;
+        spec->events[spec->num_events].down  = strcmp(state, "down") == 0;
+        spec->num_events++;
+    }
+
+    fclose(fptr);
+    return true;
+}
+
+// Every ROM is mapped once here, before the workers start, and the jobs
+// share the image
+static JobSpec* load_jobs(const char* path, Chip8RomStore* store, size_t* count){
+    FILE* fptr = fopen(path, "r");
+    char line[MAX_LINE];
+    JobSpec* specs = NULL;
+    size_t capacity = 0;
+
+    if (fptr == NULL)
+    {
+        fprintf(stderr, "Unable to open job file: %s\n", path);
+        exit(2);
+    }
+
+    *count = 0;
+    while (fgets(line, sizeof(line), fptr) != NULL)
+    {
+        char rom[MAX_LINE], script[MAX_LINE];
+        const Chip8Rom* image;
+        int fields;
+
+        if (line[0] == '#')
+        {
+            continue;
+        }
+        fields = sscanf(line, "%1023s %1023s", rom, script);
+        if (fields < 1)
+        {
+            continue;
+        }
+
+        image = Chip8RomOpen(store, rom);
+        if (image == NULL)
+        {
+            exit(2);
+        }
+
+        if (*count == capacity)
+        {
+            JobSpec* grown;
+
+            capacity = capacity ? capacity * 2 : 16;
+            grown = realloc(specs, capacity * sizeof(JobSpec));
+            if (grown == NULL)
+            {
+                fprintf(stderr, "Out of memory\n");
+                exit(1);
+            }
+            specs = grown;
+        }
+        memset(&specs[*count], 0, sizeof(JobSpec));
+        specs[*count].rom = copy_string(rom);
+        specs[*count].image = image;
+        if (fields == 2 && !load_events(script, &specs[*count]))
+        {
+            exit(2);
+        }
+        (*count)++;
+    }
+
+    fclose(fptr);
+    return specs;
+}
+
+static double now_seconds(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void usage(){
+    fprintf(stderr,
+        "Usage: ./chip8_runner [options] <jobfile>\n"
+        "  -j <threads>   worker threads (default: all cores)\n"
+        "  -n <repeat>    run every job in the file this many times (default 1)\n"
+        "  -c <cycles>    cycle budget per job, 0 = none (default 0)\n"
+        "  -f <frames>    frame budget per job, 0 = none (default 600)\n"
+        "  -i <cycles>    instructions per 60 Hz frame (default %d)\n"
+        "  -e <engine>    switch, predecode, jit or simd (default switch)\n"
+        "  -o <file>      write results here instead of stdout\n"
+        "  -S <seed>      random number seed for every job (default 1)\n"
+        "  -P             count instructions and report where each job spent them\n"
+        "  -t <records>   trace each job's last instructions, written out on a fault\n",
+        DEFAULT_CYCLES_PER_FRAME);
+    exit(2);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* out_path = NULL;
+    size_t repeat = 1;
+    size_t num_specs;
+    JobSpec* specs;
+    Chip8RomStore store;
+    pthread_t* threads;
+    FILE* out = stdout;
+    int opt;
+
+    num_workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+    while ((opt = getopt(argc, argv, "j:n:c:f:i:e:o:S:Pt:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'j': num_workers = atoi(optarg); break;
+            case 'n': repeat = strtoull(optarg, NULL, 10); break;
+            case 'c': max_cycles = strtoull(optarg, NULL, 10); break;
+            case 'f': max_frames = strtoull(optarg, NULL, 10); break;
+            case 'i': cycles_per_frame = strtoul(optarg, NULL, 10); break;
+            case 'e':
+                engine = optarg;
+                if (strcmp(engine, "switch") != 0 && strcmp(engine, "predecode") != 0 &&
+                    strcmp(engine, "jit") != 0 && strcmp(engine, "simd") != 0)
+                {
+                    usage();
+                }
+                break;
+            case 'o': out_path = optarg; break;
+            case 'S': seed = (uint32_t) strtoul(optarg, NULL, 0); break;
+            case 'P': profile = true; break;
+            case 't': trace_records = (uint32_t) strtoul(optarg, NULL, 10); break;
+            default: usage();
+        }
+    }
+    if (optind != argc - 1 || num_workers < 1 || repeat < 1 || cycles_per_frame < 1)
+    {
+        usage();
+    }
+    if (max_cycles == 0 && max_frames == 0)
+    {
+        fprintf(stderr, "Need a cycle or a frame budget\n");
+        exit(2);
+    }
+    if ((profile || trace_records > 0) && strcmp(engine, "simd") == 0)
+    {
+        fprintf(stderr, "-P and -t watch single machines, they don't work with -e simd\n");
+        exit(2);
+    }
+
+    Chip8RomStoreInit(&store);
+    specs = load_jobs(argv[optind], &store, &num_specs);
+    num_jobs = num_specs * repeat;
+    if (num_jobs == 0)
+    {
+        fprintf(stderr, "No jobs\n");
+        exit(2);
+    }
+
+    jobs = calloc(num_jobs, sizeof(Job));
+    workers = calloc(num_workers, sizeof(Worker));
+    threads = malloc(num_workers * sizeof(pthread_t));
+    for (int w = 0; w < num_workers; w++)
+    {
+        pthread_mutex_init(&workers[w].deque.lock, NULL);
+        workers[w].deque.capacity = num_jobs;
+        workers[w].deque.tasks = malloc(num_jobs * sizeof(size_t));
+        workers[w].seed = (unsigned) w * 2654435761u + 1;
+    }
+
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        jobs[i].spec = &specs[i % num_specs];
+    }
+    remaining = num_jobs;
+    if (strcmp(engine, "simd") == 0)
+    {
+        make_groups();
+        remaining = num_groups;
+    }
+
+    // Deal the tasks out round robin, stealing evens out the rest
+    for (size_t i = 0; i < remaining; i++)
+    {
+        deque_push(&workers[i % num_workers].deque, i);
+    }
+
+    double start = now_seconds();
+    for (int w = 0; w < num_workers; w++)
+    {
+        pthread_create(&threads[w], NULL, worker_main, (void*) (intptr_t) w);
+    }
+    for (int w = 0; w < num_workers; w++)
+    {
+        pthread_join(threads[w], NULL);
+    }
+    double elapsed = now_seconds() - start;
+
+    if (out_path != NULL)
+    {
+        out = fopen(out_path, "w");
+        if (out == NULL)
+        {
+            fprintf(stderr, "Unable to open output: %s\n", out_path);
+            exit(2);
+        }
+    }
+
+    uint64_t total = 0, skipped = 0, own_pages = 0;
+    fprintf(out, "job,rom,exit,cycles,frames,fb_hash\n");
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        fprintf(out, "%zu,%s,%s,%llu,%llu,%016llx\n", i, jobs[i].spec->rom,
+                exit_names[jobs[i].exit],
+                (unsigned long long) jobs[i].cycles,
+                (unsigned long long) jobs[i].frames,
+                (unsigned long long) jobs[i].fb_hash);
+        total += jobs[i].cycles;
+        skipped += jobs[i].idle_skipped;
+        own_pages += jobs[i].own_pages;
+    }
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+
+    fprintf(stderr, "%zu jobs, %d threads, %llu instructions in %.3f s = %.2f MIPS\n",
+            num_jobs, num_workers, (unsigned long long) total, elapsed,
+            elapsed > 0 ? total / elapsed / 1e6 : 0.0);
+    fprintf(stderr, "%llu instructions (%.1f%%) skipped in idle loops\n",
+            (unsigned long long) skipped, total > 0 ? 100.0 * skipped / total : 0.0);
+    fprintf(stderr, "%.2f KB of guest memory per job not shared with other jobs\n",
+            (double) own_pages * MEM_PAGE_SIZE / 1024 / num_jobs);
+
+    for (size_t i = 0; i < num_jobs; i++)
+    {
+        if (jobs[i].exit == EXIT_FAULT)
+        {
+            fprintf(stderr, "Job %zu, %s: %s at 0x%03x, opcode %04x\n", i, jobs[i].spec->rom,
+                    Chip8FaultName(jobs[i].fault), jobs[i].fault_pc, jobs[i].fault_opcode);
+        }
+    }
+
+    for (size_t i = 0; i < num_jobs && profile; i++)
+    {
+        fprintf(stderr, "\nJob %zu, %s:\n%s", i, jobs[i].spec->rom, jobs[i].report);
+        free(jobs[i].report);
+    }
+
+    return 0;
+}
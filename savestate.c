@@ -0,0 +1,278 @@
+#include "chip8.h"
+#include "chip8_ops.h"
+#include "savestate.h"
+
+void Chip8InitState(Chip8State* state){
+    memset(state->machine.mem, 0, sizeof(state->machine.mem));
+    memset(state->machine.page_ref, 0, sizeof(state->machine.page_ref));
+}
+
+void Chip8FreeState(Chip8State* state){
+    for (unsigned page = 0; page < MEM_PAGES; page++)
+    {
+        Chip8PageRelease(state->machine.page_ref[page]);
+    }
+    Chip8InitState(state);
+}
+
+// Everything but memory, the same for every kind of restore
+static void restore_machine(CHIP8* chip8, const CHIP8* saved){
+    uint32_t changed = 0;
+
+    for (int row = 0; row < GFX_ROWS; row++)
+    {
+        if (chip8->fb[row] != saved->fb[row])
+        {
+            changed |= 1u << row;
+        }
+    }
+
+    memcpy(chip8, saved, CHIP8_MACHINE_BYTES);
+
+    // The frontend still shows what was there before
+    chip8->dirty_rows |= changed;
+    if (changed != 0)
+    {
+        chip8->draw_flag = true;
+    }
+}
+
+void Chip8SaveSnapshot(const CHIP8* chip8, Chip8State* state){
+    CHIP8* m = &state->machine;
+
+    memcpy(m, chip8, CHIP8_MACHINE_BYTES);
+    for (unsigned page = 0; page < MEM_PAGES; page++)
+    {
+        // Retain first, the state may already hold this very page
+        Chip8PageRetain(chip8->page_ref[page]);
+        Chip8PageRelease(m->page_ref[page]);
+        m->page_ref[page] = chip8->page_ref[page];
+        m->mem[page]      = chip8->mem[page];
+    }
+}
+
+void Chip8RestoreSnapshot(CHIP8* chip8, const Chip8State* state){
+    const CHIP8* saved = &state->machine;
+
+    for (unsigned page = 0; page < MEM_PAGES; page++)
+    {
+        // The same bytes means the same page. A different page can still
+        // hold the same bytes, and then the caches can keep it.
+        if (chip8->mem[page] == saved->mem[page])
+        {
+            continue;
+        }
+        if (memcmp(chip8->mem[page], saved->mem[page], MEM_PAGE_SIZE) != 0)
+        {
+            Chip8InvalidateCode(chip8, page * MEM_PAGE_SIZE, MEM_PAGE_SIZE);
+        }
+        Chip8PageRetain(saved->page_ref[page]);
+        Chip8PageRelease(chip8->page_ref[page]);
+        chip8->page_ref[page] = saved->page_ref[page];
+        chip8->mem[page]      = saved->mem[page];
+    }
+    restore_machine(chip8, saved);
+}
+
+// Field by field, with the struct's padding as zeros: a plain copy would
+// take whatever the padding held, and two flat images of the same machine
+// could differ. A field added before mem has to go in here too.
+#define FLAT_FIELD(name) memcpy(flat + offsetof(CHIP8, name), &chip8->name, sizeof(chip8->name))
+
+void Chip8SaveFlat(const CHIP8* chip8, uint8_t flat[CHIP8_FLAT_BYTES]){
+    memset(flat, 0, CHIP8_MACHINE_BYTES);
+    FLAT_FIELD(opcode);
+    FLAT_FIELD(registers);
+    FLAT_FIELD(IndexRegister);
+    FLAT_FIELD(PC);
+    FLAT_FIELD(fb);
+    FLAT_FIELD(DelayTimer);
+    FLAT_FIELD(SoundTimer);
+    FLAT_FIELD(stack);
+    FLAT_FIELD(stkptr);
+    FLAT_FIELD(key);
+    FLAT_FIELD(draw_flag);
+    FLAT_FIELD(dirty_rows);
+    FLAT_FIELD(waiting);
+    FLAT_FIELD(fault);
+    FLAT_FIELD(rng);
+    FLAT_FIELD(ticks);
+    FLAT_FIELD(cycles);
+    Chip8ReadMemory(chip8, 0, flat + CHIP8_MACHINE_BYTES, MEM_SIZE);
+}
+
+#undef FLAT_FIELD
+
+void Chip8RestoreFlat(CHIP8* chip8, const uint8_t flat[CHIP8_FLAT_BYTES]){
+    CHIP8 saved;
+
+    memcpy(&saved, flat, CHIP8_MACHINE_BYTES);
+    Chip8WriteMemory(chip8, 0, flat + CHIP8_MACHINE_BYTES, MEM_SIZE);
+    restore_machine(chip8, &saved);
+}
+
+// ---- serialized format ----
+
+static uint8_t* put(uint8_t* p, uint64_t value, int bytes){
+    for (int i = 0; i < bytes; i++)
+    {
+        *p++ = (uint8_t) (value >> (8 * i));
+    }
+    return p;
+}
+
+static const uint8_t* get(const uint8_t* p, uint64_t* value, int bytes){
+    *value = 0;
+    for (int i = 0; i < bytes; i++)
+    {
+        *value |= (uint64_t) *p++ << (8 * i);
+    }
+    return p;
+}
+
+void Chip8SerializeState(const CHIP8* chip8, uint8_t buf[CHIP8_SAVE_SIZE]){
+    uint8_t* p = buf;
+
+    memcpy(p, CHIP8_STATE_MAGIC, 4);
+    p += 4;
+    p = put(p, CHIP8_STATE_VERSION, 4);
+
+    p = put(p, chip8->opcode, 2);
+    Chip8ReadMemory(chip8, 0, p, MEM_SIZE);
+    p += MEM_SIZE;
+    memcpy(p, chip8->registers, 16);
+    p += 16;
+    p = put(p, chip8->IndexRegister, 2);
+    p = put(p, chip8->PC, 2);
+    for (int row = 0; row < GFX_ROWS; row++)
+    {
+        p = put(p, chip8->fb[row], 8);
+    }
+    p = put(p, chip8->DelayTimer, 1);
+    p = put(p, chip8->SoundTimer, 1);
+    for (int s = 0; s < STACK_SIZE; s++)
+    {
+        p = put(p, chip8->stack[s], 2);
+    }
+    p = put(p, chip8->stkptr, 2);
+    memcpy(p, chip8->key, KEYPAD_SIZE);
+    p += KEYPAD_SIZE;
+    p = put(p, chip8->draw_flag, 1);
+    p = put(p, chip8->dirty_rows, 4);
+    p = put(p, chip8->waiting, 1);
+    p = put(p, chip8->rng, 4);
+    p = put(p, chip8->ticks, 4);
+    p = put(p, chip8->cycles, 8);
+    put(p, chip8->fault, 1);
+}
+
+bool Chip8DeserializeState(CHIP8* chip8, const uint8_t* buf, size_t size){
+    CHIP8 state;
+    CHIP8* m = &state;
+    uint8_t memory[MEM_SIZE];
+    const uint8_t* p = buf;
+    uint64_t v, version;
+
+    if (size < 8 || memcmp(p, CHIP8_STATE_MAGIC, 4) != 0)
+    {
+        return false;
+    }
+    p = get(p + 4, &version, 4);
+    if (!(version == 1 && size == CHIP8_SAVE_SIZE_V1) &&
+        !(version == 2 && size == CHIP8_SAVE_SIZE_V2) &&
+        !(version == CHIP8_STATE_VERSION && size == CHIP8_SAVE_SIZE))
+    {
+        return false;
+    }
+
+    // Start from the current machine so the struct padding is defined too
+    memcpy(m, chip8, CHIP8_MACHINE_BYTES);
+
+    p = get(p, &v, 2);  m->opcode = (uint16_t) v;
+    memcpy(memory, p, MEM_SIZE);
+    p += MEM_SIZE;
+    memcpy(m->registers, p, 16);
+    p += 16;
+    p = get(p, &v, 2);  m->IndexRegister = (uint16_t) v;
+    p = get(p, &v, 2);  m->PC = (uint16_t) v;
+    for (int row = 0; row < GFX_ROWS; row++)
+    {
+        p = get(p, &m->fb[row], 8);
+    }
+    p = get(p, &v, 1);  m->DelayTimer = (uint8_t) v;
+    p = get(p, &v, 1);  m->SoundTimer = (uint8_t) v;
+    for (int s = 0; s < STACK_SIZE; s++)
+    {
+        p = get(p, &v, 2);  m->stack[s] = (uint16_t) v;
+    }
+    p = get(p, &v, 2);  m->stkptr = (uint16_t) v;
+    memcpy(m->key, p, KEYPAD_SIZE);
+    p += KEYPAD_SIZE;
+    p = get(p, &v, 1);  m->draw_flag = v != 0;
+    p = get(p, &v, 4);  m->dirty_rows = (uint32_t) v;
+    p = get(p, &v, 1);  m->waiting = v != 0;
+    if (version >= 2)
+    {
+        p = get(p, &v, 4);  m->rng = (uint32_t) v;
+        p = get(p, &v, 4);  m->ticks = (uint32_t) v;
+        p = get(p, &m->cycles, 8);
+    }
+    m->fault = CHIP8_OK;
+    if (version >= 3)
+    {
+        get(p, &v, 1);  m->fault = (uint8_t) v;
+    }
+
+    // EmulateCycle trusts these to stay in range, and a fault always halts
+    if (m->PC > MEM_MASK || m->stkptr > STACK_SIZE || m->rng == 0 ||
+        m->fault >= CHIP8_FAULT_COUNT || (m->fault != CHIP8_OK && !m->waiting))
+    {
+        return false;
+    }
+
+    Chip8WriteMemory(chip8, 0, memory, MEM_SIZE);
+    restore_machine(chip8, m);
+    return true;
+}
+
+bool Chip8SaveStateFile(const CHIP8* chip8, const char* path){
+    uint8_t buf[CHIP8_SAVE_SIZE];
+    FILE* fptr = fopen(path, "wb");
+
+    if (fptr == NULL)
+    {
+        fprintf(stderr, "Unable to write state: %s\n", path);
+        return false;
+    }
+
+    Chip8SerializeState(chip8, buf);
+    bool ok = fwrite(buf, 1, sizeof(buf), fptr) == sizeof(buf);
+    ok = fclose(fptr) == 0 && ok;
+    if (!ok)
+    {
+        fprintf(stderr, "Unable to write state: %s\n", path);
+    }
+    return ok;
+}
+
+bool Chip8LoadStateFile(CHIP8* chip8, const char* path){
+    uint8_t buf[CHIP8_SAVE_SIZE + 1];           // one over, to catch files that are too long
+    FILE* fptr = fopen(path, "rb");
+    size_t size;
+
+    if (fptr == NULL)
+    {
+        fprintf(stderr, "Unable to open state: %s\n", path);
+        return false;
+    }
+
+    size = fread(buf, 1, sizeof(buf), fptr);
+    fclose(fptr);
+
+    if (!Chip8DeserializeState(chip8, buf, size))
+    {
+        fprintf(stderr, "Not a state file this build can read: %s\n", path);
+        return false;
+    }
+    return true;
+}
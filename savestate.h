@@ -0,0 +1,74 @@
+// Save states. A Chip8State is the machine part of a CHIP8 (everything
+// before the memory pages) copied as is, plus a reference to each memory
+// page, so taking one copies no memory at all: the machine gets a copy of a
+// page the next time it writes there. Restoring only tells the predecode
+// cache and the JIT about pages that are actually different, so jumping
+// between states of one game keeps its code cached.
+//
+// A flat copy (machine and all of memory as plain bytes) is there for code
+// that wants to look at the bytes, like the rewind buffer's deltas.
+//
+// For files (or anything else that leaves the process) there is a versioned
+// little-endian format instead, which doesn't depend on the host's struct
+// layout.
+
+#ifndef CHIP_8_SAVESTATE
+#define CHIP_8_SAVESTATE
+
+#include "chip8.h"
+
+#include <stddef.h>
+
+// Everything in CHIP8 that makes up the machine apart from memory, as
+// opposed to the pages and the caches
+#define CHIP8_MACHINE_BYTES offsetof(CHIP8, mem)
+
+// A flat copy: CHIP8_MACHINE_BYTES of machine, its padding zeroed so the same
+// machine always gives the same bytes, then MEM_SIZE of memory
+#define CHIP8_FLAT_BYTES (CHIP8_MACHINE_BYTES + MEM_SIZE)
+
+#define CHIP8_STATE_MAGIC   "C8SS"
+#define CHIP8_STATE_VERSION 3
+
+// Bytes in the serialized format: magic, version, then the fields in
+// CHIP8 order. Version 2 added rng, ticks and cycles on the end, version 3
+// the fault.
+#define CHIP8_SAVE_SIZE_V1 (4 + 4 + 2 + MEM_SIZE + 16 + 2 + 2 + 8 * GFX_ROWS + 1 + 1 + \
+                            2 * STACK_SIZE + 2 + KEYPAD_SIZE + 1 + 4 + 1)
+#define CHIP8_SAVE_SIZE_V2 (CHIP8_SAVE_SIZE_V1 + 4 + 4 + 8)
+#define CHIP8_SAVE_SIZE (CHIP8_SAVE_SIZE_V2 + 1)
+
+typedef struct
+{
+    CHIP8       machine;                        // only the fields before predecode are used
+} Chip8State;
+
+// A state holds on to memory pages, so it needs setting up before the first
+// snapshot and freeing after the last
+void Chip8InitState(Chip8State* state);
+void Chip8FreeState(Chip8State* state);
+
+// In-memory snapshot and restore. Restore leaves the caches enabled on
+// chip8 alone and marks the display rows that changed as dirty. Taking a
+// snapshot into a state drops what it held before.
+void Chip8SaveSnapshot(const CHIP8* chip8, Chip8State* state);
+void Chip8RestoreSnapshot(CHIP8* chip8, const Chip8State* state);
+
+// The same through a flat copy
+void Chip8SaveFlat(const CHIP8* chip8, uint8_t flat[CHIP8_FLAT_BYTES]);
+void Chip8RestoreFlat(CHIP8* chip8, const uint8_t flat[CHIP8_FLAT_BYTES]);
+
+// Writes CHIP8_SAVE_SIZE bytes to buf
+void Chip8SerializeState(const CHIP8* chip8, uint8_t buf[CHIP8_SAVE_SIZE]);
+
+// Loads a serialized state into chip8. Returns false, leaving chip8 alone,
+// when size, magic or version don't match or the state makes no sense.
+// Version 1 states keep chip8's own rng and clocks.
+bool Chip8DeserializeState(CHIP8* chip8, const uint8_t* buf, size_t size);
+
+// The same through a file. Both return false (and say why on stderr) when
+// the file can't be written or read or isn't a valid state.
+bool Chip8SaveStateFile(const CHIP8* chip8, const char* path);
+bool Chip8LoadStateFile(CHIP8* chip8, const char* path);
+
+#endif
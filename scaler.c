@@ -0,0 +1,161 @@
+#include "scaler.h"
+
+bool Chip8ScalerResize(Chip8Scaler* scaler, int width, int height, Chip8Filter filter){
+    int cols = filter == SCALER_SCALE2X ? 2 * GFX_COLS : GFX_COLS;
+    int rows = filter == SCALER_SCALE2X ? 2 * GFX_ROWS : GFX_ROWS;
+    uint8_t* rgb;
+
+    if (width < 1 || height < 1 || width > UINT16_MAX || height > UINT16_MAX)
+    {
+        return false;
+    }
+
+    rgb = realloc(scaler->rgb, (size_t) width * height * 3);
+    if (rgb == NULL)
+    {
+        Chip8ScalerFree(scaler);
+        return false;
+    }
+
+    scaler->rgb    = rgb;
+    scaler->width  = width;
+    scaler->height = height;
+    scaler->filter = filter;
+
+    // Source column c covers output x in [col_edge[c], col_edge[c + 1]).
+    // Non-integer scales just make some spans one wider than others.
+    for (int c = 0; c <= cols; c++)
+    {
+        scaler->col_edge[c] = (uint16_t) ((long) c * width / cols);
+    }
+    for (int r = 0; r <= rows; r++)
+    {
+        scaler->row_edge[r] = (uint16_t) ((long) r * height / rows);
+    }
+    return true;
+}
+
+void Chip8ScalerFree(Chip8Scaler* scaler){
+    free(scaler->rgb);
+    scaler->rgb    = NULL;
+    scaler->width  = 0;
+    scaler->height = 0;
+}
+
+uint32_t Chip8ScalerAffected(const Chip8Scaler* scaler, uint32_t rows){
+    if (scaler->filter == SCALER_SCALE2X)
+    {
+        rows |= rows << 1 | rows >> 1;
+    }
+    return rows;
+}
+
+// Moves bit k of the low 32 bits to bit 2k
+static uint64_t spread_bits(uint64_t x){
+    x &= 0xFFFFFFFF;
+    x = (x | x << 16) & 0x0000FFFF0000FFFFULL;
+    x = (x | x << 8)  & 0x00FF00FF00FF00FFULL;
+    x = (x | x << 4)  & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | x << 2)  & 0x3333333333333333ULL;
+    x = (x | x << 1)  & 0x5555555555555555ULL;
+    return x;
+}
+
+// Two packed rows side by side into one row twice as wide: out column 2c is
+// left column c, 2c + 1 is right column c
+static void interleave(uint64_t left, uint64_t right, uint64_t out[2]){
+    out[0] = spread_bits(left >> 32) << 1 | spread_bits(right >> 32);
+    out[1] = spread_bits(left) << 1 | spread_bits(right);
+}
+
+// Scale2x (AdvMAME2x) on display row r, 64 pixels at a time. With one bit
+// per pixel "equal" is just XNOR, so every rule is a handful of word ops.
+// Edges repeat the border pixel.
+static void scale2x_row(const uint64_t fb[GFX_ROWS], int r, uint64_t top[2], uint64_t bottom[2]){
+    const uint64_t first = 1ULL << (GFX_COLS - 1);
+    uint64_t P = fb[r];
+    uint64_t A = r > 0 ? fb[r - 1] : P;                         // above
+    uint64_t D = r < GFX_ROWS - 1 ? fb[r + 1] : P;              // below
+    uint64_t C = (P >> 1) | (P & first);                        // left
+    uint64_t B = (P << 1) | (P & 1);                            // right
+    uint64_t CA = ~(C ^ A), AB = ~(A ^ B), DC = ~(D ^ C), BD = ~(B ^ D);
+    uint64_t pick;
+    uint64_t E0, E1, E2, E3;
+
+    pick = CA & ~DC & ~AB;  E0 = (pick & A) | (~pick & P);
+    pick = AB & ~CA & ~BD;  E1 = (pick & B) | (~pick & P);
+    pick = DC & ~BD & ~CA;  E2 = (pick & C) | (~pick & P);
+    pick = BD & ~AB & ~DC;  E3 = (pick & D) | (~pick & P);
+
+    interleave(E0, E1, top);
+    interleave(E2, E3, bottom);
+}
+
+// Fills one output line from a packed source row of `cols` pixels, one
+// memset per run of equal pixels
+static void render_line(const Chip8Scaler* scaler, const uint64_t* words, int cols, uint8_t* line){
+    int start = 0;
+    int on = (int) (words[0] >> 63);
+
+    for (int c = 1; c <= cols; c++)
+    {
+        int bit = c < cols ? (int) ((words[c / 64] >> (63 - c % 64)) & 1) : !on;
+
+        if (bit != on)
+        {
+            int x0 = scaler->col_edge[start], x1 = scaler->col_edge[c];
+            memset(line + 3 * x0, scaler->colors[on], 3 * (size_t) (x1 - x0));
+            start = c;
+            on = bit;
+        }
+    }
+}
+
+// Draws source row r (of the filtered image) into every output line it covers
+static void render_row(Chip8Scaler* scaler, const uint64_t* words, int cols, int r){
+    size_t pitch = 3 * (size_t) scaler->width;
+    int y0 = scaler->row_edge[r], y1 = scaler->row_edge[r + 1];
+
+    if (y0 == y1)
+    {
+        return;
+    }
+
+    // rgb is bottom line first, so the block for this row runs upwards
+    // from line height - y1
+    uint8_t* line = scaler->rgb + (size_t) (scaler->height - y1) * pitch;
+    render_line(scaler, words, cols, line);
+    for (int y = y0 + 1; y < y1; y++)
+    {
+        memcpy(line + (size_t) (y - y0) * pitch, line, pitch);
+    }
+}
+
+void Chip8ScalerRender(Chip8Scaler* scaler, const uint64_t fb[GFX_ROWS], int first, int end,
+                       int* line, int* count){
+    int src_first = first, src_end = end;
+
+    if (scaler->filter == SCALER_SCALE2X)
+    {
+        for (int r = first; r < end; r++)
+        {
+            uint64_t top[2], bottom[2];
+
+            scale2x_row(fb, r, top, bottom);
+            render_row(scaler, top, 2 * GFX_COLS, 2 * r);
+            render_row(scaler, bottom, 2 * GFX_COLS, 2 * r + 1);
+        }
+        src_first = 2 * first;
+        src_end = 2 * end;
+    }
+    else
+    {
+        for (int r = first; r < end; r++)
+        {
+            render_row(scaler, &fb[r], GFX_COLS, r);
+        }
+    }
+
+    *line  = scaler->height - scaler->row_edge[src_end];
+    *count = scaler->row_edge[src_end] - scaler->row_edge[src_first];
+}
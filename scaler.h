@@ -0,0 +1,43 @@
+// Expands the 64x32 display into an RGB buffer of any size for a frontend.
+// Where every source column and row starts in the output is worked out once
+// per size, so a 7.5x scale costs the same as a 10x one. Each source row is
+// drawn as one output line of memset spans, one span per run of equal
+// pixels, and that line is then copied down the rest of the rows it covers.
+
+#ifndef CHIP_8_SCALER
+#define CHIP_8_SCALER
+
+#include "chip8.h"
+
+typedef enum
+{
+    SCALER_NEAREST = 0,                         // plain blocks
+    SCALER_SCALE2X,                             // Scale2x first, then nearest
+} Chip8Filter;
+
+typedef struct
+{
+    uint8_t*    rgb;                            // width * height * 3, bottom line first like GL
+    int         width;
+    int         height;
+    Chip8Filter filter;
+    uint8_t     colors[2];                      // grey level for pixels off and on
+    uint16_t    col_edge[2 * GFX_COLS + 1];     // output x where each source column starts
+    uint16_t    row_edge[2 * GFX_ROWS + 1];     // output y (from the top) of each source row
+} Chip8Scaler;
+
+// (Re)sizes the output. Start from a zeroed Chip8Scaler with colors set.
+// Returns false when out of memory, leaving the scaler empty.
+bool Chip8ScalerResize(Chip8Scaler* scaler, int width, int height, Chip8Filter filter);
+void Chip8ScalerFree(Chip8Scaler* scaler);
+
+// Display rows whose output has to be redrawn when `rows` changed. Scale2x
+// looks at the rows above and below, so it spreads by one.
+uint32_t Chip8ScalerAffected(const Chip8Scaler* scaler, uint32_t rows);
+
+// Redraws the output for display rows [first, end) from fb, and says which
+// lines of rgb that was: *count lines from line *line
+void Chip8ScalerRender(Chip8Scaler* scaler, const uint64_t fb[GFX_ROWS], int first, int end,
+                       int* line, int* count);
+
+#endif
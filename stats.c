@@ -0,0 +1,151 @@
+#include "stats.h"
+#include "chip8_ops.h"
+
+static const char* op_names[OP_COUNT] =
+{
+    [OP_DECODE] = "-", [OP_FALLBACK] = "Fx0A/other",
+    [OP_00E0] = "00E0", [OP_00EE] = "00EE",
+    [OP_1nnn] = "1nnn", [OP_2nnn] = "2nnn", [OP_3xkk] = "3xkk", [OP_4xkk] = "4xkk",
+    [OP_5xy0] = "5xy0", [OP_6xkk] = "6xkk", [OP_7xkk] = "7xkk",
+    [OP_8xy0] = "8xy0", [OP_8xy1] = "8xy1", [OP_8xy2] = "8xy2", [OP_8xy3] = "8xy3",
+    [OP_8xy4] = "8xy4", [OP_8xy5] = "8xy5", [OP_8xy6] = "8xy6", [OP_8xy7] = "8xy7",
+    [OP_8xyE] = "8xyE",
+    [OP_9xy0] = "9xy0", [OP_Annn] = "Annn", [OP_Bnnn] = "Bnnn", [OP_Cxkk] = "Cxkk",
+    [OP_Dxyn] = "Dxyn",
+    [OP_Ex9E] = "Ex9E", [OP_ExA1] = "ExA1",
+    [OP_Fx07] = "Fx07", [OP_Fx15] = "Fx15", [OP_Fx18] = "Fx18", [OP_Fx1E] = "Fx1E",
+    [OP_Fx29] = "Fx29", [OP_Fx33] = "Fx33", [OP_Fx55] = "Fx55", [OP_Fx65] = "Fx65",
+};
+
+typedef struct
+{
+    uint16_t    index;                          // Chip8Op or address
+    uint64_t    count;
+} Entry;
+
+void Chip8EnableStats(CHIP8* chip8){
+    if (chip8->stats != NULL)
+    {
+        return;
+    }
+
+    chip8->stats = calloc(1, sizeof(struct Chip8Stats));
+    if (chip8->stats == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+}
+
+void Chip8DisableStats(CHIP8* chip8){
+    free(chip8->stats);
+    chip8->stats = NULL;
+}
+
+void Chip8ResetStats(CHIP8* chip8){
+    if (chip8->stats != NULL)
+    {
+        memset(chip8->stats, 0, sizeof(struct Chip8Stats));
+    }
+}
+
+void Chip8Count(CHIP8* chip8, uint16_t pc){
+    struct Chip8Stats* stats = chip8->stats;
+    Chip8Decoded d;
+
+    Chip8Decode(chip8->opcode, &d);
+    stats->instructions++;
+    stats->ops[d.op]++;
+    stats->pc_hits[pc & MEM_MASK]++;
+    if (d.op == OP_Dxyn)
+    {
+        stats->draws++;
+        stats->sprite_rows += d.kk & 0xF;
+        stats->collisions += chip8->registers[0xF];
+    }
+    else if (d.op == OP_00E0)
+    {
+        stats->clears++;
+    }
+}
+
+static int by_count(const void* a, const void* b){
+    const Entry* x = a;
+    const Entry* y = b;
+
+    if (x->count != y->count)
+    {
+        return x->count < y->count ? 1 : -1;
+    }
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+static double percent(uint64_t part, uint64_t whole){
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+void Chip8StatsReport(const CHIP8* chip8, FILE* out, unsigned top){
+    const struct Chip8Stats* stats = chip8->stats;
+    Entry ops[OP_COUNT];
+    Entry* pcs;
+    unsigned num_ops = 0, num_pcs = 0;
+
+    if (stats == NULL)
+    {
+        fprintf(out, "No counters enabled\n");
+        return;
+    }
+
+    fprintf(out, "%llu instructions counted, %llu skipped in idle loops while not counting\n",
+            (unsigned long long) stats->instructions, (unsigned long long) chip8->idle_skipped);
+    fprintf(out, "%llu draws (%llu sprite rows, %llu collisions), %llu clears\n",
+            (unsigned long long) stats->draws, (unsigned long long) stats->sprite_rows,
+            (unsigned long long) stats->collisions, (unsigned long long) stats->clears);
+
+    for (unsigned op = 0; op < OP_COUNT; op++)
+    {
+        if (stats->ops[op] != 0)
+        {
+            ops[num_ops].index = (uint16_t) op;
+            ops[num_ops].count = stats->ops[op];
+            num_ops++;
+        }
+    }
+    qsort(ops, num_ops, sizeof(Entry), by_count);
+
+    fprintf(out, "\nBy opcode:\n");
+    for (unsigned i = 0; i < num_ops; i++)
+    {
+        fprintf(out, "  %-10s %12llu  %5.1f%%\n", op_names[ops[i].index],
+                (unsigned long long) ops[i].count, percent(ops[i].count, stats->instructions));
+    }
+
+    pcs = malloc(MEM_SIZE * sizeof(Entry));
+    if (pcs == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (unsigned pc = 0; pc < MEM_SIZE; pc++)
+    {
+        if (stats->pc_hits[pc] != 0)
+        {
+            pcs[num_pcs].index = (uint16_t) pc;
+            pcs[num_pcs].count = stats->pc_hits[pc];
+            num_pcs++;
+        }
+    }
+    qsort(pcs, num_pcs, sizeof(Entry), by_count);
+
+    fprintf(out, "\nBusiest of %u addresses:\n", num_pcs);
+    for (unsigned i = 0; i < num_pcs && i < top; i++)
+    {
+        uint16_t pc = pcs[i].index;
+
+        // What is there now, which is what ran unless the ROM rewrote it
+        fprintf(out, "  0x%03x  %04x %12llu  %5.1f%%\n", pc,
+                fetch_opcode(chip8, pc),
+                (unsigned long long) pcs[i].count, percent(pcs[i].count, stats->instructions));
+    }
+    free(pcs);
+}
@@ -0,0 +1,44 @@
+// Execution counters. While a machine has them enabled, Chip8Run counts
+// every instruction by opcode and by address, plus the draws and clears, and
+// a report shows where the ROM spends its time.
+//
+// Counting costs nothing while it's off: Chip8Run checks chip8->stats once
+// per call, not once per instruction, and no core has any counting code in
+// it. While it's on, Chip8Run steps EmulateCycle instead of using the fast
+// cores and doesn't skip idle loops, so every instruction that runs is seen.
+// The machine ends up in exactly the same state either way.
+
+#ifndef CHIP_8_STATS
+#define CHIP_8_STATS
+
+#include "chip8.h"
+#include "predecode.h"
+
+#define STATS_DEFAULT_TOP 16
+
+struct Chip8Stats
+{
+    uint64_t    instructions;                   // counted so far
+    uint64_t    ops[OP_COUNT];                  // by Chip8Op, Fx0A and bad opcodes under OP_FALLBACK
+    uint64_t    pc_hits[MEM_SIZE];              // by the address the instruction was at
+    uint64_t    draws;                          // Dxyn
+    uint64_t    sprite_rows;                    // rows those draws covered
+    uint64_t    collisions;                     // draws that set VF
+    uint64_t    clears;                         // 00E0
+};
+
+// Enable allocates the counters (about 33 KB) starting from zero, and does
+// nothing if they are on already. Both are fine to call at any point, also
+// between two Chip8Run calls. Disable before freeing a machine that has them.
+void Chip8EnableStats(CHIP8* chip8);
+void Chip8DisableStats(CHIP8* chip8);
+void Chip8ResetStats(CHIP8* chip8);
+
+// Counts the instruction at pc that just ran
+void Chip8Count(CHIP8* chip8, uint16_t pc);
+
+// Writes a summary to out: the totals, every opcode that ran by count, and
+// the `top` busiest addresses with the instruction at each
+void Chip8StatsReport(const CHIP8* chip8, FILE* out, unsigned top);
+
+#endif
@@ -0,0 +1,97 @@
+// Threaded-code core. Used instead of the handler-call loop in predecode.c
+// when built with CHIP8_THREADED defined (`CORE=threaded ./build.sh`). Needs
+// GCC or clang for labels-as-values.
+//
+// It walks the same predecode cache, but every handler body ends in its own
+// copy of the dispatch, so each instruction costs one indirect jump and the
+// branch predictor gets one history per opcode instead of one shared switch.
+
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+#include "chip8.h"
+#include "chip8_ops.h"
+#include "predecode.h"
+#include "handlers.h"
+
+void Chip8RunThreaded(CHIP8* chip8, uint32_t cycles){
+    static const void* labels[OP_COUNT] =
+    {
+        [OP_DECODE]   = &&do_decode,
+        [OP_FALLBACK] = &&do_fallback,
+        [OP_00E0] = &&do_00E0, [OP_00EE] = &&do_00EE,
+        [OP_1nnn] = &&do_1nnn, [OP_2nnn] = &&do_2nnn, [OP_3xkk] = &&do_3xkk,
+        [OP_4xkk] = &&do_4xkk, [OP_5xy0] = &&do_5xy0, [OP_6xkk] = &&do_6xkk,
+        [OP_7xkk] = &&do_7xkk,
+        [OP_8xy0] = &&do_8xy0, [OP_8xy1] = &&do_8xy1, [OP_8xy2] = &&do_8xy2,
+        [OP_8xy3] = &&do_8xy3, [OP_8xy4] = &&do_8xy4, [OP_8xy5] = &&do_8xy5,
+        [OP_8xy6] = &&do_8xy6, [OP_8xy7] = &&do_8xy7, [OP_8xyE] = &&do_8xyE,
+        [OP_9xy0] = &&do_9xy0, [OP_Annn] = &&do_Annn, [OP_Bnnn] = &&do_Bnnn,
+        [OP_Cxkk] = &&do_Cxkk, [OP_Dxyn] = &&do_Dxyn,
+        [OP_Ex9E] = &&do_Ex9E, [OP_ExA1] = &&do_ExA1,
+        [OP_Fx07] = &&do_Fx07, [OP_Fx15] = &&do_Fx15, [OP_Fx18] = &&do_Fx18,
+        [OP_Fx1E] = &&do_Fx1E, [OP_Fx29] = &&do_Fx29, [OP_Fx33] = &&do_Fx33,
+        [OP_Fx55] = &&do_Fx55, [OP_Fx65] = &&do_Fx65,
+    };
+    Chip8Decoded* entries = chip8->predecode->entries;
+    Chip8Decoded* d;
+    unsigned offset;
+
+// Fetch the next cached entry and jump straight to its body. Addresses that
+// are not cached (odd, below 0x200 or in the guard slots) take the slow path.
+#define DISPATCH() \
+    do \
+    { \
+        if (cycles-- == 0) goto out; \
+        offset = (unsigned) chip8->PC - PREDECODE_BASE; \
+        if ((offset & 1) || offset >= MEM_PC_GUARD - PREDECODE_BASE) goto slow; \
+        d = &entries[offset / 2]; \
+        chip8->opcode = d->opcode; \
+        goto *labels[d->op]; \
+    } while (0)
+
+#define OP(name) do_##name: exec_##name(chip8, d); DISPATCH();
+
+// For the handlers that can fault through EmulateCycle
+#define OP_HALTS(name) do_##name: exec_##name(chip8, d); if (chip8->waiting) goto out; DISPATCH();
+
+    DISPATCH();
+
+    OP_HALTS(00EE) OP_HALTS(2nnn) OP_HALTS(Ex9E) OP_HALTS(ExA1)
+    OP(00E0) OP(3xkk) OP(4xkk) OP(5xy0) OP(6xkk) OP(7xkk)
+    OP(8xy0) OP(8xy1) OP(8xy2) OP(8xy3) OP(8xy4) OP(8xy5) OP(8xy6) OP(8xy7) OP(8xyE)
+    OP(9xy0) OP(Annn) OP(Bnnn) OP(Cxkk) OP(Dxyn)
+    OP(Fx07) OP(Fx15) OP(Fx18) OP(Fx1E) OP(Fx29) OP(Fx33) OP(Fx55) OP(Fx65)
+
+do_decode:
+    Chip8Decode(fetch_opcode(chip8, chip8->PC), d);
+    chip8->opcode = d->opcode;
+    goto *labels[d->op];
+
+do_1nnn:
+    exec_1nnn(chip8, d);
+    if (d->nnn <= PREDECODE_BASE + offset)
+    {
+        cycles -= Chip8SkipIdle(chip8, cycles);
+    }
+    DISPATCH();
+
+do_fallback:
+slow:
+    EmulateCycle(chip8);
+    if (chip8->waiting)
+    {
+        goto out;
+    }
+    if ((chip8->opcode & 0xF000) == 0x1000 && chip8->PC <= PREDECODE_BASE + offset)
+    {
+        cycles -= Chip8SkipIdle(chip8, cycles);
+    }
+    DISPATCH();
+
+out:
+    return;
+
+#undef OP
+#undef OP_HALTS
+#undef DISPATCH
+}
@@ -0,0 +1,183 @@
+#include "trace.h"
+
+void Chip8EnableTrace(CHIP8* chip8, uint32_t records, const char* fault_path){
+    struct Chip8Trace* trace;
+    uint32_t capacity = 1;
+
+    if (chip8->trace != NULL)
+    {
+        return;
+    }
+    while (capacity < records && capacity < (1u << 31))
+    {
+        capacity <<= 1;
+    }
+
+    trace = calloc(1, sizeof(struct Chip8Trace));
+    if (trace == NULL || (trace->records = malloc(capacity * sizeof(Chip8TraceRecord))) == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    trace->mask = capacity - 1;
+    if (fault_path != NULL)
+    {
+        trace->fault_path = malloc(strlen(fault_path) + 1);
+        if (trace->fault_path == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+        strcpy(trace->fault_path, fault_path);
+    }
+    chip8->trace = trace;
+}
+
+void Chip8DisableTrace(CHIP8* chip8){
+    if (chip8->trace != NULL)
+    {
+        free(chip8->trace->records);
+        free(chip8->trace->fault_path);
+        free(chip8->trace);
+        chip8->trace = NULL;
+    }
+}
+
+void Chip8TraceStep(CHIP8* chip8, uint16_t pc, const uint8_t before[16]){
+    struct Chip8Trace* trace = chip8->trace;
+    Chip8TraceRecord* r = &trace->records[trace->written++ & trace->mask];
+    uint64_t lo, hi, was_lo, was_hi;
+
+    r->cycle  = trace->cycle;
+    r->pc     = pc;
+    r->opcode = chip8->opcode;
+    r->I      = chip8->IndexRegister;
+    r->reg    = 0;
+    r->value  = 0;
+
+    // Which registers changed, eight at a time. Most instructions change
+    // none or one, so this is usually two compares.
+    memcpy(&lo, chip8->registers, 8);
+    memcpy(&hi, chip8->registers + 8, 8);
+    memcpy(&was_lo, before, 8);
+    memcpy(&was_hi, before + 8, 8);
+    if (lo != was_lo || hi != was_hi)
+    {
+        int first = -1, changed = 0;
+
+        // VF comes last, so 8xy4 and friends report Vx rather than the flag
+        for (int reg = 0; reg < 16; reg++)
+        {
+            if (chip8->registers[reg] != before[reg])
+            {
+                if (first < 0)
+                {
+                    first = reg;
+                }
+                changed++;
+            }
+        }
+        r->reg   = (uint8_t) (first | TRACE_REG_CHANGED | (changed > 1 ? TRACE_REG_MORE : 0));
+        r->value = chip8->registers[first];
+    }
+}
+
+// ---- dump file ----
+
+static uint8_t* put(uint8_t* p, uint64_t value, int bytes){
+    for (int i = 0; i < bytes; i++)
+    {
+        *p++ = (uint8_t) (value >> (8 * i));
+    }
+    return p;
+}
+
+static uint64_t get(const uint8_t* p, int bytes){
+    uint64_t value = 0;
+
+    for (int i = 0; i < bytes; i++)
+    {
+        value |= (uint64_t) p[i] << (8 * i);
+    }
+    return value;
+}
+
+bool Chip8TraceDump(const CHIP8* chip8, const char* path){
+    const struct Chip8Trace* trace = chip8->trace;
+    uint8_t buf[TRACE_HEADER_SIZE];
+    uint64_t first, count;
+    FILE* fptr;
+
+    if (trace == NULL)
+    {
+        fprintf(stderr, "Tracing is off, nothing to dump\n");
+        return false;
+    }
+    count = trace->written < (uint64_t) trace->mask + 1 ? trace->written : (uint64_t) trace->mask + 1;
+    first = trace->written - count;
+
+    fptr = fopen(path, "wb");
+    if (fptr == NULL)
+    {
+        fprintf(stderr, "Unable to write trace: %s\n", path);
+        return false;
+    }
+
+    memcpy(buf, TRACE_MAGIC, 4);
+    put(buf + 4, TRACE_VERSION, 4);
+    put(buf + 8, count, 4);
+    put(buf + 12, 0, 4);
+    fwrite(buf, 1, TRACE_HEADER_SIZE, fptr);
+
+    for (uint64_t i = first; i < trace->written; i++)
+    {
+        const Chip8TraceRecord* r = &trace->records[i & trace->mask];
+        uint8_t rec[TRACE_RECORD_SIZE];
+        uint8_t* p = rec;
+
+        p = put(p, r->cycle, 8);
+        p = put(p, r->pc, 2);
+        p = put(p, r->opcode, 2);
+        p = put(p, r->I, 2);
+        p = put(p, r->reg, 1);
+        put(p, r->value, 1);
+        fwrite(rec, 1, TRACE_RECORD_SIZE, fptr);
+    }
+
+    if (ferror(fptr) | fclose(fptr))
+    {
+        fprintf(stderr, "Unable to write trace: %s\n", path);
+        return false;
+    }
+    fprintf(stderr, "Wrote the last %llu instructions to %s\n", (unsigned long long) count, path);
+    return true;
+}
+
+void Chip8TraceFault(CHIP8* chip8){
+    struct Chip8Trace* trace = chip8->trace;
+    Chip8TraceRecord* r;
+
+    if (trace == NULL || trace->fault_path == NULL)
+    {
+        return;
+    }
+
+    // The bad instruction never finished, so it goes in as it was found
+    r = &trace->records[trace->written++ & trace->mask];
+    r->cycle  = trace->cycle;
+    r->pc     = chip8->PC;
+    r->opcode = chip8->opcode;
+    r->I      = chip8->IndexRegister;
+    r->reg    = 0;
+    r->value  = 0;
+    Chip8TraceDump(chip8, trace->fault_path);
+}
+
+void Chip8TraceDecode(const uint8_t buf[TRACE_RECORD_SIZE], Chip8TraceRecord* record){
+    record->cycle  = get(buf, 8);
+    record->pc     = (uint16_t) get(buf + 8, 2);
+    record->opcode = (uint16_t) get(buf + 10, 2);
+    record->I      = (uint16_t) get(buf + 12, 2);
+    record->reg    = buf[14];
+    record->value  = buf[15];
+}
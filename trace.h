@@ -0,0 +1,77 @@
+// Execution trace. While a machine has it enabled, Chip8Run writes a 16 byte
+// record per instruction into a ring, so the last N instructions before
+// anything interesting are always at hand. Nothing is formatted while it
+// runs: the ring is dumped to a binary file on demand, or by itself when
+// the machine hits an unknown opcode, and chip8_tracedump (tracedump.c)
+// turns the file into text.
+//
+// Like the counters in stats.h, it costs one pointer check per Chip8Run
+// call while off. While on, Chip8Run steps EmulateCycle without idle
+// skipping, so every instruction lands in the ring.
+//
+// The ring has a single writer, the thread running the machine, and takes
+// no locks. Dump it from that thread, between Chip8Run calls.
+
+#ifndef CHIP_8_TRACE
+#define CHIP_8_TRACE
+
+#include "chip8.h"
+
+#define TRACE_DEFAULT_RECORDS   (1u << 16)
+
+#define TRACE_MAGIC             "C8TR"
+#define TRACE_VERSION           1
+#define TRACE_HEADER_SIZE       16
+#define TRACE_RECORD_SIZE       16
+
+// reg in a record: the low 4 bits say which register, if any, changed
+#define TRACE_REG_CHANGED       0x10            // a register changed, value is its new value
+#define TRACE_REG_MORE          0x20            // and others did too (VF, Fx65, ...)
+
+typedef struct
+{
+    uint64_t    cycle;                          // chip8->cycles clock when it ran
+    uint16_t    pc;
+    uint16_t    opcode;
+    uint16_t    I;                              // after the instruction
+    uint8_t     reg;                            // see TRACE_REG_*
+    uint8_t     value;
+} Chip8TraceRecord;
+
+struct Chip8Trace
+{
+    Chip8TraceRecord*   records;
+    uint32_t            mask;                   // capacity - 1, capacity is a power of two
+    uint64_t            written;                // records ever written, the newest is written - 1
+    uint64_t            cycle;                  // clock of the instruction running now
+    char*               fault_path;             // dumped here on a fault, NULL = don't
+};
+
+// Enable sets up a ring of at least `records` records (rounded up to a power
+// of two), which is dumped to fault_path if the machine faults. fault_path
+// may be NULL and is copied. Does nothing if tracing is on already. Disable
+// before freeing a machine that has it on.
+void Chip8EnableTrace(CHIP8* chip8, uint32_t records, const char* fault_path);
+void Chip8DisableTrace(CHIP8* chip8);
+
+// Adds a record for the instruction at pc that just ran, at trace->cycle.
+// before is V0-VF from before it ran.
+void Chip8TraceStep(CHIP8* chip8, uint16_t pc, const uint8_t before[16]);
+
+// Writes the ring, oldest record first, in the format below. Says why on
+// stderr and returns false if the file can't be written.
+//
+//     "C8TR" | version (4) | record count (4) | reserved (4)
+//     records: cycle (8) | pc (2) | opcode (2) | I (2) | reg (1) | value (1)
+//
+// All little-endian.
+bool Chip8TraceDump(const CHIP8* chip8, const char* path);
+
+// Called on a fault with the PC on the bad instruction: records it and
+// dumps to fault_path, if there is a trace and a path
+void Chip8TraceFault(CHIP8* chip8);
+
+// Reads one record back out of a dump
+void Chip8TraceDecode(const uint8_t buf[TRACE_RECORD_SIZE], Chip8TraceRecord* record);
+
+#endif
@@ -0,0 +1,94 @@
+// Turns a trace dump (trace.h) into text, one instruction per line:
+//
+//     cycle        pc     opcode  instruction       I      change
+//     1234567      0x23c  e7a1    SKNP V7           0x2f0  V7=0x12
+//
+// Usage: ./chip8_tracedump [-n <last>] <trace>
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "chip8.h"
+#include "disasm.h"
+#include "trace.h"
+
+#include <unistd.h>
+
+static void usage(){
+    fprintf(stderr,
+        "Usage: ./chip8_tracedump [-n <last>] <trace>\n"
+        "  -n <last>      only the last this many instructions\n");
+    exit(2);
+}
+
+int main(int argc, char* argv[])
+{
+    uint64_t last = 0;
+    uint8_t buf[TRACE_HEADER_SIZE > TRACE_RECORD_SIZE ? TRACE_HEADER_SIZE : TRACE_RECORD_SIZE];
+    uint32_t version, count;
+    FILE* fptr;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': last = strtoull(optarg, NULL, 10); break;
+            default: usage();
+        }
+    }
+    if (optind != argc - 1)
+    {
+        usage();
+    }
+
+    fptr = fopen(argv[optind], "rb");
+    if (fptr == NULL)
+    {
+        fprintf(stderr, "Unable to open trace: %s\n", argv[optind]);
+        exit(2);
+    }
+    if (fread(buf, 1, TRACE_HEADER_SIZE, fptr) != TRACE_HEADER_SIZE ||
+        memcmp(buf, TRACE_MAGIC, 4) != 0)
+    {
+        fprintf(stderr, "Not a trace: %s\n", argv[optind]);
+        exit(2);
+    }
+    version = buf[4] | buf[5] << 8 | buf[6] << 16 | (uint32_t) buf[7] << 24;
+    count   = buf[8] | buf[9] << 8 | buf[10] << 16 | (uint32_t) buf[11] << 24;
+    if (version != TRACE_VERSION)
+    {
+        fprintf(stderr, "Trace version %u, this build reads %d\n", (unsigned) version, TRACE_VERSION);
+        exit(2);
+    }
+    if (last > 0 && last < count)
+    {
+        fseek(fptr, (long) (count - last) * TRACE_RECORD_SIZE, SEEK_CUR);
+        count = (uint32_t) last;
+    }
+
+    printf("%-12s %-6s %-7s %-17s %-6s %s\n", "cycle", "pc", "opcode", "instruction", "I", "change");
+    for (uint32_t i = 0; i < count; i++)
+    {
+        Chip8TraceRecord r;
+        char text[DISASM_MAX];
+
+        if (fread(buf, 1, TRACE_RECORD_SIZE, fptr) != TRACE_RECORD_SIZE)
+        {
+            fprintf(stderr, "Trace ends early, after %u of %u records\n", (unsigned) i, (unsigned) count);
+            exit(1);
+        }
+        Chip8TraceDecode(buf, &r);
+        Chip8Disassemble(r.opcode, text);
+
+        printf("%-12llu 0x%03x  %04x    %-17s 0x%03x", (unsigned long long) r.cycle, r.pc,
+               r.opcode, text, r.I);
+        if (r.reg & TRACE_REG_CHANGED)
+        {
+            printf("  V%X=0x%02x%s", r.reg & 0xF, r.value, r.reg & TRACE_REG_MORE ? " +more" : "");
+        }
+        printf("\n");
+    }
+
+    fclose(fptr);
+    return 0;
+}